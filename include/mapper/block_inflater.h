@@ -0,0 +1,80 @@
+/* Copyright (c) 2017, United States Government, as represented by the
+ * Administrator of the National Aeronautics and Space Administration.
+ *
+ * All rights reserved.
+ *
+ * The Astrobee platform is licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with the
+ * License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+#pragma once
+
+#include <octomap/octomap.h>
+#include <Eigen/Dense>
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+#include "mapper/worker_pool.h"
+
+namespace octoclass {
+
+// Computes the inflation counts of a whole map at once. Occupied nodes are
+// binned into dense blocks, and each block of output counts is computed
+// from its padded neighbourhood: rows of occupancy along x are turned into
+// prefix sums, so that the ellipsoidal stencil reduces to one difference per
+// (y, z) row of the stencil instead of one lookup per stencil node. Blocks
+// are independent and are split between threads
+class BlockInflater {
+ public:
+    BlockInflater() {}
+
+    // Stencil offsets (must be symmetric and contiguous along x, as ellipsoids are).
+    // Counts are bounded by the stencil size, which must fit in 16 bits
+    void SetStencil(const std::vector<Eigen::Vector3i> &stencil);
+
+    // Count, for every node within the stencil of an occupied key, the number
+    // of occupied keys whose stencil covers it (keys must be unique).
+    // Only nodes with positive counts are returned
+    void Inflate(const std::vector<octomap::OcTreeKey> &occupied,
+                 WorkerPool *pool,
+                 std::vector<octomap::OcTreeKey> *keys,
+                 std::vector<uint16_t> *counts);
+
+ private:
+    static const int kBlockBits = 5;  // Blocks of 32^3 nodes
+    static const int kBlockSize = 1 << kBlockBits;
+
+    // Stencil row at offset (dy, dz) covering dx in [-half_width, half_width]
+    struct Row {
+        int dy, dz, half_width;
+    };
+    std::vector<Row> rows_;
+    Eigen::Vector3i max_offset_ = Eigen::Vector3i::Zero();
+
+    // Occupied nodes of each block (local coordinates packed in 5 bits each)
+    std::unordered_map<uint64_t, std::vector<uint16_t> > occupied_blocks_;
+    std::vector<uint64_t> output_blocks_;
+    std::vector<std::vector<octomap::OcTreeKey> > thread_keys_;
+    std::vector<std::vector<uint16_t> > thread_counts_;
+
+    static uint64_t PackBlock(const int &x, const int &y, const int &z) {
+        return static_cast<uint64_t>(x) | (static_cast<uint64_t>(y) << 21) | (static_cast<uint64_t>(z) << 42);
+    }
+    // Count the output blocks in [first, last)
+    void InflateChunk(const size_t &first,
+                      const size_t &last,
+                      std::vector<octomap::OcTreeKey> *keys,
+                      std::vector<uint16_t> *counts) const;
+};
+
+}  // namespace octoclass
@@ -0,0 +1,108 @@
+/* Copyright (c) 2017, United States Government, as represented by the
+ * Administrator of the National Aeronautics and Space Administration.
+ *
+ * All rights reserved.
+ *
+ * The Astrobee platform is licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with the
+ * License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+#pragma once
+
+#include <octomap/octomap.h>
+#include <octomap/OcTree.h>
+#include <stdint.h>
+#include <vector>
+
+#include "mapper/fading_octree.h"
+#include "mapper/merged_octree.h"
+
+namespace octoclass {
+
+// Applies many node updates to an occupancy octree at once. Updates are sorted in
+// Morton order, so consecutive updates share most of their path from the
+// root and the tree is only walked down from where the paths diverge. Leaves
+// are updated lazily and each inner node on a touched path is refreshed once,
+// after all updates below it have been applied. That same pass can prune the
+// touched nodes, so the cost scales with the update and not with the map.
+// Buffers are reused from one batch to the next.
+class BulkUpdater {
+ public:
+    BulkUpdater() {}
+
+    // Queue updates (the tree is not touched until Apply)
+    void Clear();
+    void AddHits(const std::vector<octomap::OcTreeKey> &keys);    // Same as updateNode(key, true)
+    void AddMisses(const std::vector<octomap::OcTreeKey> &keys);  // Same as updateNode(key, false)
+    // Set the log-odds of the node at a depth, replacing whatever was below it
+    // (clamped to the clamping thresholds of the tree it is applied to)
+    void AddLeaf(const octomap::OcTreeKey &key,
+                 const unsigned &depth,
+                 const float &log_odds);
+    // Add delta to the inflation count of each key (only used by MergedOcTree)
+    void AddInflation(const std::vector<octomap::OcTreeKey> &keys,
+                      const int &delta);
+    void AddInflation(const std::vector<octomap::OcTreeKey> &keys,  // One delta per key
+                      const std::vector<uint16_t> &deltas);
+
+    // Apply queued updates. Updates to the same node keep the order they were
+    // added in, and a node set with AddLeaf is updated before any node below it.
+    // If prune is set, collapsible ancestors of the updates are pruned.
+    // Instantiated for OcTree, FadingOcTree and MergedOcTree
+    template <typename TREE>
+    void Apply(TREE *tree, const bool &prune = false);
+
+    size_t Size() const { return entries_.size(); }
+
+    // Keys whose occupancy changed in the last Apply on a MergedOcTree, counting
+    // the net effect of all updates on each key: slim occupancy for hits and
+    // misses, inflated occupancy for inflation updates
+    const std::vector<octomap::OcTreeKey>& BecameOccupied() const { return became_occupied_; }
+    const std::vector<octomap::OcTreeKey>& BecameFree() const { return became_free_; }
+    // Keys that were unknown in the slim map before the hits and misses of the last Apply
+    const std::vector<octomap::OcTreeKey>& BecameKnown() const { return became_known_; }
+
+    // Morton code of a key (x in the lowest bit of each 3-bit group)
+    static uint64_t MortonCode(const octomap::OcTreeKey &key);
+
+ private:
+    enum Kind { kHit, kMiss, kSet, kInflate };
+    struct Entry {
+        uint64_t code;
+        octomap::OcTreeKey key;
+        float log_odds;  // Only used by kSet (and by kInflate, as the count delta)
+        uint8_t depth;
+        uint8_t kind;
+
+        // Nodes above the leaves sort at the start of their subtree, before their descendants
+        bool operator<(const Entry &rhs) const {
+            return (code < rhs.code) || ((code == rhs.code) && (depth < rhs.depth));
+        }
+    };
+
+    std::vector<Entry> entries_;
+    std::vector<octomap::AbstractOcTreeNode*> path_;  // Nodes from the root to the current update
+    std::vector<bool> created_;  // Node in path_ was created while descending for the current update
+    std::vector<octomap::OcTreeKey> became_occupied_, became_free_, became_known_;
+    bool prune_ = false;
+
+    // Refresh inner nodes in path_ from from_depth up to to_depth (inclusive)
+    template <typename TREE>
+    void RefreshPath(TREE *tree,
+                     const unsigned &from_depth,
+                     const unsigned &to_depth);
+    // Delete all nodes below a node
+    template <typename TREE>
+    static void DeleteChildren(TREE *tree, typename TREE::NodeType *node);
+};
+
+}  // namespace octoclass
@@ -0,0 +1,113 @@
+// Copyright (c) 2020 by Pensa Systems, Inc. -- All rights reserved
+// Confidential and Proprietary
+
+#pragma once
+
+#include <sensor_msgs/PointCloud2.h>
+
+#include <cstring>
+#include <string>
+
+namespace cloud_view {
+
+// Read-only access to the x/y/z fields of a PointCloud2 message.
+// Points are read straight from the message's byte buffer, so the
+// message is never converted or copied into a pcl::PointCloud
+class XYZView {
+ public:
+    XYZView() {}
+
+    // Locate the x/y/z fields within the message. The view is only valid if
+    // all three are FLOAT32 fields that fit within a point, the byte order
+    // matches the host, and the buffer holds every row. Invalid clouds have
+    // to be converted instead (see pcl_conversions::FromROSMsg)
+    explicit XYZView(const sensor_msgs::PointCloud2 &cloud) {
+        bool has_x = false, has_y = false, has_z = false;
+        bool fields_ok = true;
+        for (uint i = 0; i < cloud.fields.size(); i++) {
+            const sensor_msgs::PointField &field = cloud.fields[i];
+            uint32_t *offset;
+            if ((field.name == "x") || (field.name == "X")) {
+                offset = &off_x_;
+                has_x = true;
+            } else if ((field.name == "y") || (field.name == "Y")) {
+                offset = &off_y_;
+                has_y = true;
+            } else if ((field.name == "z") || (field.name == "Z")) {
+                offset = &off_z_;
+                has_z = true;
+            } else {
+                continue;
+            }
+            if ((field.datatype != sensor_msgs::PointField::FLOAT32) ||
+                (static_cast<uint64_t>(field.offset) + sizeof(float) > cloud.point_step)) {
+                fields_ok = false;
+            }
+            *offset = field.offset;
+        }
+        const bool layout_ok =
+            (static_cast<uint64_t>(cloud.width)*cloud.point_step <= cloud.row_step) &&
+            (static_cast<uint64_t>(cloud.row_step)*cloud.height <= cloud.data.size());
+        has_xyz_fields_ = has_x && has_y && has_z;
+        valid_ = has_xyz_fields_ && fields_ok && layout_ok &&
+                 ((cloud.is_bigendian != 0) == HostIsBigEndian());
+        data_ = cloud.data.data();
+        width_ = cloud.width;
+        height_ = cloud.height;
+        point_step_ = cloud.point_step;
+        row_step_ = cloud.row_step;
+    }
+
+    // View over an array of n points, with x, y, z as the first three floats
+    // of every point_step bytes (tightly packed by default)
+    XYZView(const float *xyz, const uint32_t &n_points,
+            const uint32_t &point_step = 3*sizeof(float)) {
+        data_ = reinterpret_cast<const uint8_t*>(xyz);
+        width_ = n_points;
+        height_ = 1;
+        point_step_ = point_step;
+        row_step_ = n_points*point_step_;
+        off_x_ = 0;
+        off_y_ = sizeof(float);
+        off_z_ = 2*sizeof(float);
+        has_xyz_fields_ = true;
+        valid_ = true;
+    }
+
+    bool IsValid() const { return valid_; }
+    bool HasXYZFields() const { return has_xyz_fields_; }  // Even if they cannot be read in place
+    uint32_t Width() const { return width_; }
+    uint32_t Height() const { return height_; }
+    uint32_t Size() const { return width_*height_; }
+
+    // Pointer to the first byte of point (row, col)
+    const uint8_t* PointData(const uint32_t &row, const uint32_t &col) const {
+        return data_ + row*row_step_ + col*point_step_;
+    }
+
+    // Coordinates of point (row, col). memcpy avoids unaligned float reads
+    void GetPoint(const uint32_t &row, const uint32_t &col,
+                  float *x, float *y, float *z) const {
+        const uint8_t *ptr = PointData(row, col);
+        std::memcpy(x, ptr + off_x_, sizeof(float));
+        std::memcpy(y, ptr + off_y_, sizeof(float));
+        std::memcpy(z, ptr + off_z_, sizeof(float));
+    }
+
+ private:
+    static bool HostIsBigEndian() {
+        const uint16_t one = 1;
+        uint8_t first_byte;
+        std::memcpy(&first_byte, &one, 1);
+        return first_byte == 0;
+    }
+
+    const uint8_t *data_ = NULL;
+    uint32_t width_ = 0, height_ = 0;
+    uint32_t point_step_ = 0, row_step_ = 0;
+    uint32_t off_x_ = 0, off_y_ = 0, off_z_ = 0;
+    bool has_xyz_fields_ = false;
+    bool valid_ = false;
+};
+
+}  // namespace cloud_view
@@ -0,0 +1,91 @@
+/* Copyright (c) 2017, United States Government, as represented by the
+ * Administrator of the National Aeronautics and Space Administration.
+ *
+ * All rights reserved.
+ *
+ * The Astrobee platform is licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with the
+ * License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+#pragma once
+
+#include <octomap/octomap.h>
+#include <Eigen/Dense>
+#include <stdint.h>
+#include <functional>
+#include <queue>
+#include <utility>
+#include <vector>
+
+namespace octoclass {
+
+// Euclidean distance field over a dense box of octree keys, updated
+// incrementally as obstacles appear and disappear (dynamic brushfire of
+// Lau et al.: each cell stores its nearest obstacle, and raise/lower waves
+// repair only the cells affected by a change). Distances are propagated
+// up to a maximum distance, which bounds the cost of each change
+class DistanceField {
+ public:
+    DistanceField() {}
+
+    // Box of size cells centered at center_key, propagating up to max_distance (meters).
+    // All obstacles are cleared
+    void Reset(const octomap::OcTreeKey &center_key,
+               const Eigen::Vector3i &half_size,
+               const double &resolution,
+               const double &max_distance);
+    void Clear();  // Remove all obstacles (and disable the field)
+
+    bool IsEnabled() const { return !cells_.empty(); }
+    bool Contains(const octomap::OcTreeKey &key) const;
+    const octomap::OcTreeKey& Center() const { return center_key_; }
+    double MaxDistance() const { return max_distance_; }
+
+    // Queue changes (keys outside the box are ignored). They take effect in Update
+    void SetObstacle(const octomap::OcTreeKey &key);
+    void RemoveObstacle(const octomap::OcTreeKey &key);
+    void Update();
+
+    // Distance from the center of key to the nearest obstacle. Returns false
+    // if key is outside the box or no obstacle is within the max distance
+    bool Distance(const octomap::OcTreeKey &key,
+                  double *distance,
+                  octomap::OcTreeKey *nearest) const;
+    // Gradient of the distance at key (central differences, meters per meter)
+    bool Gradient(const octomap::OcTreeKey &key,
+                  Eigen::Vector3d *gradient) const;
+
+ private:
+    static const uint32_t kInfinity = 0xFFFFFFFF;
+    struct Cell {
+        int32_t site;       // Index of the nearest obstacle cell (-1 if none)
+        uint32_t dist_sqr;  // Squared distance to it (in cells)
+        bool occupied;
+        bool raise;         // Waiting to clear the cells that pointed to a removed obstacle
+    };
+
+    std::vector<Cell> cells_;
+    octomap::OcTreeKey center_key_, min_key_;
+    Eigen::Vector3i size_ = Eigen::Vector3i::Zero();
+    double resolution_ = 0.0, max_distance_ = 0.0;
+    uint32_t max_dist_sqr_ = 0;
+    typedef std::pair<uint32_t, int32_t> QueueEntry;  // (squared distance, cell)
+    std::priority_queue<QueueEntry, std::vector<QueueEntry>, std::greater<QueueEntry> > open_;
+
+    int32_t Index(const octomap::OcTreeKey &key) const;  // -1 if outside the box
+    Eigen::Vector3i Coords(const int32_t &index) const;
+    void ProcessRaise(const int32_t &index);
+    void ProcessLower(const int32_t &index);
+    double CellDistance(const int32_t &index) const;  // Capped at the max distance
+};
+
+}  // namespace octoclass
@@ -0,0 +1,128 @@
+/* Copyright (c) 2017, United States Government, as represented by the
+ * Administrator of the National Aeronautics and Space Administration.
+ *
+ * All rights reserved.
+ *
+ * The Astrobee platform is licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with the
+ * License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+#pragma once
+
+#include <octomap/octomap.h>
+#include <octomap/OccupancyOcTreeBase.h>
+#include <stdint.h>
+#include <chrono>
+#include <string>
+
+namespace octoclass {
+
+// Occupancy node that also stores when its memory runs out. Inner nodes
+// hold the earliest expiry of their subtree, so expired nodes can be found
+// without visiting the rest of the tree. Pruned leaves hold the latest
+// expiry of the children they replaced
+class FadingNode : public octomap::OcTreeNode {
+ public:
+    static const uint32_t kNeverExpires = 0xFFFFFFFF;
+
+    FadingNode() : OcTreeNode(), expiry_(kNeverExpires) {}
+    // Deep copy (the base class would copy the children as base class nodes)
+    FadingNode(const FadingNode &rhs);
+
+    // Only occupancy is compared, so that nodes updated at different times
+    // can still be pruned (see FadingOcTree::pruneNode)
+    bool operator==(const FadingNode &rhs) const {
+        return rhs.value == value;
+    }
+    void copyData(const FadingNode &from) {
+        OcTreeNode::copyData(from);
+        expiry_ = from.expiry_;
+    }
+
+    uint32_t GetExpiry() const { return expiry_; }  // Ticks of the owning tree
+    void SetExpiry(const uint32_t &expiry) { expiry_ = expiry; }
+
+    // Most occupied child and earliest expiry among children
+    void updateOccupancyChildren();
+
+ protected:
+    uint32_t expiry_;
+};
+
+// Occupancy octree with lazy memory fading. Instead of decaying every leaf
+// on a timer, each node stores the time at which fading makes it cross the
+// occupancy threshold. Decay is applied when a node gets updated, and
+// DeleteExpired only descends into subtrees holding expired nodes.
+// A saturated node is forgotten memory_time seconds after its last update.
+class FadingOcTree : public octomap::OccupancyOcTreeBase<FadingNode> {
+ public:
+    explicit FadingOcTree(double resolution);
+    FadingOcTree* create() const { return new FadingOcTree(resolution); }
+    std::string getTreeType() const { return "FadingOcTree"; }
+
+    // Fading memory time in seconds (<= 0: never forget)
+    void SetMemoryTime(const double &memory_time);
+    double GetMemoryTime() const { return memory_time_; }
+
+    // Thresholds set the fading rates. Before changing them, ApplyDecay stores
+    // the decay accumulated so far into each node; afterwards, RefreshExpiry
+    // recomputes the expiries from the stored values
+    void ApplyDecay();
+    void RefreshExpiry();
+
+    // Applies the decay accumulated since the last update before the new one
+    virtual void updateNodeLogOdds(FadingNode *node, const float &update) const;
+
+    // Set the log-odds of a node as of now
+    void SetNodeLogOdds(FadingNode *node, const float &log_odds) const;
+
+    // Log-odds with fading applied up to now (0 once the node expired)
+    float DecayedLogOdds(const FadingNode *node) const;
+
+    // Same as isNodeOccupied, but expired leaves that were not deleted yet are
+    // not occupied. Inner nodes are occupied if any of their leaves might be
+    bool IsNodeOccupied(const FadingNode *node) const;
+
+    // Delete every node whose memory ran out. Returns the number of deleted nodes
+    size_t DeleteExpired();
+
+    // Prunes children with the same occupancy into a leaf that expires with
+    // the last of them. Nodes with expired children are not pruned
+    virtual bool pruneNode(FadingNode *node);
+
+ protected:
+    static const uint32_t kTicksPerSecond = 10;
+
+    double memory_time_;
+    std::chrono::steady_clock::time_point epoch_;  // Tick 0
+
+    uint32_t Now() const;
+    float DecayedLogOdds(const FadingNode *node, const uint32_t &now) const;
+    uint32_t ExpiryOf(const float &log_odds, const uint32_t &now) const;
+    // Returns true if the whole node expired (the caller deletes it)
+    bool DeleteExpiredRecurs(FadingNode *node, const uint32_t &now, size_t *n_deleted);
+    void RefreshExpiryRecurs(FadingNode *node, const uint32_t &now, const bool &decay);
+
+    // Registers this tree type, so that files written from it can be read back
+    class StaticMemberInitializer {
+     public:
+        StaticMemberInitializer() {
+            FadingOcTree *tree = new FadingOcTree(0.1);
+            tree->clearKeyRays();
+            octomap::AbstractOcTree::registerTreeType(tree);
+        }
+        void ensureLinking() {}
+    };
+    static StaticMemberInitializer fading_octree_member_init_;
+};
+
+}  // namespace octoclass
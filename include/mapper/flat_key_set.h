@@ -0,0 +1,152 @@
+/* Copyright (c) 2017, United States Government, as represented by the
+ * Administrator of the National Aeronautics and Space Administration.
+ *
+ * All rights reserved.
+ *
+ * The Astrobee platform is licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with the
+ * License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+#pragma once
+
+#include <octomap/octomap.h>
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+
+namespace octoclass {
+
+// Set of octomap keys stored in a flat open-addressing table (linear probing).
+// Keys are packed into the lower 48 bits of a slot, and the upper 16 bits hold
+// the generation in which the slot was written. Clear() just bumps the
+// generation, so the storage is reused from one point cloud to the next and
+// no allocation takes place once the set has reached its high-water mark.
+// Inserted keys are also kept in a dense vector for fast iteration.
+class FlatKeySet {
+ public:
+    typedef std::vector<octomap::OcTreeKey>::const_iterator const_iterator;
+
+    FlatKeySet() {}
+    explicit FlatKeySet(const size_t &expected_size) { Reserve(expected_size); }
+
+    // Returns true if the key was not in the set (insertion took place)
+    bool Insert(const octomap::OcTreeKey &key) {
+        if (2*(keys_.size() + 1) > slots_.size()) {
+            Grow(2*(keys_.size() + 1));
+        }
+        if (InsertSlot(Pack(key))) {
+            keys_.push_back(key);
+            return true;
+        }
+        return false;
+    }
+
+    // Insert all keys from another set
+    void Insert(const FlatKeySet &other) {
+        for (const_iterator it = other.begin(); it != other.end(); ++it) {
+            Insert(*it);
+        }
+    }
+
+    bool Contains(const octomap::OcTreeKey &key) const {
+        if (keys_.empty()) {
+            return false;
+        }
+        const uint64_t tagged = (generation_ << kKeyBits) | Pack(key);
+        for (size_t i = Hash(Pack(key)); ; i = (i + 1) & mask_) {
+            const uint64_t slot = slots_[i];
+            if (slot == tagged) {
+                return true;
+            } else if ((slot >> kKeyBits) != generation_) {
+                return false;
+            }
+        }
+    }
+
+    // Empty the set while keeping its storage
+    void Clear() {
+        keys_.clear();
+        generation_++;
+        if (generation_ > kMaxGeneration) {  // Generation wrapped: wipe the table
+            std::fill(slots_.begin(), slots_.end(), 0);
+            generation_ = 1;
+        }
+    }
+
+    // Make room for n keys without growing
+    void Reserve(const size_t &n) {
+        keys_.reserve(n);
+        if (2*n > slots_.size()) {
+            Grow(2*n);
+        }
+    }
+
+    size_t Size() const { return keys_.size(); }
+    bool Empty() const { return keys_.empty(); }
+    const std::vector<octomap::OcTreeKey>& Keys() const { return keys_; }
+    const_iterator begin() const { return keys_.begin(); }
+    const_iterator end() const { return keys_.end(); }
+
+ private:
+    static const int kKeyBits = 48;
+    static const uint64_t kMaxGeneration = 0xFFFF;
+
+    std::vector<uint64_t> slots_;  // (generation << 48) | packed key
+    std::vector<octomap::OcTreeKey> keys_;  // Keys in insertion order
+    uint64_t generation_ = 1;  // Slots from older generations are empty
+    size_t mask_ = 0;
+    int shift_ = 64;
+
+    static uint64_t Pack(const octomap::OcTreeKey &key) {
+        return static_cast<uint64_t>(key.k[0])
+            | (static_cast<uint64_t>(key.k[1]) << 16)
+            | (static_cast<uint64_t>(key.k[2]) << 32);
+    }
+
+    // Fibonacci hashing: uses the top bits of the product as table index
+    size_t Hash(const uint64_t &packed) const {
+        return static_cast<size_t>((packed*0x9E3779B97F4A7C15ULL) >> shift_);
+    }
+
+    // Returns false if the key was already in the table
+    bool InsertSlot(const uint64_t &packed) {
+        const uint64_t tagged = (generation_ << kKeyBits) | packed;
+        for (size_t i = Hash(packed); ; i = (i + 1) & mask_) {
+            const uint64_t slot = slots_[i];
+            if (slot == tagged) {
+                return false;
+            } else if ((slot >> kKeyBits) != generation_) {
+                slots_[i] = tagged;
+                return true;
+            }
+        }
+    }
+
+    // Resize table to the next power of two >= min_slots and rehash current keys
+    void Grow(const size_t &min_slots) {
+        size_t n_slots = 64;
+        int log_slots = 6;
+        while (n_slots < min_slots) {
+            n_slots *= 2;
+            log_slots++;
+        }
+        slots_.assign(n_slots, 0);
+        mask_ = n_slots - 1;
+        shift_ = 64 - log_slots;
+        generation_ = 1;
+        for (const_iterator it = keys_.begin(); it != keys_.end(); ++it) {
+            InsertSlot(Pack(*it));
+        }
+    }
+};
+
+}  // namespace octoclass
@@ -45,6 +45,6 @@ void FindNearestCollision(const std::vector<octomap::point3d> &colliding_nodes,
                           geometry_msgs::Point *nearest_node,
                           double *min_dist);
 
-struct timespec TimeFromNow(const uint& increment_sec);
+struct timespec TimeFromNow(const double& increment_sec);
 
 }  // namespace helper
@@ -18,6 +18,7 @@
 
 #pragma once
 
+#include <algorithm>
 #include <vector>
 #include <string>
 #include "mapper/visualization_functions.h"
@@ -49,7 +50,7 @@ class Line3d{
 
         // Optimal t is the t at which the point is closest to the line
         // t_opt = (x1-x2)'*(x1-p)/norm(x1-x2)^2;
-        static double t_opt;
+        double t_opt;
         if (x1 == x2) {
             t_opt = 0;
         } else {
@@ -90,7 +91,7 @@ class LineSegment3d{
 
         // Optimal t is the t at which the point is closest to the line
         // t_opt = (x1-x2)'*(x1-p)/norm(x1-x2)^2;
-        static double t_opt;
+        double t_opt;
         if (x1 == x2) {
             t_opt = 0;
         } else {
@@ -236,6 +237,14 @@ class FrustumPlanes{
         }
     }
 
+    // Smallest distance from a point to the frustum planes (negative if outside)
+    double DistanceToBoundary(const Eigen::Vector3d &pt) const {
+        return std::min(std::min((pt - left_plane_.origin_).dot(left_plane_.normal_),
+                                 (pt - right_plane_.origin_).dot(right_plane_.normal_)),
+                        std::min((pt - up_plane_.origin_).dot(up_plane_.normal_),
+                                 (pt - down_plane_.origin_).dot(down_plane_.normal_)));
+    }
+
     // Return visualization markers frustum visualization
     void VisualizeFrustum(const std::string &frame_id,
                           visualization_msgs::Marker *line_list) {
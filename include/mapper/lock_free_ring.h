@@ -0,0 +1,118 @@
+/* Copyright (c) 2017, United States Government, as represented by the
+ * Administrator of the National Aeronautics and Space Administration.
+ *
+ * All rights reserved.
+ *
+ * The Astrobee platform is licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with the
+ * License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <utility>
+
+namespace mapper {
+
+// Bounded lock-free ring buffer (Dmitry Vyukov's MPMC queue). Each cell has
+// a sequence number that tells producers and consumers whether the cell is
+// free to write or ready to read, so neither side ever takes a lock.
+// Elements are moved in and out: no copies of the stored data are made.
+template <typename T>
+class LockFreeRing {
+ public:
+    explicit LockFreeRing(const size_t &capacity = 2) {
+        Reset(capacity);
+    }
+
+    // Set capacity (rounded up to a power of two) and empty the ring.
+    // Not thread safe: call it before producers and consumers start
+    void Reset(const size_t &capacity) {
+        size_t n_cells = 2;
+        while (n_cells < capacity) {
+            n_cells *= 2;
+        }
+        cells_.reset(new Cell[n_cells]);
+        mask_ = n_cells - 1;
+        for (size_t i = 0; i < n_cells; i++) {
+            cells_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+        enqueue_pos_.store(0, std::memory_order_relaxed);
+        dequeue_pos_.store(0, std::memory_order_relaxed);
+    }
+
+    // Returns false if the ring is full (item is left untouched)
+    bool TryPush(T &&item) {
+        Cell *cell;
+        size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+        while (true) {
+            cell = &cells_[pos & mask_];
+            const size_t seq = cell->sequence.load(std::memory_order_acquire);
+            const intptr_t dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (dif == 0) {  // Cell is free: try to claim it
+                if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (dif < 0) {  // Cell still holds an unread element
+                return false;
+            } else {  // Another producer claimed this cell
+                pos = enqueue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+        cell->data = std::move(item);
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Returns false if the ring is empty
+    bool TryPop(T *item) {
+        Cell *cell;
+        size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+        while (true) {
+            cell = &cells_[pos & mask_];
+            const size_t seq = cell->sequence.load(std::memory_order_acquire);
+            const intptr_t dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+            if (dif == 0) {  // Cell is ready: try to claim it
+                if (dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (dif < 0) {  // Cell has not been written yet
+                return false;
+            } else {  // Another consumer claimed this cell
+                pos = dequeue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+        *item = std::move(cell->data);
+        cell->sequence.store(pos + mask_ + 1, std::memory_order_release);
+        return true;
+    }
+
+    size_t Capacity() const { return mask_ + 1; }
+
+ private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T data;
+    };
+
+    // Producer and consumer positions are padded into different cache lines
+    std::unique_ptr<Cell[]> cells_;
+    size_t mask_;
+    char pad0_[64];
+    std::atomic<size_t> enqueue_pos_;
+    char pad1_[64];
+    std::atomic<size_t> dequeue_pos_;
+};
+
+}  // namespace mapper
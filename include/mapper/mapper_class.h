@@ -61,8 +61,11 @@
 // Classes
 #include "mapper/tf_class.h"
 #include "mapper/octoclass.h"
+#include "mapper/shifted_keys.h"
 #include "mapper/polynomials.h"
 #include "mapper/sampled_trajectory.h"
+#include "mapper/voxel_downsampler.h"
+#include "mapper/pcl_scheduler.h"
 
 // Data structures
 #include "mapper/structs.h"
@@ -89,8 +92,16 @@ class MapperClass {
   bool RobotPosProjectedOnTrajectory(const geometry_msgs::Point& robot_position,
                                      geometry_msgs::Point *robot_projected_on_traj);
 
-  void GetCollidingNodesPcl(const pcl::PointCloud<pcl::PointXYZ>& pcl,
-                            std::vector<octomap::point3d> *colliding_nodes);
+  // Discretize the trajectory points into keys of the map
+  void DiscretizeTrajectory(const pcl::PointCloud<pcl::PointXYZ>& pcl,
+                            octoclass::ShiftedKeys *keys);
+
+  // Appends the keys that collide with the inflated map
+  void GetCollidingKeys(const std::vector<octomap::OcTreeKey> &keys,
+                        std::vector<octomap::OcTreeKey> *colliding_keys);
+
+  void GetNodeCenters(const std::vector<octomap::OcTreeKey> &keys,
+                      std::vector<octomap::point3d> *centers);
 
   void GetOctomapResolution(double *octomap_resolution);
 
@@ -105,6 +116,20 @@ class MapperClass {
   void PublishRadiusMarkers(const Eigen::Vector3d &center,
                             const double &radius);
 
+  // Load "<prefix>_downsample_mode" and "<prefix>_downsample_voxel_size" lists
+  void LoadDownsampleParams(ros::NodeHandle *nh,
+                            const std::string &prefix,
+                            const uint &n_sensors,
+                            std::vector<point_filter::DownsampleParams> *params);
+
+  // Create one input slot per sensor, with queue capacity and
+  // "<prefix>_priority" list (priority defaults to 1)
+  void CreateSensorInputs(ros::NodeHandle *nh,
+                          const std::string &prefix,
+                          const std::vector<std::string> &topics,
+                          const int &queue_capacity,
+                          std::vector<std::unique_ptr<sensorInput> > *inputs);
+
   // Callbacks (see callbacks.cc for implementation) ----------------
   // Callback for handling incoming camera point cloud messages
   void CameraPclCallback(const sensor_msgs::PointCloud2::ConstPtr &msg,
@@ -114,6 +139,9 @@ class MapperClass {
   void LidarPclCallback(const sensor_msgs::PointCloud2::ConstPtr &msg,
                          const uint& cam_index);
 
+  // Push a point cloud into its sensor's queue (drops the oldest one if full)
+  void EnqueuePcl(stampedPcl *new_pcl);
+
   // Callback for handling incoming new trajectory messages (astrobee type - deprecated)
   void SegmentCallback(const mapper::Segment::ConstPtr &msg);
 
@@ -153,6 +181,9 @@ class MapperClass {
   // Load octomap
   bool LoadMap(std_srvs::Trigger::Request &req,
                std_srvs::Trigger::Response &res);
+  // Read the saved map into the octomap. Returns false, leaving the map
+  // untouched, if it could not be read (message says why)
+  bool ReadMapFiles(std::string *message);
 
   // Process PCL data or not
   bool OctomapProcessPCL(std_srvs::SetBool::Request &req,
@@ -185,6 +216,14 @@ class MapperClass {
   // Thread for getting pcl data and populating the octomap
   void OctomappingTask();
 
+  // Mapping worker: preprocesses clouds concurrently with the other workers,
+  // then applies its map update when its ticket comes up
+  void MappingWorker(const uint &worker_index);
+
+  // Block until the map update with this ticket is next. Returns false if the node is terminating
+  bool WaitForScanApplyTurn(const uint64_t &ticket);
+  void EndScanApplyTurn();  // Let the next ticket apply its update
+
   // Thread for getting keyboard messages
   void KeyboardTask();
 
@@ -214,6 +253,19 @@ class MapperClass {
   ros::ServiceServer map_inflation_srv_, reset_map_srv_;
   ros::ServiceServer save_map_srv_, load_map_srv_, process_pcl_srv_;
 
+  // Per-sensor downsampling parameters (indexed as the camera/lidar topics)
+  std::vector<point_filter::DownsampleParams> cam_downsample_, lidar_downsample_;
+
+  // Point cloud scheduling parameters
+  SchedulingPolicy pcl_scheduling_policy_;
+  double pcl_max_staleness_;
+
+  // Mapping pipeline (see OctomappingTask)
+  int mapping_workers_;
+  PclScheduler pcl_scheduler_;  // Protected by mutexes_.pcl_scheduler
+  uint64_t next_pcl_ticket_;    // Protected by mutexes_.pcl_scheduler
+  uint64_t next_apply_ticket_;  // Protected by mutexes_.scan_apply
+
   // Thread rates (hz)
   double tf_update_rate_, fading_memory_update_rate_, collision_check_rate_;
 
@@ -0,0 +1,185 @@
+/* Copyright (c) 2017, United States Government, as represented by the
+ * Administrator of the National Aeronautics and Space Administration.
+ *
+ * All rights reserved.
+ *
+ * The Astrobee platform is licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with the
+ * License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+#pragma once
+
+#include <octomap/octomap.h>
+#include <octomap/OcTreeBaseImpl.h>
+#include <octomap/OcTreeDataNode.h>
+#include <stdint.h>
+#include <string>
+
+namespace octoclass {
+
+// Views of the map stored in each MergedNode
+enum MapLayer {
+    kSlimLayer = 1,      // Occupancy as measured
+    kInflatedLayer = 2   // Occupancy with obstacles inflated by the robot size
+};
+
+// Quantized log-odds of the slim map and inflation count of the inflated map
+struct MergedValue {
+    static const int16_t kUnknown = INT16_MIN;  // Slim map was never observed in this node
+
+    int16_t slim;
+    uint16_t inflation;  // Number of occupied slim nodes whose inflation stencil covers this node
+
+    MergedValue() : slim(kUnknown), inflation(0) {}
+    bool operator==(const MergedValue &rhs) const {
+        return (slim == rhs.slim) && (inflation == rhs.inflation);
+    }
+};
+
+// Node holding the slim and the inflated map. A node is occupied in the
+// inflated map if its inflation count is positive, free if it is zero and
+// the slim map is known, and unknown otherwise. Inner nodes hold the max of
+// their children, and the mean of their children's free and occupied
+// fractions (missing children are unknown), so the volume of a box can be
+// computed without visiting the leaves inside it. Leaves derive their
+// fractions from their value, so the value (all that leaves need, and all
+// that is written to files) stays at 4 bytes
+class MergedNode : public octomap::OcTreeDataNode<MergedValue> {
+ public:
+    static const int kMaxInflation = 0xFFFF;  // Stencils may not have more nodes than this
+    static const uint16_t kWholeNode = 0xFFFF;  // Quantized fraction of a whole node
+
+    MergedNode() : OcTreeDataNode<MergedValue>(), free_(0), occupied_(0) {}
+    // Deep copy (the base class would copy the children as base class nodes)
+    MergedNode(const MergedNode &rhs);
+
+    // Setters are for leaves
+    int16_t GetSlim() const { return value.slim; }
+    void SetSlim(const int16_t &slim) { value.slim = slim; }
+    uint16_t GetInflation() const { return value.inflation; }
+    void SetInflation(const uint16_t &inflation) { value.inflation = inflation; }
+    float GetFreeFraction() const { return this->FreeUnits() / static_cast<float>(kWholeNode); }
+    float GetOccupiedFraction() const { return this->OccupiedUnits() / static_cast<float>(kWholeNode); }
+    bool IsKnown(const MapLayer &layer) const {
+        return (value.slim != MergedValue::kUnknown) || ((layer == kInflatedLayer) && (value.inflation > 0));
+    }
+
+    // Max of the children (mean for the fractions)
+    void updateOccupancyChildren();
+
+ private:
+    // Free and occupied fractions of the inflated map, in units of kWholeNode
+    uint16_t FreeUnits() const;
+    uint16_t OccupiedUnits() const;
+    bool IsLeaf() const;
+
+    // Aggregates of inner nodes (unused in leaves). They take the padding
+    // after the value, so they do not make the nodes any larger
+    uint16_t free_, occupied_;
+};
+
+// Octree holding the slim and the inflated occupancy maps in the same nodes,
+// so both views share all inner nodes. Only the slim map is measured: the
+// inflated map is derived from it by counting, in each node, how many
+// occupied slim nodes have it within their inflation stencil. Occupancy
+// parameters are the same as in octomap::OcTree. Updates go through BulkUpdater
+class MergedOcTree : public octomap::OcTreeBaseImpl<MergedNode, octomap::AbstractOcTree> {
+ public:
+    static const float kLogOddsScale;  // Quantization steps per unit of log-odds
+
+    explicit MergedOcTree(double resolution);
+    MergedOcTree* create() const { return new MergedOcTree(resolution); }
+    std::string getTreeType() const { return "MergedOcTree"; }
+
+    // Occupancy parameters of the slim map (probabilities, as in octomap::OcTree)
+    void setOccupancyThres(double prob);
+    void setProbHit(double prob);
+    void setProbMiss(double prob);
+    void setClampingThresMin(double prob);
+    void setClampingThresMax(double prob);
+    float getOccupancyThresLog() const { return occ_thres_ / kLogOddsScale; }
+    float getProbHitLog() const { return prob_hit_log_; }
+    float getProbMissLog() const { return prob_miss_log_; }
+    float getClampingThresMinLog() const { return clamp_min_ / kLogOddsScale; }
+    float getClampingThresMaxLog() const { return clamp_max_ / kLogOddsScale; }
+
+    // Node at key, or NULL if it does not exist or the layer is unknown there
+    const MergedNode* Search(const octomap::OcTreeKey &key,
+                             const MapLayer &layer,
+                             const unsigned &depth = 0) const;
+    const MergedNode* Search(const octomap::point3d &point,
+                             const MapLayer &layer,
+                             const unsigned &depth = 0) const;
+    bool IsNodeOccupied(const MergedNode *node, const MapLayer &layer) const {
+        if (layer == kSlimLayer) {
+            return node->GetSlim() >= occ_thres_;  // Unknown is always below the threshold
+        }
+        return node->GetInflation() > 0;
+    }
+    float GetLogOdds(const MergedNode *node) const {  // Slim map
+        return node->IsKnown(kSlimLayer) ? node->GetSlim() / kLogOddsScale : 0.0f;
+    }
+    // Slim map is at the clamping threshold in the direction of the update
+    bool IsSaturated(const MergedNode *node, const float &update) const;
+
+    // Add log-odds to the slim map of a node (unknown starts at 0), with clamping
+    void UpdateNodeLogOdds(MergedNode *node, const float &update) const;
+    void SetNodeLogOdds(MergedNode *node, const float &log_odds) const;
+    // Add to the inflation count of a node. Counts never leave [0, kMaxInflation]
+    // as long as the stencil is no larger than that
+    void AdjustInflation(MergedNode *node, const int &delta) const;
+
+    // Set all inflation counts to zero, deleting the nodes left unknown
+    void ClearInflation();
+
+    // Free and occupied volume (m^3) of the inflated map in the box of nodes
+    // between min_key and max_key (inclusive). Only nodes crossing the box
+    // boundary are visited: the ones inside it contribute their aggregates
+    void BoxVolumes(const octomap::OcTreeKey &min_key,
+                    const octomap::OcTreeKey &max_key,
+                    double *free,
+                    double *occupied) const;
+
+    // Root is created empty (unknown) if it does not exist
+    MergedNode* CreateRoot();
+
+ protected:
+    int16_t occ_thres_, clamp_min_, clamp_max_;  // Quantized log-odds
+    float prob_hit_log_, prob_miss_log_;
+
+    static int16_t Quantize(const double &log_odds);
+    // Returns true if the whole node is unknown afterwards (the caller deletes it)
+    bool ClearInflationRecurs(MergedNode *node);
+    // Adds the number of free and occupied finest nodes of node (first key and
+    // depth given) that are inside the box
+    void BoxVolumesRecurs(const MergedNode *node,
+                          const octomap::OcTreeKey &first_key,
+                          const unsigned &depth,
+                          const octomap::OcTreeKey &min_key,
+                          const octomap::OcTreeKey &max_key,
+                          double *free,
+                          double *occupied) const;
+
+    // Registers this tree type, so that files written from it can be read back
+    class StaticMemberInitializer {
+     public:
+        StaticMemberInitializer() {
+            MergedOcTree *tree = new MergedOcTree(0.1);
+            tree->clearKeyRays();
+            octomap::AbstractOcTree::registerTreeType(tree);
+        }
+        void ensureLinking() {}
+    };
+    static StaticMemberInitializer merged_octree_member_init_;
+};
+
+}  // namespace octoclass
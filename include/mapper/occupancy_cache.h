@@ -0,0 +1,83 @@
+/* Copyright (c) 2017, United States Government, as represented by the
+ * Administrator of the National Aeronautics and Space Administration.
+ *
+ * All rights reserved.
+ *
+ * The Astrobee platform is licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with the
+ * License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+#pragma once
+
+#include <octomap/octomap.h>
+#include <Eigen/Dense>
+#include <stdint.h>
+#include <vector>
+
+namespace octoclass {
+
+// Occupancy of a dense box of octree keys, stored with two bits per node
+// (unknown, free or occupied), so that a lookup is a single array load
+// instead of a descent from the root of the octree. The owner keeps it in
+// sync with the tree
+class OccupancyCache {
+ public:
+    enum State { kUnknown = 0, kFree = 1, kOccupied = 2 };
+
+    OccupancyCache() {}
+
+    // Box of 2*half_size + 1 nodes centered at center_key, all unknown
+    void Reset(const octomap::OcTreeKey &center_key,
+               const Eigen::Vector3i &half_size);
+    void Clear();  // Disable the cache
+
+    bool IsEnabled() const { return !words_.empty(); }
+    const octomap::OcTreeKey& Center() const { return center_key_; }
+    const octomap::OcTreeKey& MinKey() const { return min_key_; }
+    const Eigen::Vector3i& Size() const { return size_; }
+
+    // Returns false if key is outside the box
+    bool Get(const octomap::OcTreeKey &key, State *state) const {
+        const int64_t index = this->Index(key);
+        if (index < 0) {
+            return false;
+        }
+        *state = static_cast<State>((words_[index >> 5] >> (2*(index & 31))) & 3);
+        return true;
+    }
+    void Set(const octomap::OcTreeKey &key, const State &state) {
+        const int64_t index = this->Index(key);
+        if (index < 0) {
+            return;
+        }
+        uint64_t &word = words_[index >> 5];
+        const int shift = 2*(index & 31);
+        word = (word & ~(3ULL << shift)) | (static_cast<uint64_t>(state) << shift);
+    }
+
+ private:
+    std::vector<uint64_t> words_;  // 32 nodes per word, x fastest
+    octomap::OcTreeKey center_key_, min_key_;
+    Eigen::Vector3i size_ = Eigen::Vector3i::Zero();
+
+    int64_t Index(const octomap::OcTreeKey &key) const {
+        const int x = static_cast<int>(key[0]) - min_key_[0];
+        const int y = static_cast<int>(key[1]) - min_key_[1];
+        const int z = static_cast<int>(key[2]) - min_key_[2];
+        if ((x < 0) || (y < 0) || (z < 0) || (x >= size_[0]) || (y >= size_[1]) || (z >= size_[2])) {
+            return -1;
+        }
+        return (static_cast<int64_t>(z)*size_[1] + y)*size_[0] + x;
+    }
+};
+
+}  // namespace octoclass
@@ -25,9 +25,23 @@
 #include <pcl/point_types.h>
 #include <sensor_msgs/point_cloud2_iterator.h>
 #include <visualization_msgs/MarkerArray.h>
+#include <functional>
+#include <memory>
 #include <vector>
+#include <thread>
 #include <iostream>
 #include "mapper/helper.h"
+#include "mapper/cloud_view.h"
+#include "mapper/flat_key_set.h"
+#include "mapper/point_filter.h"
+#include "mapper/scan_update.h"
+#include "mapper/worker_pool.h"
+#include "mapper/bulk_update.h"
+#include "mapper/block_inflater.h"
+#include "mapper/distance_field.h"
+#include "mapper/occupancy_cache.h"
+#include "mapper/fading_octree.h"
+#include "mapper/merged_octree.h"
 #include "mapper/indexed_octree_key.h"
 #include "mapper/linear_algebra.h"
 #include "mapper/graphs.h"
@@ -37,12 +51,22 @@
 
 namespace octoclass {
 
+// Receives each known leaf of the slim map evicted by the rolling window
+// (key of its first node, depth and log-odds)
+typedef std::function<void(const octomap::OcTreeKey&, const unsigned&, const float&)> SpillCallback;
+
 // 3D occupancy grid
 class OctoClass{
  public:
-    octomap::OcTree tree_ = octomap::OcTree(0.1);  // create empty tree with resolution 0.1
-    octomap::OcTree tree_inflated_ = octomap::OcTree(0.1);  // create empty tree with resolution 0.1
-    double memory_time_;  // Fading memory of the tree in seconds
+    // Slim and inflated maps (kSlimLayer and kInflatedLayer of each node).
+    // Inflation is counted from the occupied slim nodes
+    MergedOcTree tree_ = MergedOcTree(0.1);  // create empty tree with resolution 0.1
+    // Dynamic layer: hits on long-standing free space of the tree above go
+    // here instead, and are forgotten after memory_time_ (tree_ never
+    // forgets). Queries consult both layers
+    FadingOcTree dynamic_tree_ = FadingOcTree(0.1);
+    FadingOcTree dynamic_inflated_ = FadingOcTree(0.1);
+    double memory_time_ = 0.0;  // Fading memory of the dynamic layer in seconds (<= 0: no dynamic layer)
     algebra_3d::FrustumPlanes cam_frustum_;
     algebra_3d::PlanarLidar lidar_range_;
 
@@ -51,6 +75,9 @@ class OctoClass{
                        const std::string &inertial_frame_id,  // Resolution in meters
                        const bool &map_3d);
     OctoClass();
+    // Read-only copy for planning outside the map lock. Holds only what queries
+    // need: the inflated tree, the dynamic inflated layer and the parameters
+    std::unique_ptr<OctoClass> PlanningSnapshot() const;
 
     // Mapping methods
     void SetMemory(const double &memory);  // Fading memory time
@@ -59,10 +86,16 @@ class OctoClass{
     void SetInertialFrame(const std::string &inertial_frame_id);  // Inertial frame id
     void SetResolution(const double &resolution_in);  // Resolution of the octomap
     void ResetMap();  // Reset the octomap structure
-    void CopyMap(octomap::OcTree &tree, octomap::OcTree &tree_inflated);
-    void SetMapInflation(const double &inflate_radius);  // Set the inflation radius (same for xyz)
-    void SetMapInflation(const double &inflate_radius_xy,
+    // Copy a saved map. Return false, leaving the map untouched, for other tree types
+    bool CopyMap(const octomap::AbstractOcTree &tree);  // MergedOcTree
+    bool CopyMap(const octomap::AbstractOcTree &tree,  // Slim OcTree or FadingOcTree (inflated one is re-derived)
+                 const octomap::AbstractOcTree &tree_inflated);
+    // Set the inflation radius (same for xyz). Returns false, keeping the current
+    // inflation, if the stencil has more nodes than inflation counts can hold
+    bool SetMapInflation(const double &inflate_radius);
+    bool SetMapInflation(const double &inflate_radius_xy,
                          const double &inflate_radius_z);  // Set inflation radius (xy and z different)
+    void SetInflationShellOnly(const bool &shell_only);  // Only insert stencil shells between adjacent endpoints
     void SetCamFrustum(const double &fov,
                        const double &aspect_ratio);
     void SetLidarRange(const double &min_range,
@@ -73,36 +106,65 @@ class OctoClass{
     void SetClampingThresholds(const double &clamping_threshold_min,
                                const double &clamping_threshold_max);
     void SetMap3d(const bool &map_3d);
+    void SetRaycastThreads(const int &n_threads);  // Number of threads used in ComputeUpdate (<= 0: all cores)
+    // Distance field of the inflated map in a box around the robot (half_extent_xy <= 0: no distance field)
+    void SetDistanceField(const double &half_extent_xy,
+                          const double &half_extent_z,
+                          const double &max_distance);
+    // Move the distance field box if the robot got too close to its border (rebuilds the field)
+    void RecenterDistanceField(const Eigen::Vector3d &robot_position);
+    // Dense copy of the inflated occupancy in a box around the robot, consulted
+    // first by point and segment queries (half_extent_xy <= 0: no cache)
+    void SetCollisionCache(const double &half_extent_xy,
+                           const double &half_extent_z);
+    // Move the cache box if the robot got too close to its border (rebuilds the cache)
+    void RecenterCollisionCache(const Eigen::Vector3d &robot_position);
+    // Keep the map within a box around the robot (half_extent_xy <= 0: unbounded map)
+    void SetRollingWindow(const double &half_extent_xy,
+                          const double &half_extent_z);
+    void SetSpillCallback(const SpillCallback &spill);  // Called for the slim leaves evicted by the window
+    // Move the window with the robot, evicting the subtrees that leave it
+    void MoveWindow(const Eigen::Vector3d &robot_position);
     std::string GetInertialFrameId() {return inertial_frame_id_;}
     void PointsOctomapToPointCloud2(const octomap::point3d_list& points,
                                     sensor_msgs::PointCloud2& cloud);  // Convert from octomap to pointcloud2
-    void PclToRayOctomap(const pcl::PointCloud< pcl::PointXYZ > &cloud,
-                          const tf::StampedTransform &tf_cam2world,
+    void PclToRayOctomap(const cloud_view::XYZView &cloud,
+                          const Eigen::Affine3d &tf_cam2world,
                           const algebra_3d::FrustumPlanes &frustum);    // Map obstacles and free area
     // Same as above, but without frustum filtering (for lidar)
-    void PclToRayOctomap(const pcl::PointCloud< pcl::PointXYZ > &cloud,
-                          const tf::StampedTransform &tf_cam2world);
-    void ComputeUpdate(const octomap::KeySet &occ_inflated,  // Inflated endpoints
-                       const octomap::KeySet &occ_slim,      // Non-inflated endpoints
-                       const octomap::point3d& origin,
-                       const double &maxrange,
-                       octomap::KeySet *occ_slim_in_range,
-                       octomap::KeySet *free_slim,
-                       octomap::KeySet *free_inflated);  // Raycasting method for inflated maps
-    void FadeMemory(const double &rate);  // Run fading memory method
-    void InflateObstacles(const double &thickness);  // DEPRECATED: it was used to inflate the whole map (too expensive)
+    void PclToRayOctomap(const cloud_view::XYZView &cloud,
+                          const Eigen::Affine3d &tf_cam2world);
+    // Snapshot of the mapping parameters, for computing ScanUpdates without the map lock
+    std::shared_ptr<const ScanParams> GetScanParams() const {return scan_params_;}
+    // Returns false (and leaves the map untouched) if parameters changed since the update was computed
+    bool ApplyScanUpdate(const ScanUpdate &update);
+    // Same as updateNode(key, true/false) for all keys, but sorted and in a single pass over the tree.
+    // If prune is set, the ancestors of the updated nodes are pruned in that same pass
+    void BulkUpdate(const std::vector<octomap::OcTreeKey> &occupied,
+                    const std::vector<octomap::OcTreeKey> &free,
+                    const bool &prune,
+                    FadingOcTree *tree);
+    void FadeMemory();  // Delete dynamic nodes whose memory expired (fading itself is applied lazily)
     // Returns all colliding nodes in the pcl
     void FindCollidingNodesTree(const pcl::PointCloud< pcl::PointXYZ > &point_cloud,
                                 std::vector<octomap::point3d> *colliding_nodes);
     // Returns points from the pcl that collides with inflated tree
     void FindCollidingNodesInflated(const pcl::PointCloud< pcl::PointXYZ > &point_cloud,
                                     std::vector<octomap::point3d> *colliding_nodes);
+    // Keys that are occupied in the inflated tree or in the dynamic inflated layer
+    void CollidingKeys(const std::vector<octomap::OcTreeKey> &keys,
+                       std::vector<octomap::OcTreeKey> *colliding) const;
+    // Inflated nodes whose occupancy may have changed (in either layer) since
+    // the last call. If the map changed wholesale (reset, reinflation, fading,
+    // window move) full_change is set instead and keys is empty
+    void TakeChangedKeys(std::vector<octomap::OcTreeKey> *keys,
+                         bool *full_change);
 
-    // Visualization methods
+    // Visualization methods (const: they run under the shared map lock)
     void TreeVisMarkers(visualization_msgs::MarkerArray *obstacles,
-                        visualization_msgs::MarkerArray *free);
+                        visualization_msgs::MarkerArray *free) const;
     void InflatedVisMarkers(visualization_msgs::MarkerArray *obstacles,
-                            visualization_msgs::MarkerArray *free);
+                            visualization_msgs::MarkerArray *free) const;
     // void freeVisMarkers(visualization_msgs::MarkerArray* marker_array);
     // void inflatedFreeVisMarkers(visualization_msgs::MarkerArray* marker_array);
 
@@ -153,7 +215,15 @@ class OctoClass{
     void OccNodesWithinRadius(const geometry_msgs::Point &center_pt,
                               const double &radius,
                               std::vector<Eigen::Vector3d> *node_center);
-    // Return nearest occupied node within a radius (inflated tree)
+    // Distance from a point to the nearest occupied node of the inflated tree (dynamic layer
+    // excluded), its center and the gradient of the distance. Returns false if the point is
+    // outside the distance field or no node is within its max distance
+    bool DistanceToObstacle(const Eigen::Vector3d &point,
+                            double *distance,
+                            Eigen::Vector3d *node_center,
+                            Eigen::Vector3d *gradient) const;
+    // Return nearest occupied node within a radius (inflated tree). Uses the
+    // distance field when the center is inside it
     bool NearestOccNodeWithinRadius(const geometry_msgs::Point &center_pt,
                                     const double &radius,
                                     Eigen::Vector3d *node_center,
@@ -187,21 +257,147 @@ class OctoClass{
                  visualization_msgs::Marker *graph_markers);
 
  private:
+    explicit OctoClass(const OctoClass *source);  // Used by PlanningSnapshot
+
     int tree_depth_;
+    int raycast_threads_ = 1;
+    std::shared_ptr<WorkerPool> raycast_pool_ = std::make_shared<WorkerPool>(1);  // Raycasting and inflation threads
     double resolution_;
-    double max_range_, min_range_;
-    float inflate_radius_xy_, inflate_radius_z_;
-    std::vector<Eigen::Vector3d> sphere_;  // Discretized sphere used in map inflation
-    std::vector<double> depth_volumes_;     // Volume per depth in the tree
+    double max_range_ = 0.0, min_range_ = 0.0;
+    float inflate_radius_xy_ = 0.0, inflate_radius_z_ = 0.0;
+    std::vector<Eigen::Vector3i> sphere_keys_;  // Discretized sphere used in map inflation (key offsets)
+    std::vector<Eigen::Vector3i> sphere_shells_[6];  // Stencil nodes not covered by a face neighbor's stencil
+    Eigen::Vector3i sphere_max_offset_ = Eigen::Vector3i::Zero();  // Stencil extents (in nodes)
+    double sphere_radius_ = 0.0;  // Distance from stencil center to its farthest node
+    bool inflation_shell_only_ = true;
     std::string inertial_frame_id_;
     bool map_3d_;
 
+    std::shared_ptr<const ScanParams> scan_params_;  // Rebuilt whenever a mapping parameter changes
+    ScanWorker scan_worker_;  // Used by PclToRayOctomap
+    ScanUpdate scan_update_;
+    BulkUpdater bulk_updater_;  // Used for all insertions into the trees
+    std::vector<octomap::OcTreeKey> persistent_hits_;  // Scratch for ApplyScanUpdate
+    std::vector<octomap::OcTreeKey> dynamic_hits_, dynamic_misses_;
+    std::vector<octomap::OcTreeKey> inflation_added_, inflation_removed_;
+    BlockInflater block_inflater_;  // Used to recount the inflation of the whole map
+    std::vector<uint16_t> inflation_counts_;
+    DistanceField esdf_;  // Fed with the inflated occupancy changes of each update
+    double esdf_half_extent_xy_ = 0.0, esdf_half_extent_z_ = 0.0, esdf_max_distance_ = 1.0;
+    OccupancyCache collision_cache_;  // Inflated occupancy of tree_ (dynamic layer excluded)
+    double cache_half_extent_xy_ = 0.0, cache_half_extent_z_ = 0.0;
+    std::vector<octomap::OcTreeKey> known_keys_;  // Scratch for ApplyScanUpdate
+    bool window_enabled_ = false;
+    double window_half_extent_xy_ = 0.0, window_half_extent_z_ = 0.0;
+    Eigen::Vector3d window_center_ = Eigen::Vector3d::Zero();
+    octomap::OcTreeKey window_min_key_, window_max_key_;  // Inclusive
+    SpillCallback spill_;
+    std::vector<octomap::OcTreeKey> window_occupied_, window_inflated_occupied_, window_free_;
+    std::vector<octomap::OcTreeKey> evicted_occupied_;  // Evicted obstacles whose stencil reaches the window
+    FlatKeySet entered_sources_;  // Obstacles whose stencil reaches nodes that entered the window
+    std::vector<octomap::OcTreeKey> changed_keys_;  // Collected for TakeChangedKeys
+    bool full_change_ = true;
+
     // Methods
+    void UpdateScanParams();  // Snapshot the current mapping parameters into scan_params_
+    template <typename TREE>
+    bool AddLeaves(const octomap::AbstractOcTree &tree);  // Queue all leaves of a tree of type TREE into bulk_updater_
+    void RebuildInflation();  // Recount the inflated map from all occupied slim nodes (in parallel)
+    void RebuildDistanceField(const octomap::OcTreeKey &center_key);  // Reset the field around a key from tree_
+    // Apply inflation_added_ and inflation_removed_ to tree_ (and the changes they make to the
+    // distance field and the collision cache)
+    void UpdateInflation();
+    void RebuildCollisionCache(const octomap::OcTreeKey &center_key);  // Reset the cache around a key from tree_
+    void RefreshCollisionCache(const std::vector<octomap::OcTreeKey> &keys);  // Copy keys from tree_ into the cache
+    // Occupancy of the inflated tree at a key, from the cache if it covers the key
+    OccupancyCache::State InflatedState(const octomap::OcTreeKey &key) const;
+    OccupancyCache::State TreeInflatedState(const octomap::OcTreeKey &key) const;  // Always from tree_
+    // Free and occupied volume in a bounding box, from the aggregates of the
+    // persistent tree corrected by the dynamic obstacles in the box
+    void BBXVolumes(const Eigen::Vector3d &box_min,
+                    const Eigen::Vector3d &box_max,
+                    double *free,
+                    double *occupied) const;
+    // Walk a segment through the inflated tree and the dynamic inflated layer, one node at a
+    // time at the node's own size (large free nodes are crossed in one step). Returns 1 at the
+    // first occupied node, otherwise -1 if a node was unknown (returning at the first one if
+    // stop_at_unknown), otherwise 0
+    int TraverseSegment(const octomap::point3d &p1,
+                        const octomap::point3d &p2,
+                        const bool &stop_at_unknown) const;
+    // State of the node containing key for TraverseSegment (1 occupied, -1 unknown, 0 free),
+    // depth is set to the depth of the smallest node containing it in either layer
+    int SegmentNodeState(const octomap::OcTreeKey &key,
+                         unsigned *depth) const;
+    // Deepest node of tree containing key (depth is set to its depth). If that region
+    // was never created, returns NULL and the depth of the missing node
+    template <typename TREE>
+    const typename TREE::NodeType* LeafAt(const TREE &tree,
+                                          const octomap::OcTreeKey &key,
+                                          unsigned *depth) const;
+    bool InWindow(const octomap::OcTreeKey &key) const;
+    static bool InBox(const octomap::OcTreeKey &key,
+                      const octomap::OcTreeKey &min_key,
+                      const octomap::OcTreeKey &max_key);
+    // Keep only the keys inside (or only those outside) the box [min_key, max_key]
+    static void FilterByBox(const octomap::OcTreeKey &min_key,
+                            const octomap::OcTreeKey &max_key,
+                            const bool &inside,
+                            std::vector<octomap::OcTreeKey> *keys);
+    // Occupied slim nodes whose stencil reaches the nodes of the window that
+    // were outside the previous one [old_min_key, old_max_key]
+    void OccupiedAroundEntered(const octomap::OcTreeKey &old_min_key,
+                               const octomap::OcTreeKey &old_max_key,
+                               FlatKeySet *occupied) const;
+    void ClipToWindow(const std::vector<octomap::OcTreeKey> &keys,
+                      std::vector<octomap::OcTreeKey> *clipped) const;
+    // Evict the parts of a subtree outside the window. Returns true if the
+    // whole node must be deleted by the caller
+    template <typename TREE>
+    bool EvictOutsideWindow(TREE *tree,
+                            typename TREE::NodeType *node,
+                            const octomap::OcTreeKey &first_key,
+                            const unsigned &depth,
+                            size_t *n_evicted);
+    // Called on each evicted subtree before it is deleted
+    void OnEvict(FadingOcTree *tree,
+                 FadingNode *node,
+                 const octomap::OcTreeKey &first_key,
+                 const unsigned &depth);
+    void OnEvict(MergedOcTree *tree,
+                 MergedNode *node,
+                 const octomap::OcTreeKey &first_key,
+                 const unsigned &depth);
+    // Occupied nodes of the dynamic inflated layer that are free in tree_
+    void DynamicOccNodesWithinBox(const Eigen::Vector3d &box_min,
+                                  const Eigen::Vector3d &box_max,
+                                  std::vector<Eigen::Vector3d> *node_center,
+                                  std::vector<double> *node_sizes);
+    // Stencil of each key, clipped to the key range (keys repeat where stencils overlap)
+    void StencilKeys(const std::vector<octomap::OcTreeKey> &keys,
+                     std::vector<octomap::OcTreeKey> *stencil_keys) const;
+    // Split hits into those that disagree with long-standing free space in a layer of tree_ (dynamic) and the rest.
+    // Persistent hits are not returned if persistent is NULL
+    void SplitHits(const std::vector<octomap::OcTreeKey> &hits,
+                   const MapLayer &layer,
+                   std::vector<octomap::OcTreeKey> *persistent,
+                   std::vector<octomap::OcTreeKey> *dynamic);
+    // Keys that already exist in the dynamic tree (misses elsewhere would only grow it)
+    void KnownKeys(const std::vector<octomap::OcTreeKey> &keys,
+                   const FadingOcTree &tree,
+                   std::vector<octomap::OcTreeKey> *known);
+    // Add keys to changed_keys_ (too many of them count as a full change)
+    void MarkChanged(const std::vector<octomap::OcTreeKey> &keys);
+    void MarkFullChange();
+    // Dynamic layer has an occupied node at key (depth: size of the queried node, 0 for leaves)
+    bool DynamicOccupied(const FadingOcTree &tree,
+                         const octomap::OcTreeKey &key,
+                         const unsigned &depth = 0) const;
     double VectorNormSquared(const double &x,
                              const double &y,
                              const double &z);
     std_msgs::ColorRGBA HeightMapColor(const double &height,
-                                       const double &alpha);
+                                       const double &alpha) const;
 };
 
 }  // namespace octoclass
@@ -0,0 +1,86 @@
+/* Copyright (c) 2017, United States Government, as represented by the
+ * Administrator of the National Aeronautics and Space Administration.
+ *
+ * All rights reserved.
+ *
+ * The Astrobee platform is licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with the
+ * License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+#pragma once
+
+#include <ros/ros.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "mapper/structs.h"
+
+namespace mapper {
+
+enum SchedulingPolicy {
+    kScheduleRoundRobin,   // Sensors take turns
+    kScheduleOldestFirst,  // Cloud that has been waiting the longest goes first
+    kScheduleWeighted      // Sensors take turns in proportion to their priority
+};
+
+// Parses "round_robin", "oldest_first" or "weighted". Returns false for anything else
+bool SchedulingPolicyFromString(const std::string &name, SchedulingPolicy *policy);
+
+// Picks which sensor's cloud gets integrated next. Each sensor has one staged
+// cloud popped from its input queue, so a fast sensor cannot push the clouds
+// of a slow one out of a shared queue. Only the octomapping thread uses it.
+class PclScheduler {
+ public:
+    PclScheduler() {}
+
+    // Cameras come first, then lidars. Inputs must outlive the scheduler.
+    // Clouds older than max_staleness (seconds) are discarded (<= 0 disables)
+    void Initialize(const std::vector<sensorInput*> &inputs,
+                    const SchedulingPolicy &policy,
+                    const double &max_staleness);
+
+    // Returns false if no sensor has a fresh cloud waiting
+    bool Next(stampedPcl *pcl, uint *input_index);
+
+    // Record the latency between reception and integration of a cloud
+    void Integrated(const uint &input_index, const stampedPcl &pcl);
+
+    // Log per-sensor counters and latencies every period (seconds)
+    void LogStats(const double &period);
+
+ private:
+    // Latency (seconds) of the clouds integrated since the last log
+    struct LatencyStats {
+        uint64_t count;
+        double sum;
+        double max;
+
+        LatencyStats() : count(0), sum(0.0), max(0.0) {}
+    };
+
+    std::vector<sensorInput*> inputs_;
+    std::vector<stampedPcl> staged_;     // Next cloud of each sensor
+    std::vector<bool> has_staged_;
+    std::vector<double> current_weight_;  // Smooth weighted round-robin state
+    std::vector<LatencyStats> latency_;
+    SchedulingPolicy policy_ = kScheduleRoundRobin;
+    double max_staleness_ = 0.0;
+    uint next_ = 0;                      // Next sensor in round-robin order
+    ros::Time last_log_;
+
+    // Fill the staging slot of a sensor from its queue, discarding stale clouds
+    void Refill(const uint &i, const ros::Time &now);
+    bool IsStale(const stampedPcl &pcl, const ros::Time &now) const;
+};
+
+}  // namespace mapper
@@ -0,0 +1,85 @@
+/* Copyright (c) 2017, United States Government, as represented by the
+ * Administrator of the National Aeronautics and Space Administration.
+ *
+ * All rights reserved.
+ *
+ * The Astrobee platform is licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with the
+ * License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+#pragma once
+
+#include <octomap/octomap.h>
+#include <Eigen/Dense>
+#include <Eigen/Geometry>
+#include <string>
+#include <vector>
+
+#include "mapper/cloud_view.h"
+#include "mapper/linear_algebra.h"
+
+namespace point_filter {
+
+// Everything the filter needs to know about a point cloud, in world frame
+struct FilterParams {
+    float rot[9];             // Sensor to world rotation (row major)
+    float trans[3];           // Sensor to world translation
+    float origin[3];          // Origin used for range checks
+    bool flatten_z;           // Set z = 0 after transforming (2D maps)
+    bool use_frustum;         // Discard points outside the frustum planes
+    float planes[4][4];       // Frustum planes: inside iff n.p + d >= 0 (nx, ny, nz, d)
+    float min_range_sqr;      // Points closer than this to origin are discarded
+    double resolution_factor;  // 1/resolution of the octomap
+    int tree_max_val;         // Key offset of the octomap (2^(depth-1))
+
+    FilterParams() {}
+
+    // Sensor to world transform and optional frustum (NULL for lidars)
+    FilterParams(const Eigen::Affine3d &tf_sensor2world,
+                 const algebra_3d::FrustumPlanes *frustum,
+                 const bool &map_3d,
+                 const double &min_range,
+                 const double &resolution,
+                 const int &tree_depth);
+};
+
+// Output of the filter: one entry per valid point (keys may repeat)
+struct FilteredPoints {
+    std::vector<octomap::OcTreeKey> keys;
+    std::vector<float> range_sqr;  // Squared distance from the point to the origin
+    size_t size;
+
+    FilteredPoints() : size(0) {}
+};
+
+// Transform all points in a cloud into world frame, discard those that are
+// invalid, out of frustum or too close to the origin, and discretize the
+// remaining ones into octomap keys. Points are processed in blocks using the
+// widest instruction set supported by the CPU (AVX-512, AVX2 or scalar)
+void FilterPoints(const cloud_view::XYZView &cloud,
+                  const FilterParams &params,
+                  FilteredPoints *out);
+
+// Same filter with a given instruction set ("AVX-512", "AVX2" or "scalar").
+// Returns false if the CPU does not support it. All of them give the same output
+bool FilterPoints(const cloud_view::XYZView &cloud,
+                  const FilterParams &params,
+                  const std::string &instruction_set,
+                  FilteredPoints *out);
+
+// Name of the instruction set used by FilterPoints
+const char* InstructionSet();
+
+// Instruction sets supported by the CPU, widest first (scalar is always last)
+std::vector<std::string> SupportedInstructionSets();
+
+}  // namespace point_filter
@@ -0,0 +1,115 @@
+/* Copyright (c) 2017, United States Government, as represented by the
+ * Administrator of the National Aeronautics and Space Administration.
+ *
+ * All rights reserved.
+ *
+ * The Astrobee platform is licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with the
+ * License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+#pragma once
+
+#include <octomap/octomap.h>
+#include <octomap/OcTree.h>
+#include <Eigen/Dense>
+#include <Eigen/Geometry>
+#include <memory>
+#include <vector>
+
+#include "mapper/cloud_view.h"
+#include "mapper/flat_key_set.h"
+#include "mapper/point_filter.h"
+#include "mapper/worker_pool.h"
+#include "mapper/linear_algebra.h"
+
+namespace octoclass {
+
+// Everything needed to turn a point cloud into map updates without touching
+// the map. OctoClass creates a new one whenever a mapping parameter changes,
+// so a snapshot stays consistent while it is used outside the map lock
+struct ScanParams {
+    octomap::OcTree key_tree;  // Empty tree with the map resolution (key/coordinate conversions)
+    int tree_depth;
+    double resolution;
+    double max_range, min_range;
+    bool map_3d;
+    bool inflation_shell_only;
+    std::shared_ptr<WorkerPool> raycast_pool;  // Shared by all ScanWorkers and the map inflation
+    std::vector<Eigen::Vector3i> sphere_keys;  // Discretized sphere used in map inflation (key offsets)
+    std::vector<Eigen::Vector3i> sphere_shells[6];  // Stencil nodes not covered by a face neighbor's stencil
+    Eigen::Vector3i sphere_max_offset;  // Stencil extents (in nodes)
+    double sphere_radius;  // Distance from stencil center to its farthest node
+
+    explicit ScanParams(const double &resolution_in) : key_tree(resolution_in) {}
+
+    // Unit key offset along +x, -x, +y, -y, +z, -z
+    static Eigen::Vector3i FaceDirection(const int &i) {
+        Eigen::Vector3i d = Eigen::Vector3i::Zero();
+        d[i/2] = (i % 2 == 0) ? 1 : -1;
+        return d;
+    }
+};
+
+// Node updates produced by one point cloud, applied in this order
+struct ScanUpdate {
+    std::shared_ptr<const ScanParams> params;  // Snapshot the update was computed with
+    std::vector<octomap::OcTreeKey> inflated_occupied;  // Inflated endpoints (only routed to the dynamic layer)
+    std::vector<octomap::OcTreeKey> occupied;           // Occupied in the slim tree
+    std::vector<octomap::OcTreeKey> free;               // Free in both trees
+};
+
+// Turns point clouds into ScanUpdates: filtering, key discretization,
+// inflation and raycasting. Scratch key sets are reused from one cloud to
+// the next, so every thread computing updates needs its own ScanWorker
+class ScanWorker {
+ public:
+    ScanWorker() {}
+
+    // Frustum is NULL for lidars (no frustum filtering)
+    void Compute(const std::shared_ptr<const ScanParams> &params,
+                 const cloud_view::XYZView &cloud,
+                 const Eigen::Affine3d &tf_sensor2world,
+                 const algebra_3d::FrustumPlanes *frustum,
+                 ScanUpdate *update);
+
+ private:
+    const ScanParams *params_ = NULL;  // Parameters of the cloud being processed
+    point_filter::FilteredPoints filtered_points_;
+    FlatKeySet endpoints_, endpoints_inflated_;
+    FlatKeySet full_stencil_endpoints_;  // Endpoints whose whole stencil was inserted
+    FlatKeySet occ_cells_in_range_, free_cells_, inflated_free_cells_;
+    std::vector<FlatKeySet> thread_occ_, thread_free_, thread_free_inflated_;  // Per raycasting thread
+    std::vector<octomap::KeyRay> thread_keyrays_;
+
+    // Insert the inflation stencil around endpoint k (frustum is NULL for lidars)
+    void InflateEndpoint(const octomap::OcTreeKey &k,
+                         const algebra_3d::FrustumPlanes *frustum);
+    void ComputeUpdate(const FlatKeySet &occ_inflated,  // Inflated endpoints
+                       const FlatKeySet &occ_slim,      // Non-inflated endpoints
+                       const octomap::point3d& origin,
+                       const double &maxrange,
+                       FlatKeySet *occ_slim_in_range,
+                       FlatKeySet *free_slim,
+                       FlatKeySet *free_inflated);  // Raycasting method for inflated maps
+    void ComputeUpdateChunk(const std::vector<octomap::OcTreeKey> &endpoints,
+                            const size_t &first,
+                            const size_t &last,
+                            const FlatKeySet &occ_inflated,
+                            const octomap::point3d &origin,
+                            const double &max_range,
+                            octomap::KeyRay *keyray,
+                            FlatKeySet *occ_slim_in_range,
+                            FlatKeySet *free_slim,
+                            FlatKeySet *free_inflated) const;  // Raycasting for a subset of endpoints
+};
+
+}  // namespace octoclass
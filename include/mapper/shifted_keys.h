@@ -0,0 +1,74 @@
+/* Copyright (c) 2017, United States Government, as represented by the
+ * Administrator of the National Aeronautics and Space Administration.
+ *
+ * All rights reserved.
+ *
+ * The Astrobee platform is licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with the
+ * License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#pragma once
+
+#include <octomap/octomap.h>
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <Eigen/Dense>
+#include <stdint.h>
+#include <vector>
+
+#include "mapper/flat_key_set.h"
+
+namespace octoclass {
+
+// Point set discretized into octree keys once, that can then be shifted by
+// any vector without converting its points again. Each point keeps its key
+// and its position inside that node in 16 bit fixed point. A shift is split
+// into a whole number of nodes and a residue: along each axis, a point moves
+// one node further when its position inside the node plus the residue
+// reaches the next node. Sorting those positions per axis tells whether a new
+// shift moves any point to a different node than the last one did
+class ShiftedKeys {
+ public:
+    ShiftedKeys() {}
+
+    // Discretize points (resolution and depth of the octree they are checked against)
+    void Reset(const pcl::PointCloud<pcl::PointXYZ> &points,
+               const double &resolution,
+               const unsigned &tree_depth);
+
+    bool Empty() const { return points_.empty(); }
+
+    // Keys of the points shifted by shift (meters), without repetitions.
+    // Points shifted out of the key range are dropped. Returns false, and
+    // leaves keys untouched, if they are the same as for the last shift
+    bool Shift(const Eigen::Vector3d &shift,
+               FlatKeySet *keys);
+
+ private:
+    struct Point {
+        int32_t node[3];    // Key
+        uint16_t frac[3];   // Position inside the node (1/65536 of a node)
+    };
+
+    static const int32_t kFracOne = 1 << 16;
+
+    std::vector<Point> points_;
+    std::vector<uint16_t> sorted_frac_[3];
+    double resolution_factor_ = 1.0;
+    int32_t max_key_ = 0;
+    bool shifted_ = false;  // Last shift is valid
+    int32_t last_nodes_[3];     // Whole nodes of the last shift
+    size_t last_crossing_[3];   // Points that moved one node further with the last shift
+};
+
+}  // namespace octoclass
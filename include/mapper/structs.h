@@ -25,13 +25,17 @@
 
 // c++ libraries
 #include <semaphore.h>
-#include <queue>
+#include <atomic>
+#include <memory>
 #include <string>
 #include <vector>
 #include <mutex>
+#include <condition_variable>
+#include <boost/thread/shared_mutex.hpp>
 
 // Locally defined libraries
 #include "mapper/octoclass.h"
+#include "mapper/lock_free_ring.h"
 #include "mapper/sampled_trajectory.h"
 
 // Pensa-ros msg types
@@ -39,10 +43,28 @@
 
 namespace mapper {
 
+// The message pointer is queued as-is: the point data is shared with the
+// subscriber and never copied before it gets integrated into the octomap
 struct stampedPcl {
-    pcl::PointCloud<pcl::PointXYZ> cloud;
+    sensor_msgs::PointCloud2::ConstPtr cloud;
     tf::StampedTransform tf_cam2world;
     bool is_lidar;
+    uint sensor_index;  // Index among cameras (or among lidars)
+    ros::Time receive_time;  // When the callback got the message
+};
+
+// Input slot of a single sensor (camera or lidar). Counters are written by
+// the callbacks and the octomapping thread, so they are atomic
+struct sensorInput {
+    LockFreeRing<stampedPcl> queue;   // Clouds waiting to be scheduled (oldest dropped when full)
+    bool latest_only;                 // Only the most recent queued cloud is ever integrated
+    double priority;                  // Weight for the weighted scheduling policy
+    std::string name;                 // Topic name (for logging)
+    std::atomic<uint64_t> dropped;    // Clouds dropped because a newer one arrived
+    std::atomic<uint64_t> stale;      // Clouds discarded for exceeding the max staleness
+    std::atomic<uint64_t> integrated;  // Clouds integrated into the map
+
+    sensorInput() : latest_only(false), priority(1.0), dropped(0), stale(0), integrated(0) {}
 };
 
 struct globalVariables {
@@ -52,13 +74,17 @@ struct globalVariables {
     std::vector<tf::StampedTransform> tf_lidar2world;
     octoclass::OctoClass octomap = octoclass::OctoClass(0.05, "map", true);
     sampled_traj::SampledTrajectory3D sampled_traj;
+    uint64_t sampled_traj_version;  // Incremented whenever sampled_traj is replaced
     pensa_msgs::trapezoidal_p2pFeedback traj_status;
-    std::queue<stampedPcl> pcl_queue;
     bool update_map;
     bool map_3d;
-    const uint max_queue_size = 2;
+
+    // Lock-free variables
+    std::vector<std::unique_ptr<sensorInput> > cam_inputs;    // One input slot per camera
+    std::vector<std::unique_ptr<sensorInput> > lidar_inputs;  // One input slot per lidar
 
     globalVariables() {
+        sampled_traj_version = 0;
         traj_status.current_time = 0.0;
         traj_status.final_time = 0.0;
     }
@@ -71,24 +97,26 @@ class mutexStruct {
     std::mutex body_tf;
     std::mutex cam_tf;
     std::mutex lidar_tf;
-    std::mutex octomap;
-    std::mutex point_cloud;
+    boost::shared_mutex octomap;  // Shared by read-only queries, exclusive for map changes
     std::mutex update_map;
+    std::mutex pcl_scheduler;  // Point cloud scheduler and ticket counter
+    std::mutex scan_apply;     // Ticket of the next map update to apply
+    std::condition_variable scan_apply_turn;  // Notified after each map update
 };
 
 class semaphoreStruct {
  public:
-    sem_t pcl;
-    // sem_t collision_check;
+    sem_t pcl;  // Wakes up the octomapping thread (may be posted more times than there are clouds)
+    sem_t collision_check;  // Wakes up the path collision checker after map or trajectory changes
 
     // Methods
     semaphoreStruct() {
         sem_init(&pcl, 0, 0);
-        // sem_init(&collision_check, 0, 0);
+        sem_init(&collision_check, 0, 0);
     }
     void destroy() {
         sem_destroy(&pcl);
-        // sem_destroy(&collision_check);
+        sem_destroy(&collision_check);
     }
 };
 
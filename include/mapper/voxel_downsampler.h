@@ -0,0 +1,81 @@
+/* Copyright (c) 2017, United States Government, as represented by the
+ * Administrator of the National Aeronautics and Space Administration.
+ *
+ * All rights reserved.
+ *
+ * The Astrobee platform is licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with the
+ * License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "mapper/cloud_view.h"
+
+namespace point_filter {
+
+enum DownsampleMode {
+    kDownsampleNone,      // Keep all points
+    kDownsampleNearest,   // Keep the point closest to the sensor in each voxel
+    kDownsampleCentroid   // Replace the points in each voxel by their centroid
+};
+
+// Downsampling configuration for one sensor
+struct DownsampleParams {
+    DownsampleMode mode;
+    double voxel_size;  // meters
+
+    DownsampleParams() : mode(kDownsampleNone), voxel_size(0.0) {}
+};
+
+// Parses "none", "nearest" or "centroid". Returns false for anything else
+bool DownsampleModeFromString(const std::string &name, DownsampleMode *mode);
+
+// Voxel grid downsampling in the sensor frame. Each point is hashed into a
+// voxel of the grid and only one representative point per voxel is kept.
+// Hash table and output buffers are reused from one cloud to the next.
+class VoxelDownsampler {
+ public:
+    VoxelDownsampler() {}
+
+    // Downsample a cloud. The returned view points into this object's
+    // buffers, so it is only valid until the next call
+    cloud_view::XYZView Downsample(const cloud_view::XYZView &cloud,
+                                   const DownsampleParams &params);
+
+ private:
+    // Hash table slot: a slot is empty unless written in the current generation
+    struct Slot {
+        uint64_t voxel;
+        uint32_t index;       // Index of the voxel in points_
+        uint32_t generation;
+    };
+
+    std::vector<Slot> slots_;
+    std::vector<uint64_t> voxels_;     // Voxel code of each output point
+    std::vector<float> points_;        // Output points (x, y, z)
+    std::vector<double> sums_;         // Sum of the points in each voxel (centroid mode)
+    std::vector<uint32_t> counts_;     // Number of points in each voxel (centroid mode)
+    std::vector<float> range_sqr_;     // Squared range of the kept point (nearest mode)
+    uint32_t generation_ = 0;
+    size_t mask_ = 0;
+    int shift_ = 64;
+
+    // Returns the index of a voxel in points_, adding it if it is new
+    uint32_t FindOrInsert(const uint64_t &voxel, bool *inserted);
+    void Grow(const size_t &min_slots);  // Resize hash table and rehash voxels
+};
+
+}  // namespace point_filter
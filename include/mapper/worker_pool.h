@@ -0,0 +1,70 @@
+/* Copyright (c) 2017, United States Government, as represented by the
+ * Administrator of the National Aeronautics and Space Administration.
+ *
+ * All rights reserved.
+ *
+ * The Astrobee platform is licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with the
+ * License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace octoclass {
+
+// Fixed set of threads started once and reused for every parallel loop.
+// Run() hands out task indices to the pool threads and to the calling
+// thread, and returns once all of them have completed. Several threads may
+// call Run() at the same time: their batches are served in arrival order
+class WorkerPool {
+ public:
+    // Number of threads working on each batch, counting the calling thread
+    explicit WorkerPool(const int &n_threads);
+    ~WorkerPool();
+
+    int Size() const { return static_cast<int>(threads_.size()) + 1; }
+
+    // Call task(i) for every i in [0, n_tasks)
+    void Run(const size_t &n_tasks,
+             const std::function<void(const size_t&)> &task);
+
+ private:
+    struct Batch {
+        const std::function<void(const size_t&)> *task;
+        size_t n_tasks;
+        size_t next = 0;  // Next task index to be handed out
+        size_t done = 0;  // Completed tasks
+        std::condition_variable finished;
+    };
+
+    std::mutex mutex_;
+    std::condition_variable work_available_;
+    std::deque<Batch*> batches_;  // Batches with task indices left to hand out
+    bool stop_ = false;
+    std::vector<std::thread> threads_;
+
+    // Hand out the next task index of the front batch (mutex_ must be held)
+    Batch *NextTask(size_t *index);
+    void WorkerLoop();
+
+    WorkerPool(const WorkerPool&);
+    WorkerPool& operator=(const WorkerPool&);
+};
+
+}  // namespace octoclass
@@ -0,0 +1,209 @@
+/* Copyright (c) 2017, United States Government, as represented by the
+ * Administrator of the National Aeronautics and Space Administration.
+ *
+ * All rights reserved.
+ *
+ * The Astrobee platform is licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with the
+ * License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "mapper/block_inflater.h"
+
+#include <algorithm>
+#include <map>
+#include <utility>
+#include <vector>
+
+namespace octoclass {
+
+void BlockInflater::SetStencil(const std::vector<Eigen::Vector3i> &stencil) {
+    std::map<std::pair<int, int>, int> half_widths;
+    max_offset_.setZero();
+    for (size_t i = 0; i < stencil.size(); i++) {
+        int &half_width = half_widths.insert(
+            std::make_pair(std::make_pair(stencil[i][1], stencil[i][2]), 0)).first->second;
+        half_width = std::max(half_width, std::abs(stencil[i][0]));
+        max_offset_ = max_offset_.cwiseMax(stencil[i].cwiseAbs());
+    }
+    rows_.clear();
+    for (std::map<std::pair<int, int>, int>::const_iterator it = half_widths.begin();
+         it != half_widths.end(); ++it) {
+        Row row;
+        row.dy = it->first.first;
+        row.dz = it->first.second;
+        row.half_width = it->second;
+        rows_.push_back(row);
+    }
+}
+
+void BlockInflater::Inflate(const std::vector<octomap::OcTreeKey> &occupied,
+                            WorkerPool *pool,
+                            std::vector<octomap::OcTreeKey> *keys,
+                            std::vector<uint16_t> *counts) {
+    keys->clear();
+    counts->clear();
+    if (occupied.empty() || rows_.empty()) {
+        return;
+    }
+
+    // Bin occupied nodes into blocks
+    occupied_blocks_.clear();
+    const int mask = kBlockSize - 1;
+    for (size_t i = 0; i < occupied.size(); i++) {
+        const octomap::OcTreeKey &k = occupied[i];
+        occupied_blocks_[PackBlock(k[0] >> kBlockBits, k[1] >> kBlockBits, k[2] >> kBlockBits)].push_back(
+            static_cast<uint16_t>((k[0] & mask) | ((k[1] & mask) << kBlockBits) | ((k[2] & mask) << (2*kBlockBits))));
+    }
+
+    // Output blocks: every block that a stencil of an occupied block can reach
+    const Eigen::Vector3i reach = (max_offset_.array() + mask)/kBlockSize;
+    const int max_block = (1 << 16) >> kBlockBits;
+    output_blocks_.clear();
+    for (std::unordered_map<uint64_t, std::vector<uint16_t> >::const_iterator it = occupied_blocks_.begin();
+         it != occupied_blocks_.end(); ++it) {
+        const int bx = it->first & 0x1fffff, by = (it->first >> 21) & 0x1fffff, bz = it->first >> 42;
+        for (int x = std::max(bx - reach[0], 0); x <= std::min(bx + reach[0], max_block - 1); x++) {
+            for (int y = std::max(by - reach[1], 0); y <= std::min(by + reach[1], max_block - 1); y++) {
+                for (int z = std::max(bz - reach[2], 0); z <= std::min(bz + reach[2], max_block - 1); z++) {
+                    output_blocks_.push_back(PackBlock(x, y, z));
+                }
+            }
+        }
+    }
+    std::sort(output_blocks_.begin(), output_blocks_.end());
+    output_blocks_.erase(std::unique(output_blocks_.begin(), output_blocks_.end()), output_blocks_.end());
+
+    // Blocks are split in contiguous chunks (one per pool thread)
+    const size_t n_blocks = output_blocks_.size();
+    const size_t n_workers = std::max(static_cast<size_t>(1), std::min(static_cast<size_t>(pool->Size()), n_blocks));
+    thread_keys_.resize(n_workers);
+    thread_counts_.resize(n_workers);
+    const size_t chunk_size = (n_blocks + n_workers - 1)/n_workers;
+    pool->Run(n_workers, [&](const size_t &i) {
+        const size_t first = std::min(i*chunk_size, n_blocks);
+        const size_t last = std::min(first + chunk_size, n_blocks);
+        this->InflateChunk(first, last, (i == 0) ? keys : &thread_keys_[i], (i == 0) ? counts : &thread_counts_[i]);
+    });
+    for (size_t i = 1; i < n_workers; i++) {
+        keys->insert(keys->end(), thread_keys_[i].begin(), thread_keys_[i].end());
+        counts->insert(counts->end(), thread_counts_[i].begin(), thread_counts_[i].end());
+    }
+}
+
+void BlockInflater::InflateChunk(const size_t &first,
+                                 const size_t &last,
+                                 std::vector<octomap::OcTreeKey> *keys,
+                                 std::vector<uint16_t> *counts) const {
+    keys->clear();
+    counts->clear();
+    const int mask = kBlockSize - 1;
+    const Eigen::Vector3i pad = max_offset_;
+    const Eigen::Vector3i size = Eigen::Vector3i::Constant(kBlockSize) + 2*pad;  // Padded block
+    const Eigen::Vector3i reach = (max_offset_.array() + mask)/kBlockSize;
+    const int row_length = size[0] + 1;  // Prefix sums start with a zero
+    std::vector<uint16_t> prefix(row_length*size[1]*size[2]);
+    // Summed volume of the padded block (zero first plane in each direction)
+    const int sat_y = size[1] + 1, sat_z = size[2] + 1;
+    std::vector<uint32_t> sat(row_length*sat_y*sat_z);
+
+    for (size_t b = first; b < last; b++) {
+        const int bx = output_blocks_[b] & 0x1fffff, by = (output_blocks_[b] >> 21) & 0x1fffff,
+                  bz = output_blocks_[b] >> 42;
+        const Eigen::Vector3i origin = Eigen::Vector3i(bx, by, bz)*kBlockSize - pad;  // Key of padded cell 0
+
+        // Mark occupied nodes of the neighbourhood (one count per cell, shifted by one for the prefix)
+        std::fill(prefix.begin(), prefix.end(), 0);
+        bool any = false;
+        for (int x = bx - reach[0]; x <= bx + reach[0]; x++) {
+            for (int y = by - reach[1]; y <= by + reach[1]; y++) {
+                for (int z = bz - reach[2]; z <= bz + reach[2]; z++) {
+                    if ((x < 0) || (y < 0) || (z < 0)) {
+                        continue;
+                    }
+                    std::unordered_map<uint64_t, std::vector<uint16_t> >::const_iterator it =
+                        occupied_blocks_.find(PackBlock(x, y, z));
+                    if (it == occupied_blocks_.end()) {
+                        continue;
+                    }
+                    const Eigen::Vector3i corner = Eigen::Vector3i(x, y, z)*kBlockSize - origin;
+                    for (size_t i = 0; i < it->second.size(); i++) {
+                        const uint16_t local = it->second[i];
+                        const Eigen::Vector3i p = corner + Eigen::Vector3i(local & mask, (local >> kBlockBits) & mask,
+                                                                           local >> (2*kBlockBits));
+                        if ((p.array() >= 0).all() && (p.array() < size.array()).all()) {
+                            prefix[(p[2]*size[1] + p[1])*row_length + p[0] + 1] = 1;
+                            any = true;
+                        }
+                    }
+                }
+            }
+        }
+        if (!any) {
+            continue;
+        }
+        for (int i = 0; i < size[1]*size[2]; i++) {
+            uint16_t *row = &prefix[i*row_length];
+            for (int x = 1; x < row_length; x++) {
+                row[x] += row[x - 1];
+            }
+        }
+        std::fill(sat.begin(), sat.end(), 0);
+        for (int z = 0; z < size[2]; z++) {
+            for (int y = 0; y < size[1]; y++) {
+                const uint16_t *row = &prefix[(z*size[1] + y)*row_length];
+                uint32_t *out = &sat[((z + 1)*sat_y + y + 1)*row_length];
+                const uint32_t *below_y = out - row_length;
+                const uint32_t *below_z = out - sat_y*row_length;
+                const uint32_t *below_yz = below_z - row_length;
+                for (int x = 0; x < row_length; x++) {
+                    out[x] = row[x] + below_y[x] + below_z[x] - below_yz[x];
+                }
+            }
+        }
+
+        // Each stencil row adds the occupied nodes in a segment of one prefix row
+        for (int z = 0; z < kBlockSize; z++) {
+            for (int y = 0; y < kBlockSize; y++) {
+                for (int x = 0; x < kBlockSize; x++) {
+                    // Most nodes have nothing within the stencil bounding box
+                    const int x0 = x, x1 = x + 2*pad[0] + 1;
+                    const int y0 = y, y1 = y + 2*pad[1] + 1;
+                    const int z0 = z, z1 = z + 2*pad[2] + 1;
+                    const int64_t box =
+                        static_cast<int64_t>(sat[(z1*sat_y + y1)*row_length + x1]) -
+                        sat[(z0*sat_y + y1)*row_length + x1] - sat[(z1*sat_y + y0)*row_length + x1] -
+                        sat[(z1*sat_y + y1)*row_length + x0] + sat[(z0*sat_y + y0)*row_length + x1] +
+                        sat[(z0*sat_y + y1)*row_length + x0] + sat[(z1*sat_y + y0)*row_length + x0] -
+                        sat[(z0*sat_y + y0)*row_length + x0];
+                    if (box == 0) {
+                        continue;
+                    }
+
+                    int count = 0;
+                    const int px = x + pad[0];
+                    for (size_t r = 0; r < rows_.size(); r++) {
+                        const Row &s = rows_[r];
+                        const uint16_t *row = &prefix[((z + pad[2] + s.dz)*size[1] + y + pad[1] + s.dy)*row_length];
+                        count += row[px + s.half_width + 1] - row[px - s.half_width];
+                    }
+                    if (count > 0) {
+                        keys->push_back(octomap::OcTreeKey(bx*kBlockSize + x, by*kBlockSize + y,
+                                                           bz*kBlockSize + z));
+                        counts->push_back(static_cast<uint16_t>(count));
+                    }
+                }
+            }
+        }
+    }
+}
+
+}  // namespace octoclass
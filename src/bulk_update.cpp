@@ -0,0 +1,340 @@
+/* Copyright (c) 2017, United States Government, as represented by the
+ * Administrator of the National Aeronautics and Space Administration.
+ *
+ * All rights reserved.
+ *
+ * The Astrobee platform is licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with the
+ * License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "mapper/bulk_update.h"
+
+#include <algorithm>
+#include <vector>
+
+namespace octoclass {
+
+namespace {
+
+// Spread the lowest 21 bits of v so that there are two zeros between each of them
+uint64_t SpreadBits(uint64_t v) {
+    v &= 0x1fffff;
+    v = (v | (v << 32)) & 0x1f00000000ffffULL;
+    v = (v | (v << 16)) & 0x1f0000ff0000ffULL;
+    v = (v | (v << 8)) & 0x100f00f00f00f00fULL;
+    v = (v | (v << 4)) & 0x10c30c30c30c30c3ULL;
+    v = (v | (v << 2)) & 0x1249249249249249ULL;
+    return v;
+}
+
+// A pruned leaf already at the clamping threshold would not change, so
+// it can be left pruned (unless its expiry must be renewed)
+bool Saturated(const octomap::OcTree *tree, const octomap::OcTreeNode *node, const float &update) {
+    return ((update >= 0.0f) && (node->getLogOdds() >= tree->getClampingThresMaxLog())) ||
+           ((update <= 0.0f) && (node->getLogOdds() <= tree->getClampingThresMinLog()));
+}
+bool Saturated(const FadingOcTree *tree, const FadingNode *node, const float &update) {
+    return false;
+}
+bool Saturated(const MergedOcTree *tree, const MergedNode *node, const float &update) {
+    return tree->IsSaturated(node, update);
+}
+
+void UpdateLeaf(octomap::OcTree *tree, octomap::OcTreeNode *node, const float &update) {
+    tree->updateNodeLogOdds(node, update);
+}
+void UpdateLeaf(FadingOcTree *tree, FadingNode *node, const float &update) {
+    tree->updateNodeLogOdds(node, update);
+}
+void UpdateLeaf(MergedOcTree *tree, MergedNode *node, const float &update) {
+    tree->UpdateNodeLogOdds(node, update);
+}
+
+void SetLeaf(octomap::OcTree *tree, octomap::OcTreeNode *node, const float &log_odds) {
+    node->setLogOdds(log_odds);
+}
+void SetLeaf(FadingOcTree *tree, FadingNode *node, const float &log_odds) {
+    tree->SetNodeLogOdds(node, log_odds);
+}
+void SetLeaf(MergedOcTree *tree, MergedNode *node, const float &log_odds) {
+    tree->SetNodeLogOdds(node, log_odds);
+}
+
+// Only merged trees carry an inflated view derived from their occupancy
+void Inflate(octomap::OcTree *tree, octomap::OcTreeNode *node, const int &delta) {}
+void Inflate(FadingOcTree *tree, FadingNode *node, const int &delta) {}
+void Inflate(MergedOcTree *tree, MergedNode *node, const int &delta) {
+    tree->AdjustInflation(node, delta);
+}
+
+bool TracksOccupancy(const octomap::OcTree *tree) { return false; }
+bool TracksOccupancy(const FadingOcTree *tree) { return false; }
+bool TracksOccupancy(const MergedOcTree *tree) { return true; }
+bool Occupied(const octomap::OcTree *tree, const octomap::OcTreeNode *node, const MapLayer &layer) {
+    return tree->isNodeOccupied(node);
+}
+bool Occupied(const FadingOcTree *tree, const FadingNode *node, const MapLayer &layer) {
+    return tree->isNodeOccupied(node);
+}
+bool Occupied(const MergedOcTree *tree, const MergedNode *node, const MapLayer &layer) {
+    return tree->IsNodeOccupied(node, layer);
+}
+bool Known(const octomap::OcTreeNode *node) { return true; }
+bool Known(const FadingNode *node) { return true; }
+bool Known(const MergedNode *node) { return node->IsKnown(kSlimLayer); }
+
+// Root can only be created through the octomap interface. Creating it
+// with a neutral update does not change the result of the first update
+void CreateRoot(octomap::OcTree *tree, const octomap::OcTreeKey &key) {
+    tree->updateNode(key, 0.0f, true);
+}
+void CreateRoot(FadingOcTree *tree, const octomap::OcTreeKey &key) {
+    tree->updateNode(key, 0.0f, true);
+}
+void CreateRoot(MergedOcTree *tree, const octomap::OcTreeKey &key) {
+    tree->CreateRoot();
+}
+
+}  // namespace
+
+uint64_t BulkUpdater::MortonCode(const octomap::OcTreeKey &key) {
+    return SpreadBits(key[0]) | (SpreadBits(key[1]) << 1) | (SpreadBits(key[2]) << 2);
+}
+
+void BulkUpdater::Clear() {
+    entries_.clear();
+}
+
+void BulkUpdater::AddHits(const std::vector<octomap::OcTreeKey> &keys) {
+    Entry e;
+    e.log_odds = 0.0f;
+    e.depth = 0;  // Set to the tree depth in Apply
+    e.kind = kHit;
+    for (size_t i = 0; i < keys.size(); i++) {
+        e.code = MortonCode(keys[i]);
+        e.key = keys[i];
+        entries_.push_back(e);
+    }
+}
+
+void BulkUpdater::AddMisses(const std::vector<octomap::OcTreeKey> &keys) {
+    Entry e;
+    e.log_odds = 0.0f;
+    e.depth = 0;  // Set to the tree depth in Apply
+    e.kind = kMiss;
+    for (size_t i = 0; i < keys.size(); i++) {
+        e.code = MortonCode(keys[i]);
+        e.key = keys[i];
+        entries_.push_back(e);
+    }
+}
+
+void BulkUpdater::AddLeaf(const octomap::OcTreeKey &key,
+                          const unsigned &depth,
+                          const float &log_odds) {
+    Entry e;
+    e.code = MortonCode(key);
+    e.key = key;
+    e.log_odds = log_odds;
+    e.depth = depth;
+    e.kind = kSet;
+    entries_.push_back(e);
+}
+
+void BulkUpdater::AddInflation(const std::vector<octomap::OcTreeKey> &keys,
+                               const int &delta) {
+    Entry e;
+    e.log_odds = delta;
+    e.depth = 0;  // Set to the tree depth in Apply
+    e.kind = kInflate;
+    for (size_t i = 0; i < keys.size(); i++) {
+        e.code = MortonCode(keys[i]);
+        e.key = keys[i];
+        entries_.push_back(e);
+    }
+}
+
+void BulkUpdater::AddInflation(const std::vector<octomap::OcTreeKey> &keys,
+                               const std::vector<uint16_t> &deltas) {
+    Entry e;
+    e.depth = 0;  // Set to the tree depth in Apply
+    e.kind = kInflate;
+    for (size_t i = 0; i < keys.size(); i++) {
+        e.code = MortonCode(keys[i]);
+        e.key = keys[i];
+        e.log_odds = deltas[i];
+        entries_.push_back(e);
+    }
+}
+
+template <typename TREE>
+void BulkUpdater::Apply(TREE *tree, const bool &prune) {
+    typedef typename TREE::NodeType Node;
+    prune_ = prune;
+    became_occupied_.clear();
+    became_free_.clear();
+    became_known_.clear();
+    if (entries_.empty()) {
+        return;
+    }
+    const unsigned tree_depth = tree->getTreeDepth();
+    const float hit_log_odds = tree->getProbHitLog();
+    const float miss_log_odds = tree->getProbMissLog();
+    const float clamp_min = tree->getClampingThresMinLog();
+    const float clamp_max = tree->getClampingThresMaxLog();
+
+    // Hits and misses go all the way down. Nodes above the leaves are sorted
+    // by the first code in their subtree
+    for (size_t i = 0; i < entries_.size(); i++) {
+        Entry &e = entries_[i];
+        if (e.kind == kHit) {
+            e.depth = tree_depth;
+            e.log_odds = hit_log_odds;
+        } else if (e.kind == kMiss) {
+            e.depth = tree_depth;
+            e.log_odds = miss_log_odds;
+        } else if (e.kind == kInflate) {
+            e.depth = tree_depth;
+        } else if (e.depth < tree_depth) {
+            e.code &= ~((1ULL << (3*(tree_depth - e.depth))) - 1);
+        }
+    }
+    std::stable_sort(entries_.begin(), entries_.end());
+
+    if (tree->getRoot() == NULL) {
+        CreateRoot(tree, entries_[0].key);
+    }
+    path_.resize(tree_depth + 1);
+    created_.resize(tree_depth + 1);
+    path_[0] = tree->getRoot();
+    unsigned depth = 0;  // Depth of the deepest valid node in path_
+    const bool track = TracksOccupancy(tree);
+    bool was_occupied = false;  // Occupancy of the current key before its first update
+    bool was_known = true;
+
+    for (size_t i = 0; i < entries_.size(); i++) {
+        const Entry &e = entries_[i];
+
+        // Go back up to the deepest node shared with the previous update
+        if (i > 0) {
+            const uint64_t diff = e.code ^ entries_[i - 1].code;
+            unsigned shared_depth = tree_depth;
+            if (diff != 0) {
+                const unsigned level = (63 - __builtin_clzll(diff))/3;  // Key bit where the paths split
+                shared_depth = tree_depth - 1 - level;
+            }
+            shared_depth = std::min(shared_depth, static_cast<unsigned>(e.depth));
+            if (shared_depth < depth) {
+                this->RefreshPath(tree, depth, shared_depth + 1);
+                depth = shared_depth;
+            }
+        }
+
+        // Walk down, creating nodes as updateNode does. A pruned leaf already
+        // at the clamping threshold would not change: leave it pruned
+        Node *node = static_cast<Node*>(path_[depth]);
+        created_[depth] = false;
+        bool skip = false;
+        while (depth < e.depth) {
+            if (((e.kind == kHit) || (e.kind == kMiss)) && !created_[depth] && !tree->nodeHasChildren(node) &&
+                Saturated(tree, node, e.log_odds)) {
+                skip = true;
+                break;
+            }
+            const unsigned bit = tree_depth - 1 - depth;
+            const unsigned child = ((e.key[0] >> bit) & 1) | (((e.key[1] >> bit) & 1) << 1) |
+                                   (((e.key[2] >> bit) & 1) << 2);
+            created_[depth + 1] = false;
+            if (!tree->nodeChildExists(node, child)) {
+                if (!tree->nodeHasChildren(node) && !created_[depth]) {
+                    tree->expandNode(node);  // Pruned leaf: children inherit its value
+                } else {
+                    tree->createNodeChild(node, child);
+                    created_[depth + 1] = true;
+                }
+            }
+            node = tree->getNodeChild(node, child);
+            depth++;
+            path_[depth] = node;
+        }
+
+        if (e.kind == kSet) {
+            DeleteChildren(tree, node);
+            // Copied maps may have been saved with wider clamping thresholds
+            SetLeaf(tree, node, std::min(std::max(e.log_odds, clamp_min), clamp_max));
+            continue;
+        }
+
+        // Updates to the same key are consecutive: compare the occupancy
+        // before the first one with the occupancy after the last one
+        const MapLayer layer = (e.kind == kInflate) ? kInflatedLayer : kSlimLayer;
+        const bool first = (i == 0) || (entries_[i - 1].code != e.code) ||
+                           (entries_[i - 1].depth != e.depth);
+        const bool last = (i + 1 == entries_.size()) || (entries_[i + 1].code != e.code) ||
+                          (entries_[i + 1].depth != e.depth);
+        if (track && first) {
+            was_occupied = Occupied(tree, node, layer);
+            was_known = Known(node);
+        }
+        if (e.kind == kInflate) {
+            Inflate(tree, node, static_cast<int>(e.log_odds));
+        } else if (!skip) {
+            UpdateLeaf(tree, node, e.log_odds);
+        }
+        if (track && last && !was_known && (e.kind != kInflate)) {
+            became_known_.push_back(e.key);
+        }
+        if (track && last && (Occupied(tree, node, layer) != was_occupied)) {
+            if (was_occupied) {
+                became_free_.push_back(e.key);
+            } else {
+                became_occupied_.push_back(e.key);
+            }
+        }
+    }
+
+    this->RefreshPath(tree, depth, 0);
+    path_[0] = NULL;
+}
+
+template <typename TREE>
+void BulkUpdater::RefreshPath(TREE *tree,
+                              const unsigned &from_depth,
+                              const unsigned &to_depth) {
+    for (int d = from_depth; d >= static_cast<int>(to_depth); d--) {
+        typename TREE::NodeType *node = static_cast<typename TREE::NodeType*>(path_[d]);
+        if (!tree->nodeHasChildren(node)) {
+            continue;
+        }
+        // Children were refreshed (and pruned) first, so this only looks one level down
+        if (!prune_ || !tree->pruneNode(node)) {
+            node->updateOccupancyChildren();
+        }
+    }
+}
+
+template <typename TREE>
+void BulkUpdater::DeleteChildren(TREE *tree, typename TREE::NodeType *node) {
+    for (unsigned i = 0; i < 8; i++) {
+        if (tree->nodeChildExists(node, i)) {
+            typename TREE::NodeType *child = tree->getNodeChild(node, i);
+            DeleteChildren(tree, child);
+            tree->deleteNodeChild(node, i);
+        }
+    }
+}
+
+template void BulkUpdater::Apply(octomap::OcTree *tree, const bool &prune);
+template void BulkUpdater::Apply(FadingOcTree *tree, const bool &prune);
+template void BulkUpdater::Apply(MergedOcTree *tree, const bool &prune);
+
+}  // namespace octoclass
@@ -19,7 +19,6 @@
 #include <vector>
 #include <string>
 #include "mapper/mapper_class.h"
-#include "mapper/pcl_conversions.h"
 
 namespace mapper {
 
@@ -27,58 +26,57 @@ void MapperClass::CameraPclCallback(const sensor_msgs::PointCloud2::ConstPtr &ms
                                     const uint& cam_index) {
     // Structure to include pcl and its frame
     stampedPcl new_pcl;
-    const uint max_queue_size = globals_.max_queue_size;
 
-    // Convert message into pcl type
-    pcl::PointCloud< pcl::PointXYZ > cloud;
-    pcl_conversions::FromROSMsg(*msg, &cloud);
-    new_pcl.cloud = cloud;
+    // Keep a reference to the message (no conversion or copy)
+    new_pcl.cloud = msg;
 
     // Get transform from camera to world
     mutexes_.cam_tf.lock();
         new_pcl.tf_cam2world = globals_.tf_cameras2world[cam_index];
     mutexes_.cam_tf.unlock();
     new_pcl.is_lidar = false;
+    new_pcl.sensor_index = cam_index;
 
     // save into global variables
-    mutexes_.point_cloud.lock();
-        globals_.pcl_queue.push(new_pcl);
-        if (globals_.pcl_queue.size() > max_queue_size) {
-            globals_.pcl_queue.pop();
-        } else {
-            // signal octomap thread to process new pcl data
-            sem_post(&semaphores_.pcl);
-        }
-    mutexes_.point_cloud.unlock();
+    this->EnqueuePcl(&new_pcl);
 }
 
 void MapperClass::LidarPclCallback(const sensor_msgs::PointCloud2::ConstPtr &msg,
                                    const uint& lidar_index) {
     // Structure to include pcl and its frame
     stampedPcl new_pcl;
-    const uint max_queue_size = globals_.max_queue_size;
 
-    // Convert message into pcl type
-    pcl::PointCloud< pcl::PointXYZ > cloud;
-    pcl_conversions::FromROSMsg(*msg, &cloud);
-    new_pcl.cloud = cloud;
+    // Keep a reference to the message (no conversion or copy)
+    new_pcl.cloud = msg;
 
     // Get transform from camera to world
     new_pcl.tf_cam2world = globals_.tf_lidar2world[lidar_index];
     new_pcl.is_lidar = true;
+    new_pcl.sensor_index = lidar_index;
 
     // save into global variables
-    mutexes_.point_cloud.lock();
-        globals_.pcl_queue.push(new_pcl);
-        if (globals_.pcl_queue.size() > max_queue_size) {
-            globals_.pcl_queue.pop();
-        } else {
-            // signal octomap thread to process new pcl data
-            sem_post(&semaphores_.pcl);
-        }
-    mutexes_.point_cloud.unlock();
+    this->EnqueuePcl(&new_pcl);
 }
 
+void MapperClass::EnqueuePcl(stampedPcl *new_pcl) {
+    sensorInput &input = new_pcl->is_lidar ?
+        *globals_.lidar_inputs[new_pcl->sensor_index] :
+        *globals_.cam_inputs[new_pcl->sensor_index];
+    new_pcl->receive_time = ros::Time::now();
+
+    // If this sensor's queue is full, drop its oldest cloud to make room
+    stampedPcl dropped_pcl;
+    while (!input.queue.TryPush(std::move(*new_pcl))) {
+        if (input.queue.TryPop(&dropped_pcl)) {
+            const uint64_t n_drops = ++input.dropped;
+            ROS_DEBUG_THROTTLE(5.0, "[mapper]: %lu point clouds dropped from %s",
+                               static_cast<unsigned long>(n_drops), input.name.c_str());
+        }
+    }
+
+    // signal octomap thread to process new pcl data
+    sem_post(&semaphores_.pcl);
+}
 
 void MapperClass::SegmentCallback(const mapper::Segment::ConstPtr &msg) {
     ros::Time t0 = ros::Time::now();
@@ -122,10 +120,11 @@ void MapperClass::SegmentCallback(const mapper::Segment::ConstPtr &msg) {
 
         // populate kdtree for finding nearest neighbor w.r.t. collisions
         globals_.sampled_traj.CreateKdTree();
+        globals_.sampled_traj_version++;
     mutexes_.sampled_traj.unlock();
 
     // Notify the collision checker to check for collision
-    // sem_post(&semaphores_.collision_check);
+    sem_post(&semaphores_.collision_check);
 
     // ros::Duration solver_time = ros::Time::now() - t0;
     // ROS_DEBUG("Time to compute octotraj: %f", solver_time.toSec());
@@ -168,10 +167,11 @@ void MapperClass::SampledTrajectoryCallback(const pensa_msgs::VecPVA_4d::ConstPt
 
         // populate kdtree for finding nearest neighbor w.r.t. collisions
         globals_.sampled_traj.CreateKdTree();
+        globals_.sampled_traj_version++;
     mutexes_.sampled_traj.unlock();
 
     // Notify the collision checker to check for collision
-    // sem_post(&semaphores_.collision_check);
+    sem_post(&semaphores_.collision_check);
 }
 
 void MapperClass::WaypointsCallback(const pensa_msgs::WaypointSetConstPtr &msg) {
@@ -210,10 +210,11 @@ void MapperClass::WaypointsCallback(const pensa_msgs::WaypointSetConstPtr &msg)
 
         // populate kdtree for finding nearest neighbor w.r.t. collisions
         globals_.sampled_traj.CreateKdTree();
+        globals_.sampled_traj_version++;
     mutexes_.sampled_traj.unlock();
 
     // Notify the collision checker to check for collision
-    // sem_post(&semaphores_.collision_check);
+    sem_post(&semaphores_.collision_check);
 }
 
 void MapperClass::TrajectoryStatusCallback(const pensa_msgs::trapezoidal_p2pActionFeedbackConstPtr &msg) {
@@ -0,0 +1,214 @@
+/* Copyright (c) 2017, United States Government, as represented by the
+ * Administrator of the National Aeronautics and Space Administration.
+ *
+ * All rights reserved.
+ *
+ * The Astrobee platform is licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with the
+ * License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "mapper/distance_field.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace octoclass {
+
+void DistanceField::Reset(const octomap::OcTreeKey &center_key,
+                          const Eigen::Vector3i &half_size,
+                          const double &resolution,
+                          const double &max_distance) {
+    center_key_ = center_key;
+    size_ = 2*half_size + Eigen::Vector3i::Ones();
+    for (int i = 0; i < 3; i++) {
+        min_key_[i] = static_cast<uint16_t>(std::max(static_cast<int>(center_key[i]) - half_size[i], 0));
+    }
+    resolution_ = resolution;
+    max_distance_ = max_distance;
+    const double max_cells = max_distance/resolution;
+    max_dist_sqr_ = static_cast<uint32_t>(std::ceil(max_cells*max_cells));
+
+    Cell empty;
+    empty.site = -1;
+    empty.dist_sqr = kInfinity;
+    empty.occupied = false;
+    empty.raise = false;
+    cells_.assign(size_.prod(), empty);
+    open_ = std::priority_queue<QueueEntry, std::vector<QueueEntry>, std::greater<QueueEntry> >();
+}
+
+void DistanceField::Clear() {
+    cells_.clear();
+    size_.setZero();
+    open_ = std::priority_queue<QueueEntry, std::vector<QueueEntry>, std::greater<QueueEntry> >();
+}
+
+bool DistanceField::Contains(const octomap::OcTreeKey &key) const {
+    return this->Index(key) >= 0;
+}
+
+int32_t DistanceField::Index(const octomap::OcTreeKey &key) const {
+    const int x = static_cast<int>(key[0]) - min_key_[0];
+    const int y = static_cast<int>(key[1]) - min_key_[1];
+    const int z = static_cast<int>(key[2]) - min_key_[2];
+    if ((x < 0) || (y < 0) || (z < 0) || (x >= size_[0]) || (y >= size_[1]) || (z >= size_[2])) {
+        return -1;
+    }
+    return (z*size_[1] + y)*size_[0] + x;
+}
+
+Eigen::Vector3i DistanceField::Coords(const int32_t &index) const {
+    return Eigen::Vector3i(index % size_[0], (index/size_[0]) % size_[1], index/(size_[0]*size_[1]));
+}
+
+void DistanceField::SetObstacle(const octomap::OcTreeKey &key) {
+    const int32_t index = this->Index(key);
+    if ((index < 0) || cells_[index].occupied) {
+        return;
+    }
+    Cell &cell = cells_[index];
+    cell.occupied = true;
+    cell.site = index;
+    cell.dist_sqr = 0;
+    cell.raise = false;
+    open_.push(QueueEntry(0, index));
+}
+
+void DistanceField::RemoveObstacle(const octomap::OcTreeKey &key) {
+    const int32_t index = this->Index(key);
+    if ((index < 0) || !cells_[index].occupied) {
+        return;
+    }
+    Cell &cell = cells_[index];
+    cell.occupied = false;
+    cell.site = -1;
+    cell.dist_sqr = kInfinity;
+    cell.raise = true;
+    open_.push(QueueEntry(0, index));
+}
+
+void DistanceField::Update() {
+    while (!open_.empty()) {
+        const int32_t index = open_.top().second;
+        open_.pop();
+        const Cell &cell = cells_[index];
+        if (cell.raise) {
+            this->ProcessRaise(index);
+        } else if ((cell.site >= 0) && cells_[cell.site].occupied) {
+            this->ProcessLower(index);
+        }
+    }
+}
+
+void DistanceField::ProcessRaise(const int32_t &index) {
+    const Eigen::Vector3i c = this->Coords(index);
+    for (int dz = -1; dz <= 1; dz++) {
+        for (int dy = -1; dy <= 1; dy++) {
+            for (int dx = -1; dx <= 1; dx++) {
+                const Eigen::Vector3i n = c + Eigen::Vector3i(dx, dy, dz);
+                if ((n.array() < 0).any() || (n.array() >= size_.array()).any()) {
+                    continue;
+                }
+                const int32_t n_index = (n[2]*size_[1] + n[1])*size_[0] + n[0];
+                Cell &neighbor = cells_[n_index];
+                if (neighbor.raise || (neighbor.site < 0)) {
+                    continue;
+                }
+                if (!cells_[neighbor.site].occupied) {
+                    // Nearest obstacle is gone: keep raising
+                    open_.push(QueueEntry(neighbor.dist_sqr, n_index));
+                    neighbor.site = -1;
+                    neighbor.dist_sqr = kInfinity;
+                    neighbor.raise = true;
+                } else {
+                    // Valid neighbor: lower the raised cells from it
+                    open_.push(QueueEntry(neighbor.dist_sqr, n_index));
+                }
+            }
+        }
+    }
+    cells_[index].raise = false;
+}
+
+void DistanceField::ProcessLower(const int32_t &index) {
+    const Eigen::Vector3i c = this->Coords(index);
+    const int32_t site = cells_[index].site;
+    const Eigen::Vector3i s = this->Coords(site);
+    for (int dz = -1; dz <= 1; dz++) {
+        for (int dy = -1; dy <= 1; dy++) {
+            for (int dx = -1; dx <= 1; dx++) {
+                const Eigen::Vector3i n = c + Eigen::Vector3i(dx, dy, dz);
+                if ((n.array() < 0).any() || (n.array() >= size_.array()).any()) {
+                    continue;
+                }
+                const int32_t n_index = (n[2]*size_[1] + n[1])*size_[0] + n[0];
+                Cell &neighbor = cells_[n_index];
+                if (neighbor.raise) {
+                    continue;
+                }
+                const uint32_t dist_sqr = (n - s).squaredNorm();
+                if ((dist_sqr < neighbor.dist_sqr) && (dist_sqr <= max_dist_sqr_)) {
+                    neighbor.dist_sqr = dist_sqr;
+                    neighbor.site = site;
+                    open_.push(QueueEntry(dist_sqr, n_index));
+                }
+            }
+        }
+    }
+}
+
+bool DistanceField::Distance(const octomap::OcTreeKey &key,
+                             double *distance,
+                             octomap::OcTreeKey *nearest) const {
+    const int32_t index = this->Index(key);
+    if ((index < 0) || (cells_[index].site < 0)) {
+        return false;
+    }
+    const Cell &cell = cells_[index];
+    *distance = std::sqrt(static_cast<double>(cell.dist_sqr))*resolution_;
+    const Eigen::Vector3i s = this->Coords(cell.site);
+    *nearest = octomap::OcTreeKey(min_key_[0] + s[0], min_key_[1] + s[1], min_key_[2] + s[2]);
+    return true;
+}
+
+double DistanceField::CellDistance(const int32_t &index) const {
+    if (cells_[index].site < 0) {
+        return max_distance_;
+    }
+    return std::min(std::sqrt(static_cast<double>(cells_[index].dist_sqr))*resolution_, max_distance_);
+}
+
+bool DistanceField::Gradient(const octomap::OcTreeKey &key,
+                             Eigen::Vector3d *gradient) const {
+    const int32_t index = this->Index(key);
+    if (index < 0) {
+        return false;
+    }
+    const Eigen::Vector3i c = this->Coords(index);
+    for (int i = 0; i < 3; i++) {
+        Eigen::Vector3i lo = c, hi = c;
+        lo[i] = std::max(c[i] - 1, 0);
+        hi[i] = std::min(c[i] + 1, size_[i] - 1);
+        if (lo[i] == hi[i]) {
+            (*gradient)[i] = 0.0;
+            continue;
+        }
+        const int32_t lo_index = (lo[2]*size_[1] + lo[1])*size_[0] + lo[0];
+        const int32_t hi_index = (hi[2]*size_[1] + hi[1])*size_[0] + hi[0];
+        (*gradient)[i] = (this->CellDistance(hi_index) - this->CellDistance(lo_index))/
+                         ((hi[i] - lo[i])*resolution_);
+    }
+    return true;
+}
+
+}  // namespace octoclass
@@ -0,0 +1,212 @@
+/* Copyright (c) 2017, United States Government, as represented by the
+ * Administrator of the National Aeronautics and Space Administration.
+ *
+ * All rights reserved.
+ *
+ * The Astrobee platform is licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with the
+ * License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "mapper/fading_octree.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace octoclass {
+
+FadingNode::FadingNode(const FadingNode &rhs) : OcTreeNode(), expiry_(rhs.expiry_) {
+    value = rhs.value;
+    if (rhs.children != NULL) {
+        this->allocChildren();
+        for (unsigned i = 0; i < 8; i++) {
+            if (rhs.children[i] != NULL) {
+                children[i] = new FadingNode(*static_cast<FadingNode*>(rhs.children[i]));
+            }
+        }
+    }
+}
+
+void FadingNode::updateOccupancyChildren() {
+    this->setLogOdds(this->getMaxChildLogOdds());
+    uint32_t expiry = kNeverExpires;
+    if (children != NULL) {
+        for (unsigned i = 0; i < 8; i++) {
+            if (children[i] != NULL) {
+                expiry = std::min(expiry, static_cast<FadingNode*>(children[i])->GetExpiry());
+            }
+        }
+    }
+    expiry_ = expiry;
+}
+
+FadingOcTree::StaticMemberInitializer FadingOcTree::fading_octree_member_init_;
+
+FadingOcTree::FadingOcTree(double resolution)
+    : octomap::OccupancyOcTreeBase<FadingNode>(resolution),
+      memory_time_(-1.0),
+      epoch_(std::chrono::steady_clock::now()) {
+    fading_octree_member_init_.ensureLinking();
+}
+
+void FadingOcTree::SetMemoryTime(const double &memory_time) {
+    this->ApplyDecay();
+    memory_time_ = memory_time;
+    this->RefreshExpiry();
+}
+
+void FadingOcTree::ApplyDecay() {
+    if (root != NULL) {
+        this->RefreshExpiryRecurs(root, this->Now(), true);
+    }
+}
+
+void FadingOcTree::RefreshExpiry() {
+    if (root != NULL) {
+        this->RefreshExpiryRecurs(root, this->Now(), false);
+    }
+}
+
+void FadingOcTree::updateNodeLogOdds(FadingNode *node, const float &update) const {
+    const uint32_t now = this->Now();
+    node->setLogOdds(this->DecayedLogOdds(node, now));
+    octomap::OccupancyOcTreeBase<FadingNode>::updateNodeLogOdds(node, update);
+    node->SetExpiry(this->ExpiryOf(node->getLogOdds(), now));
+}
+
+void FadingOcTree::SetNodeLogOdds(FadingNode *node, const float &log_odds) const {
+    node->setLogOdds(log_odds);
+    node->SetExpiry(this->ExpiryOf(log_odds, this->Now()));
+}
+
+float FadingOcTree::DecayedLogOdds(const FadingNode *node) const {
+    return this->DecayedLogOdds(node, this->Now());
+}
+
+bool FadingOcTree::IsNodeOccupied(const FadingNode *node) const {
+    if (!this->isNodeOccupied(node)) {
+        return false;
+    }
+    return this->nodeHasChildren(node) || (node->GetExpiry() > this->Now());
+}
+
+size_t FadingOcTree::DeleteExpired() {
+    // Leaves that expired before fading was disabled are still deleted
+    size_t n_deleted = 0;
+    if (root == NULL) {
+        return n_deleted;
+    }
+    if (this->DeleteExpiredRecurs(root, this->Now(), &n_deleted)) {
+        this->clear();  // Everything expired
+        n_deleted++;
+    }
+    return n_deleted;
+}
+
+bool FadingOcTree::pruneNode(FadingNode *node) {
+    if (!this->isNodeCollapsible(node)) {
+        return false;
+    }
+    const uint32_t now = this->Now();
+    uint32_t expiry = 0;
+    for (unsigned i = 0; i < 8; i++) {
+        const uint32_t child_expiry = this->getNodeChild(node, i)->GetExpiry();
+        if (child_expiry <= now) {
+            return false;
+        }
+        expiry = std::max(expiry, child_expiry);
+    }
+    octomap::OccupancyOcTreeBase<FadingNode>::pruneNode(node);
+    node->SetExpiry(expiry);
+    return true;
+}
+
+uint32_t FadingOcTree::Now() const {
+    const std::chrono::duration<double> t = std::chrono::steady_clock::now() - epoch_;
+    return static_cast<uint32_t>(t.count()*kTicksPerSecond);
+}
+
+float FadingOcTree::DecayedLogOdds(const FadingNode *node, const uint32_t &now) const {
+    const uint32_t expiry = node->GetExpiry();
+    if (expiry == FadingNode::kNeverExpires) {
+        return node->getLogOdds();
+    } else if (expiry <= now) {
+        return 0.0f;  // Forgotten: back to the prior
+    }
+
+    // Node reaches the threshold at expiry, moving towards it at a constant rate
+    const float remaining = static_cast<float>(expiry - now)/kTicksPerSecond;
+    const float value = node->getLogOdds();
+    if (value >= occ_prob_thres_log) {
+        const float rate = (clamping_thres_max - occ_prob_thres_log)/memory_time_;
+        return std::min(value, occ_prob_thres_log + rate*remaining);
+    } else {
+        const float rate = (occ_prob_thres_log - clamping_thres_min)/memory_time_;
+        return std::max(value, occ_prob_thres_log - rate*remaining);
+    }
+}
+
+uint32_t FadingOcTree::ExpiryOf(const float &log_odds, const uint32_t &now) const {
+    if (memory_time_ <= 0.0) {
+        return FadingNode::kNeverExpires;
+    }
+
+    // Saturated nodes take memory_time_ to fade down to the threshold
+    double time_left;
+    if (log_odds >= occ_prob_thres_log) {
+        const double range = clamping_thres_max - occ_prob_thres_log;
+        time_left = (range > 0.0) ? memory_time_*(log_odds - occ_prob_thres_log)/range : 0.0;
+    } else {
+        const double range = occ_prob_thres_log - clamping_thres_min;
+        time_left = (range > 0.0) ? memory_time_*(occ_prob_thres_log - log_odds)/range : 0.0;
+    }
+    const double expiry = now + std::ceil(time_left*kTicksPerSecond);
+    return static_cast<uint32_t>(std::min(expiry, static_cast<double>(FadingNode::kNeverExpires - 1)));
+}
+
+bool FadingOcTree::DeleteExpiredRecurs(FadingNode *node, const uint32_t &now, size_t *n_deleted) {
+    if (node->GetExpiry() > now) {
+        return false;  // Nothing expired below this node
+    }
+    if (!this->nodeHasChildren(node)) {
+        return true;
+    }
+    for (unsigned i = 0; i < 8; i++) {
+        if (this->nodeChildExists(node, i) &&
+            this->DeleteExpiredRecurs(this->getNodeChild(node, i), now, n_deleted)) {
+            this->deleteNodeChild(node, i);
+            (*n_deleted)++;
+        }
+    }
+    if (!this->nodeHasChildren(node)) {
+        return true;
+    }
+    node->updateOccupancyChildren();
+    return false;
+}
+
+void FadingOcTree::RefreshExpiryRecurs(FadingNode *node, const uint32_t &now, const bool &decay) {
+    if (this->nodeHasChildren(node)) {
+        for (unsigned i = 0; i < 8; i++) {
+            if (this->nodeChildExists(node, i)) {
+                this->RefreshExpiryRecurs(this->getNodeChild(node, i), now, decay);
+            }
+        }
+        node->updateOccupancyChildren();
+    } else if (node->GetExpiry() > now) {  // Expired leaves are left for the next sweep
+        if (decay) {
+            node->setLogOdds(this->DecayedLogOdds(node, now));
+        }
+        node->SetExpiry(this->ExpiryOf(node->getLogOdds(), now));
+    }
+}
+
+}  // namespace octoclass
@@ -75,10 +75,12 @@ void FindNearestCollision(const std::vector<octomap::point3d> &colliding_nodes,
     }
 }
 
-struct timespec TimeFromNow(const uint& increment_sec) {
+struct timespec TimeFromNow(const double& increment_sec) {
   struct timespec ts;
   clock_gettime(CLOCK_REALTIME, &ts);
-  ts.tv_sec += increment_sec;
+  const int64_t nsec = ts.tv_nsec + static_cast<int64_t>(increment_sec*1e9);
+  ts.tv_sec += nsec/1000000000;
+  ts.tv_nsec = nsec%1000000000;
   return ts;
 }
 
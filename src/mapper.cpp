@@ -25,7 +25,12 @@ int main(int argc, char **argv) {
     // Shutdown ROS if sigint is detected
     signal(SIGINT, SigInt);
 
-    ros::spin();
+    // Callbacks and services run concurrently: read-only map queries only
+    // take the map lock in shared mode
+    int callback_threads = 0;  // 0 uses all cores
+    node.getParam("callback_threads", callback_threads);
+    ros::MultiThreadedSpinner spinner(callback_threads);
+    spinner.spin();
 
     return 0;
 }
@@ -19,7 +19,10 @@
 // Standard includes
 #include <mapper/mapper_class.h>
 
+#include <algorithm>
+#include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
 namespace mapper {
@@ -51,12 +54,18 @@ void MapperClass::Initialize(ros::NodeHandle *nh) {
     double clamping_threshold_max, clamping_threshold_min;
     double traj_resolution, compression_max_dev;
     bool process_pcl_at_startup, map_3d;
+    int raycast_threads = 1;
+    bool inflation_shell_only = true;
+    double esdf_half_extent_xy = 0.0, esdf_half_extent_z = 0.0, esdf_max_distance = 1.0;
+    double window_half_extent_xy = 0.0, window_half_extent_z = 0.0;
+    double cache_half_extent_xy = 0.0, cache_half_extent_z = 0.0;
     nh->getParam("map_resolution", map_resolution);
     nh->getParam("max_range", max_range);
     nh->getParam("min_range", min_range);
     nh->getParam("memory_time", memory_time);
     nh->getParam("inflate_radius_xy", inflate_radius_xy);
     nh->getParam("inflate_radius_z", inflate_radius_z);
+    nh->getParam("inflation_shell_only", inflation_shell_only);
     nh->getParam("cam_fov", cam_fov);
     nh->getParam("cam_aspect_ratio", aspect_ratio);
     nh->getParam("occupancy_threshold", occupancy_threshold);
@@ -69,6 +78,14 @@ void MapperClass::Initialize(ros::NodeHandle *nh) {
     nh->getParam("tf_update_rate", tf_update_rate_);
     nh->getParam("fading_memory_update_rate", fading_memory_update_rate_);
     nh->getParam("collision_check_rate", collision_check_rate_);
+    nh->getParam("raycast_threads", raycast_threads);
+    nh->getParam("esdf_half_extent_xy", esdf_half_extent_xy);
+    nh->getParam("esdf_half_extent_z", esdf_half_extent_z);
+    nh->getParam("esdf_max_distance", esdf_max_distance);
+    nh->getParam("window_half_extent_xy", window_half_extent_xy);
+    nh->getParam("window_half_extent_z", window_half_extent_z);
+    nh->getParam("collision_cache_half_extent_xy", cache_half_extent_xy);
+    nh->getParam("collision_cache_half_extent_z", cache_half_extent_z);
 
     // Get namespace of current node
     nh->getParam("namespace", ns_);
@@ -90,6 +107,42 @@ void MapperClass::Initialize(ros::NodeHandle *nh) {
     nh->getParam("lidar_prefix", lidar_prefix);
     nh->getParam("lidar_suffix", lidar_suffix);
 
+    // One lock-free input queue per sensor (capacity 1 keeps only the latest cloud)
+    int pcl_queue_capacity = 2;
+    nh->getParam("pcl_queue_capacity", pcl_queue_capacity);
+    std::vector<std::string> cam_topics, lidar_topics;
+    for (uint i = 0; i < depth_cam_names.size(); i++) {
+        cam_topics.push_back(depth_cam_prefix + depth_cam_names[i] + depth_cam_suffix);
+    }
+    for (uint i = 0; i < lidar_names.size(); i++) {
+        lidar_topics.push_back(lidar_prefix + lidar_names[i] + lidar_suffix);
+    }
+    this->CreateSensorInputs(nh, "depth_cam", cam_topics, pcl_queue_capacity, &globals_.cam_inputs);
+    this->CreateSensorInputs(nh, "lidar", lidar_topics, pcl_queue_capacity, &globals_.lidar_inputs);
+
+    // Point cloud scheduling among sensors
+    std::string pcl_scheduling_policy = "round_robin";
+    pcl_max_staleness_ = 0.0;
+    nh->getParam("pcl_scheduling_policy", pcl_scheduling_policy);
+    nh->getParam("pcl_max_staleness", pcl_max_staleness_);
+    if (!SchedulingPolicyFromString(pcl_scheduling_policy, &pcl_scheduling_policy_)) {
+        ROS_ERROR("[mapper]: Unknown point cloud scheduling policy `%s`, using round_robin!",
+                  pcl_scheduling_policy.c_str());
+        pcl_scheduling_policy_ = kScheduleRoundRobin;
+    }
+    ROS_DEBUG("[mapper]: Point cloud scheduling policy: %s (max staleness %f s)",
+              pcl_scheduling_policy.c_str(), pcl_max_staleness_);
+
+    // Workers preprocessing point clouds in parallel (map updates are still applied one at a time)
+    mapping_workers_ = 1;
+    nh->getParam("mapping_workers", mapping_workers_);
+    mapping_workers_ = std::max(mapping_workers_, 1);
+    ROS_DEBUG("[mapper]: Mapping workers: %d", mapping_workers_);
+
+    // Load per-sensor downsampling parameters
+    this->LoadDownsampleParams(nh, "depth_cam", depth_cam_names.size(), &cam_downsample_);
+    this->LoadDownsampleParams(nh, "lidar", lidar_names.size(), &lidar_downsample_);
+
     // Load frame ids
     std::vector<std::string> cam_frame_id;
     std::vector<std::string> lidar_frame_id;
@@ -161,12 +214,18 @@ void MapperClass::Initialize(ros::NodeHandle *nh) {
     globals_.octomap.SetInertialFrame(inertial_frame_id_);
     globals_.octomap.SetMemory(memory_time);
     globals_.octomap.SetMapInflation(inflate_radius_xy, inflate_radius_z);
+    globals_.octomap.SetInflationShellOnly(inflation_shell_only);
     globals_.octomap.SetCamFrustum(cam_fov, aspect_ratio);
     globals_.octomap.SetLidarRange(min_range, max_range);
     globals_.octomap.SetOccupancyThreshold(occupancy_threshold);
     globals_.octomap.SetHitMissProbabilities(probability_hit, probability_miss);
     globals_.octomap.SetClampingThresholds(clamping_threshold_min, clamping_threshold_max);
     globals_.octomap.SetMap3d(map_3d);
+    globals_.octomap.SetRaycastThreads(raycast_threads);
+    globals_.octomap.SetRollingWindow(window_half_extent_xy, window_half_extent_z);
+    globals_.octomap.SetDistanceField(esdf_half_extent_xy, esdf_half_extent_z, esdf_max_distance);
+    globals_.octomap.SetCollisionCache(cache_half_extent_xy, cache_half_extent_z);
+    ROS_DEBUG("[mapper]: Point filter uses %s instructions", point_filter::InstructionSet());
 
     // update trajectory discretization parameters (used in collision check)
     globals_.sampled_traj.SetMaxDev(compression_max_dev);
@@ -237,18 +296,16 @@ void MapperClass::Initialize(ros::NodeHandle *nh) {
 
     // Camera subscribers and tf threads ----------------------------------------------
     for (uint i = 0; i < depth_cam_names.size(); i++) {
-        std::string cam_topic = depth_cam_prefix + depth_cam_names[i] + depth_cam_suffix;
         cameras_sub_[i] = nh->subscribe<sensor_msgs::PointCloud2>
-              (cam_topic, 10, boost::bind(&MapperClass::CameraPclCallback, this, _1, i));
+              (cam_topics[i], 10, boost::bind(&MapperClass::CameraPclCallback, this, _1, i));
         h_cameras_tf_thread_[i] = std::thread(&MapperClass::CameraTfTask, this, inertial_frame_id_, cam_frame_id[i], i);
         ROS_INFO("[mapper] Subscribed to camera topic: %s", cameras_sub_[i].getTopic().c_str());
     }
 
     // Lidar subscribers and tf threads ----------------------------------------------
     for (uint i = 0; i < lidar_names.size(); i++) {
-        std::string lidar_topic = lidar_prefix + lidar_names[i] + lidar_suffix;
         lidar_sub_[i] = nh->subscribe<sensor_msgs::PointCloud2>
-              (lidar_topic, 10, boost::bind(&MapperClass::LidarPclCallback, this, _1, i));
+              (lidar_topics[i], 10, boost::bind(&MapperClass::LidarPclCallback, this, _1, i));
         h_lidar_tf_thread_[i] = std::thread(&MapperClass::LidarTfTask, this, inertial_frame_id_, lidar_frame_id[i], i);
         ROS_INFO("[mapper] Subscribed to lidar topic: %s", lidar_sub_[i].getTopic().c_str());
     }
@@ -279,17 +336,36 @@ bool MapperClass::RobotPosProjectedOnTrajectory(const geometry_msgs::Point& robo
     return success;
 }
 
-void MapperClass::GetCollidingNodesPcl(const pcl::PointCloud<pcl::PointXYZ>& pcl,
-                                       std::vector<octomap::point3d> *colliding_nodes) {
-    mutexes_.octomap.lock();
-        globals_.octomap.FindCollidingNodesInflated(pcl, colliding_nodes);
-    mutexes_.octomap.unlock();
+void MapperClass::DiscretizeTrajectory(const pcl::PointCloud<pcl::PointXYZ>& pcl,
+                                       octoclass::ShiftedKeys *keys) {
+    mutexes_.octomap.lock_shared();
+        const double resolution = globals_.octomap.tree_.getResolution();
+        const unsigned tree_depth = globals_.octomap.tree_.getTreeDepth();
+    mutexes_.octomap.unlock_shared();
+    keys->Reset(pcl, resolution, tree_depth);
+}
+
+void MapperClass::GetCollidingKeys(const std::vector<octomap::OcTreeKey> &keys,
+                                   std::vector<octomap::OcTreeKey> *colliding_keys) {
+    mutexes_.octomap.lock_shared();
+        globals_.octomap.CollidingKeys(keys, colliding_keys);
+    mutexes_.octomap.unlock_shared();
+}
+
+void MapperClass::GetNodeCenters(const std::vector<octomap::OcTreeKey> &keys,
+                                 std::vector<octomap::point3d> *centers) {
+    centers->clear();
+    mutexes_.octomap.lock_shared();
+        for (size_t i = 0; i < keys.size(); i++) {
+            centers->push_back(globals_.octomap.tree_.keyToCoord(keys[i]));
+        }
+    mutexes_.octomap.unlock_shared();
 }
 
 void MapperClass::GetOctomapResolution(double *octomap_resolution) {
-    mutexes_.octomap.lock();
-        *octomap_resolution = globals_.octomap.tree_inflated_.getResolution();
-    mutexes_.octomap.unlock();
+    mutexes_.octomap.lock_shared();
+        *octomap_resolution = globals_.octomap.tree_.getResolution();
+    mutexes_.octomap.unlock_shared();
 }
 
 void MapperClass::PublishNearestCollision(const geometry_msgs::Point &nearest_collision,
@@ -323,6 +399,56 @@ void MapperClass::PublishRadiusMarkers(const Eigen::Vector3d &center,
     obstacle_radius_marker_pub_.publish(obstacle_radius_marker);
 }
 
+void MapperClass::LoadDownsampleParams(ros::NodeHandle *nh,
+                                       const std::string &prefix,
+                                       const uint &n_sensors,
+                                       std::vector<point_filter::DownsampleParams> *params) {
+    std::vector<std::string> modes;
+    std::vector<double> voxel_sizes;
+    nh->getParam(prefix + "_downsample_mode", modes);
+    nh->getParam(prefix + "_downsample_voxel_size", voxel_sizes);
+
+    // Sensors without an entry in both lists are not downsampled
+    params->assign(n_sensors, point_filter::DownsampleParams());
+    for (uint i = 0; (i < n_sensors) && (i < modes.size()) && (i < voxel_sizes.size()); i++) {
+        if (!point_filter::DownsampleModeFromString(modes[i], &(*params)[i].mode)) {
+            ROS_ERROR("[mapper]: Unknown downsampling mode `%s` for %s %d!",
+                      modes[i].c_str(), prefix.c_str(), i);
+            continue;
+        }
+        (*params)[i].voxel_size = voxel_sizes[i];
+        ROS_DEBUG("[mapper]: %s %d downsampling: %s (voxel size %f)",
+                  prefix.c_str(), i, modes[i].c_str(), voxel_sizes[i]);
+    }
+}
+
+void MapperClass::CreateSensorInputs(ros::NodeHandle *nh,
+                                     const std::string &prefix,
+                                     const std::vector<std::string> &topics,
+                                     const int &queue_capacity,
+                                     std::vector<std::unique_ptr<sensorInput> > *inputs) {
+    std::vector<double> priorities;
+    nh->getParam(prefix + "_priority", priorities);
+
+    inputs->clear();
+    for (uint i = 0; i < topics.size(); i++) {
+        std::unique_ptr<sensorInput> input(new sensorInput());
+        input->queue.Reset(std::max(queue_capacity, 1));
+        input->latest_only = (queue_capacity <= 1);
+        input->name = topics[i];
+        if (i < priorities.size()) {
+            if (priorities[i] > 0.0) {
+                input->priority = priorities[i];
+            } else {
+                ROS_ERROR("[mapper]: Priority of %s %d must be positive!", prefix.c_str(), i);
+            }
+        }
+        ROS_DEBUG("[mapper]: %s %d queue capacity: %d (priority %f)", prefix.c_str(), i,
+                  input->latest_only ? 1 : static_cast<int>(input->queue.Capacity()), input->priority);
+        inputs->push_back(std::move(input));
+    }
+}
+
 // PLUGINLIB_EXPORT_CLASS(mapper::MapperClass, nodelet::Nodelet);
 
 }  // namespace mapper
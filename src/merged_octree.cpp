@@ -0,0 +1,260 @@
+/* Copyright (c) 2017, United States Government, as represented by the
+ * Administrator of the National Aeronautics and Space Administration.
+ *
+ * All rights reserved.
+ *
+ * The Astrobee platform is licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with the
+ * License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "mapper/merged_octree.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+namespace octoclass {
+
+static_assert(sizeof(MergedValue) == 4, "Leaves hold 4 bytes of data");
+static_assert(sizeof(MergedNode) == sizeof(octomap::OcTreeDataNode<MergedValue>),
+              "Aggregates of inner nodes must fit in the padding of the base node");
+
+MergedNode::MergedNode(const MergedNode &rhs)
+    : OcTreeDataNode<MergedValue>(), free_(rhs.free_), occupied_(rhs.occupied_) {
+    value = rhs.value;
+    if (rhs.children != NULL) {
+        this->allocChildren();
+        for (unsigned i = 0; i < 8; i++) {
+            if (rhs.children[i] != NULL) {
+                children[i] = new MergedNode(*static_cast<MergedNode*>(rhs.children[i]));
+            }
+        }
+    }
+}
+
+void MergedNode::updateOccupancyChildren() {
+    MergedValue max_value;
+    uint32_t free = 0, occupied = 0;
+    if (children != NULL) {
+        for (unsigned i = 0; i < 8; i++) {
+            if (children[i] != NULL) {
+                const MergedNode *child = static_cast<MergedNode*>(children[i]);
+                max_value.slim = std::max(max_value.slim, child->value.slim);
+                max_value.inflation = std::max(max_value.inflation, child->value.inflation);
+                free += child->FreeUnits();
+                occupied += child->OccupiedUnits();
+            }
+        }
+    }
+    value = max_value;
+    free_ = static_cast<uint16_t>((free + 4)/8);
+    occupied_ = static_cast<uint16_t>((occupied + 4)/8);
+}
+
+uint16_t MergedNode::FreeUnits() const {
+    if (this->IsLeaf()) {
+        return ((value.inflation == 0) && (value.slim != MergedValue::kUnknown)) ? kWholeNode : 0;
+    }
+    return free_;
+}
+
+uint16_t MergedNode::OccupiedUnits() const {
+    if (this->IsLeaf()) {
+        return (value.inflation > 0) ? kWholeNode : 0;
+    }
+    return occupied_;
+}
+
+bool MergedNode::IsLeaf() const {
+    if (children == NULL) {
+        return true;
+    }
+    for (unsigned i = 0; i < 8; i++) {
+        if (children[i] != NULL) {
+            return false;
+        }
+    }
+    return true;
+}
+
+const float MergedOcTree::kLogOddsScale = 1000.0f;
+
+MergedOcTree::StaticMemberInitializer MergedOcTree::merged_octree_member_init_;
+
+MergedOcTree::MergedOcTree(double resolution)
+    : octomap::OcTreeBaseImpl<MergedNode, octomap::AbstractOcTree>(resolution) {
+    // Same defaults as octomap::OcTree
+    this->setOccupancyThres(0.5);
+    this->setProbHit(0.7);
+    this->setProbMiss(0.4);
+    this->setClampingThresMin(0.1192);
+    this->setClampingThresMax(0.971);
+    merged_octree_member_init_.ensureLinking();
+}
+
+void MergedOcTree::setOccupancyThres(double prob) {
+    occ_thres_ = Quantize(octomap::logodds(prob));
+}
+
+void MergedOcTree::setProbHit(double prob) {
+    prob_hit_log_ = octomap::logodds(prob);
+}
+
+void MergedOcTree::setProbMiss(double prob) {
+    prob_miss_log_ = octomap::logodds(prob);
+}
+
+void MergedOcTree::setClampingThresMin(double prob) {
+    clamp_min_ = Quantize(octomap::logodds(prob));
+}
+
+void MergedOcTree::setClampingThresMax(double prob) {
+    clamp_max_ = Quantize(octomap::logodds(prob));
+}
+
+const MergedNode* MergedOcTree::Search(const octomap::OcTreeKey &key,
+                                       const MapLayer &layer,
+                                       const unsigned &depth) const {
+    const MergedNode *node = this->search(key, depth);
+    if ((node == NULL) || !node->IsKnown(layer)) {
+        return NULL;
+    }
+    return node;
+}
+
+const MergedNode* MergedOcTree::Search(const octomap::point3d &point,
+                                       const MapLayer &layer,
+                                       const unsigned &depth) const {
+    octomap::OcTreeKey key;
+    if (!this->coordToKeyChecked(point, key)) {
+        return NULL;
+    }
+    return this->Search(key, layer, depth);
+}
+
+bool MergedOcTree::IsSaturated(const MergedNode *node, const float &update) const {
+    const int16_t raw = node->GetSlim();
+    if (raw == MergedValue::kUnknown) {
+        return false;
+    }
+    return ((update >= 0.0f) && (raw >= clamp_max_)) || ((update <= 0.0f) && (raw <= clamp_min_));
+}
+
+void MergedOcTree::UpdateNodeLogOdds(MergedNode *node, const float &update) const {
+    const int delta = static_cast<int>(std::lround(update*kLogOddsScale));
+    const int current = node->IsKnown(kSlimLayer) ? node->GetSlim() : 0;
+    const int updated = std::min(std::max(current + delta, static_cast<int>(clamp_min_)),
+                                 static_cast<int>(clamp_max_));
+    node->SetSlim(static_cast<int16_t>(updated));
+}
+
+void MergedOcTree::SetNodeLogOdds(MergedNode *node, const float &log_odds) const {
+    node->SetSlim(Quantize(log_odds));
+}
+
+void MergedOcTree::AdjustInflation(MergedNode *node, const int &delta) const {
+    const int updated = node->GetInflation() + delta;
+    assert((updated >= 0) && (updated <= MergedNode::kMaxInflation));
+    node->SetInflation(static_cast<uint16_t>(updated));
+}
+
+void MergedOcTree::ClearInflation() {
+    if ((root != NULL) && this->ClearInflationRecurs(root)) {
+        this->clear();
+    }
+}
+
+bool MergedOcTree::ClearInflationRecurs(MergedNode *node) {
+    if (!this->nodeHasChildren(node)) {
+        node->SetInflation(0);
+        return !node->IsKnown(kSlimLayer);
+    }
+    for (unsigned i = 0; i < 8; i++) {
+        if (this->nodeChildExists(node, i) && this->ClearInflationRecurs(this->getNodeChild(node, i))) {
+            this->deleteNodeChild(node, i);
+        }
+    }
+    if (!this->nodeHasChildren(node)) {
+        return true;
+    }
+    node->updateOccupancyChildren();
+    return false;
+}
+
+void MergedOcTree::BoxVolumes(const octomap::OcTreeKey &min_key,
+                              const octomap::OcTreeKey &max_key,
+                              double *free,
+                              double *occupied) const {
+    *free = 0.0;
+    *occupied = 0.0;
+    if (root != NULL) {
+        this->BoxVolumesRecurs(root, octomap::OcTreeKey(0, 0, 0), 0, min_key, max_key, free, occupied);
+    }
+    const double node_volume = resolution*resolution*resolution;
+    *free *= node_volume;
+    *occupied *= node_volume;
+}
+
+void MergedOcTree::BoxVolumesRecurs(const MergedNode *node,
+                                    const octomap::OcTreeKey &first_key,
+                                    const unsigned &depth,
+                                    const octomap::OcTreeKey &min_key,
+                                    const octomap::OcTreeKey &max_key,
+                                    double *free,
+                                    double *occupied) const {
+    // Overlap of the node with the box, in finest nodes
+    const int size = 1 << (tree_depth - depth);
+    double overlap = 1.0;
+    bool inside = true;
+    for (unsigned i = 0; i < 3; i++) {
+        const int first = std::max(static_cast<int>(first_key[i]), static_cast<int>(min_key[i]));
+        const int last = std::min(static_cast<int>(first_key[i]) + size - 1, static_cast<int>(max_key[i]));
+        if (last < first) {
+            return;
+        }
+        overlap *= last - first + 1;
+        inside = inside && (last - first + 1 == size);
+    }
+
+    if (inside || !this->nodeHasChildren(node)) {
+        *free += overlap*node->GetFreeFraction();
+        *occupied += overlap*node->GetOccupiedFraction();
+        return;
+    }
+    const int half = size/2;
+    for (unsigned i = 0; i < 8; i++) {
+        if (this->nodeChildExists(node, i)) {
+            const octomap::OcTreeKey child_key(first_key[0] + ((i & 1) ? half : 0),
+                                               first_key[1] + ((i & 2) ? half : 0),
+                                               first_key[2] + ((i & 4) ? half : 0));
+            this->BoxVolumesRecurs(this->getNodeChild(node, i), child_key, depth + 1,
+                                   min_key, max_key, free, occupied);
+        }
+    }
+}
+
+MergedNode* MergedOcTree::CreateRoot() {
+    if (root == NULL) {
+        root = new MergedNode();
+        tree_size++;
+    }
+    return root;
+}
+
+int16_t MergedOcTree::Quantize(const double &log_odds) {
+    // kUnknown is reserved
+    const double raw = std::round(log_odds*kLogOddsScale);
+    return static_cast<int16_t>(std::min(std::max(raw, static_cast<double>(INT16_MIN + 1)),
+                                         static_cast<double>(INT16_MAX)));
+}
+
+}  // namespace octoclass
@@ -0,0 +1,42 @@
+/* Copyright (c) 2017, United States Government, as represented by the
+ * Administrator of the National Aeronautics and Space Administration.
+ *
+ * All rights reserved.
+ *
+ * The Astrobee platform is licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with the
+ * License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "mapper/occupancy_cache.h"
+
+#include <algorithm>
+#include <vector>
+
+namespace octoclass {
+
+void OccupancyCache::Reset(const octomap::OcTreeKey &center_key,
+                           const Eigen::Vector3i &half_size) {
+    center_key_ = center_key;
+    size_ = 2*half_size + Eigen::Vector3i::Ones();
+    for (int i = 0; i < 3; i++) {
+        min_key_[i] = static_cast<uint16_t>(std::max(static_cast<int>(center_key[i]) - half_size[i], 0));
+    }
+    const int64_t n_nodes = static_cast<int64_t>(size_[0])*size_[1]*size_[2];
+    words_.assign((n_nodes + 31)/32, 0);  // All unknown
+}
+
+void OccupancyCache::Clear() {
+    words_.clear();
+    size_.setZero();
+}
+
+}  // namespace octoclass
@@ -18,8 +18,11 @@
 
 #include <utility>
 #include <algorithm>
+#include <functional>
+#include <thread>
 #include <vector>
 #include <limits>
+#include <memory>
 #include <string>
 #include "mapper/octoclass.h"
 
@@ -29,29 +32,63 @@ OctoClass::OctoClass(const double &resolution,
                      const std::string &inertial_frame_id,
                      const bool &map_3d) {
     tree_.setResolution(resolution);
-    tree_inflated_.setResolution(resolution);
+    dynamic_tree_.setResolution(resolution);
+    dynamic_inflated_.setResolution(resolution);
     tree_depth_ = tree_.getTreeDepth();
     resolution_ = resolution;
     inertial_frame_id_ = inertial_frame_id;
     map_3d_ = map_3d;
+    this->UpdateScanParams();
 }
 
 OctoClass::OctoClass() {
 // Do nothing
 }
 
+OctoClass::OctoClass(const OctoClass *source)
+    : tree_(source->tree_),
+      dynamic_inflated_(source->dynamic_inflated_),
+      memory_time_(source->memory_time_),
+      cam_frustum_(source->cam_frustum_),
+      lidar_range_(source->lidar_range_) {
+    // Mapping state (dynamic tree, caches, distance field, window) is left empty:
+    // queries fall back to tree_ without them
+    dynamic_tree_.setResolution(source->resolution_);
+    tree_depth_ = source->tree_depth_;
+    resolution_ = source->resolution_;
+    max_range_ = source->max_range_;
+    min_range_ = source->min_range_;
+    inflate_radius_xy_ = source->inflate_radius_xy_;
+    inflate_radius_z_ = source->inflate_radius_z_;
+    inertial_frame_id_ = source->inertial_frame_id_;
+    map_3d_ = source->map_3d_;
+    this->UpdateScanParams();
+}
+
+std::unique_ptr<OctoClass> OctoClass::PlanningSnapshot() const {
+    return std::unique_ptr<OctoClass>(new OctoClass(this));
+}
+
 void OctoClass::SetMemory(const double &memory) {
     memory_time_ = memory;
+    dynamic_tree_.SetMemoryTime(memory_time_);
+    dynamic_inflated_.SetMemoryTime(memory_time_);
+    if (memory_time_ <= 0.0) {  // Everything goes to the persistent trees from now on
+        dynamic_tree_.clear();
+        dynamic_inflated_.clear();
+    }
     ROS_DEBUG("Fading memory time: %f seconds", memory_time_);
 }
 
 void OctoClass::SetMaxRange(const double &max_range) {
     max_range_ = max_range;
+    this->UpdateScanParams();
     ROS_DEBUG("Maximum range: %f meters", max_range_);
 }
 
 void OctoClass::SetMinRange(const double &min_range) {
     min_range_ = min_range;
+    this->UpdateScanParams();
     ROS_DEBUG("Minimum range: %f meters", min_range_);
 }
 
@@ -63,58 +100,98 @@ void OctoClass::SetInertialFrame(const std::string &inertial_frame_id) {
 void OctoClass::SetResolution(const double &resolution_in) {
     resolution_ = resolution_in;
     tree_.setResolution(resolution_);
-    tree_inflated_.setResolution(resolution_);
+    dynamic_tree_.setResolution(resolution_);
+    dynamic_inflated_.setResolution(resolution_);
     this->ResetMap();
 
-    // Set the volumes for the node sizes
-    depth_volumes_.resize(tree_depth_+1);
-    for (unsigned i= 0; i < depth_volumes_.size(); ++i) {
-        depth_volumes_[i] = pow(tree_inflated_.getNodeSize(i), 3);
-        // ROS_INFO("Volume for depth %d: %f", int(i), depth_volumes_[i]);
-    }
-
     this->SetMapInflation(inflate_radius_xy_, inflate_radius_z_);
 
     ROS_DEBUG("Map resolution: %f meters", resolution_);
 }
 
-void OctoClass::SetMapInflation(const double &inflate_radius_xy, const double &inflate_radius_z) {
-    inflate_radius_xy_ = inflate_radius_xy;
-    inflate_radius_z_ = inflate_radius_z;
-
-    if (!map_3d_) {
-        inflate_radius_z_ = 0.0001;
-    }
-
-    this->ResetMap();
-
-    sphere_.clear();
-    static Eigen::Vector3d xyz, xyz_normalized;
-    ROS_DEBUG("The map is being inflated by a radius of %f in XY direction!", inflate_radius_xy_);
-    ROS_DEBUG("The map is being inflated by a radius of %f in Z direction!", inflate_radius_z_);
-    const int max_xy = static_cast<int>(round(inflate_radius_xy/resolution_));
-    const int max_z = static_cast<int>(round(inflate_radius_z/resolution_));
-    static float d_origin;
+bool OctoClass::SetMapInflation(const double &inflate_radius_xy, const double &inflate_radius_z) {
+    const double radius_xy = inflate_radius_xy;
+    const double radius_z = map_3d_ ? inflate_radius_z : 0.0001;
+
+    std::vector<Eigen::Vector3i> sphere_keys;
+    Eigen::Vector3d xyz, xyz_normalized;
+    const int max_xy = static_cast<int>(round(radius_xy/resolution_));
+    const int max_z = static_cast<int>(round(radius_z/resolution_));
+    const Eigen::Vector3i grid_size(2*max_xy + 1, 2*max_xy + 1, 2*max_z + 1);
+    std::vector<bool> in_sphere(grid_size.prod(), false);  // Dense grid of stencil offsets
+    double sphere_radius = 0.0;
+    Eigen::Vector3i sphere_max_offset = Eigen::Vector3i::Zero();
     for (int x = -max_xy; x <= max_xy; x++) {
         for (int y = -max_xy; y <= max_xy; y++) {
             for (int z = -max_z; z <= max_z; z++) {
-                xyz_normalized << x*resolution_/inflate_radius_xy_,
-                                  y*resolution_/inflate_radius_xy_,
-                                  z*resolution_/inflate_radius_z_;
+                xyz_normalized << x*resolution_/radius_xy,
+                                  y*resolution_/radius_xy,
+                                  z*resolution_/radius_z;
                 xyz << x*resolution_, y*resolution_, z*resolution_;
 
                 // Check if point is inside ellipse using ellipse equation
                 if (xyz_normalized.dot(xyz_normalized) <= 1.0001) {
-                    sphere_.push_back(xyz);
-                    // std::cout << xyz.transpose() << std::endl;
+                    const Eigen::Vector3i offset(x, y, z);
+                    sphere_keys.push_back(offset);
+                    in_sphere[((x + max_xy)*grid_size[1] + y + max_xy)*grid_size[2] + z + max_z] = true;
+                    sphere_radius = std::max(sphere_radius, xyz.norm());
+                    sphere_max_offset = sphere_max_offset.cwiseMax(offset.cwiseAbs());
                 }
             }
         }
     }
+
+    // A node is covered by at most one stencil node of each occupied node, so
+    // the stencil size bounds the inflation counts. Larger stencils could
+    // overflow them: keep the current inflation instead
+    if (sphere_keys.size() > static_cast<size_t>(MergedNode::kMaxInflation)) {
+        ROS_ERROR("[mapper]: Inflation stencil of %zu nodes exceeds the %d supported at this resolution, "
+                  "keeping inflation radii %f (xy) and %f (z)!", sphere_keys.size(),
+                  MergedNode::kMaxInflation, inflate_radius_xy_, inflate_radius_z_);
+        return false;
+    }
+    inflate_radius_xy_ = radius_xy;
+    inflate_radius_z_ = radius_z;
+    sphere_keys_.swap(sphere_keys);
+    sphere_radius_ = sphere_radius;
+    sphere_max_offset_ = sphere_max_offset;
+    ROS_DEBUG("The map is being inflated by a radius of %f in XY direction!", inflate_radius_xy_);
+    ROS_DEBUG("The map is being inflated by a radius of %f in Z direction!", inflate_radius_z_);
+
+    // Shells: for each face direction d, the offsets o for which o + d is
+    // not in the stencil. When the endpoint k - d had its whole stencil
+    // inserted, these are the only nodes that endpoint k adds
+    for (int i = 0; i < 6; i++) {
+        const Eigen::Vector3i d = ScanParams::FaceDirection(i);
+        sphere_shells_[i].clear();
+        for (uint j = 0; j < sphere_keys_.size(); j++) {
+            const Eigen::Vector3i p = sphere_keys_[j] + d;
+            const bool p_in_sphere = (p.cwiseAbs().array() <= Eigen::Array3i(max_xy, max_xy, max_z)).all() &&
+                in_sphere[((p[0] + max_xy)*grid_size[1] + p[1] + max_xy)*grid_size[2] + p[2] + max_z];
+            if (!p_in_sphere) {
+                sphere_shells_[i].push_back(sphere_keys_[j]);
+            }
+        }
+    }
+    ROS_DEBUG("Inflation stencil: %d nodes (%d in each shell)",
+              static_cast<int>(sphere_keys_.size()), static_cast<int>(sphere_shells_[0].size()));
+    block_inflater_.SetStencil(sphere_keys_);
+    this->UpdateScanParams();
+
+    // Inflated map is derived from the slim one: no need to reset the map
+    dynamic_inflated_.clear();
+    this->RebuildInflation();
+    return true;
 }
 
-void OctoClass::SetMapInflation(const double &inflate_radius) {
-    this->SetMapInflation(inflate_radius, inflate_radius);
+bool OctoClass::SetMapInflation(const double &inflate_radius) {
+    return this->SetMapInflation(inflate_radius, inflate_radius);
+}
+
+void OctoClass::SetInflationShellOnly(const bool &shell_only) {
+    inflation_shell_only_ = shell_only;
+    this->UpdateScanParams();
+    ROS_DEBUG("Shell-only inflation: %s", shell_only ? "true" : "false");
 }
 
 void OctoClass::SetCamFrustum(const double &fov,
@@ -131,28 +208,306 @@ void OctoClass::SetLidarRange(const double &min_range,
 
 void OctoClass::ResetMap() {
     tree_.clear();
-    tree_inflated_.clear();
+    dynamic_tree_.clear();
+    dynamic_inflated_.clear();
+    if (esdf_.IsEnabled()) {
+        this->RebuildDistanceField(esdf_.Center());
+    }
+    if (collision_cache_.IsEnabled()) {
+        this->RebuildCollisionCache(collision_cache_.Center());
+    }
+    this->UpdateScanParams();  // Discard updates computed for the old map
+    this->MarkFullChange();
     ROS_DEBUG("Map was reset!");
 }
 
-void OctoClass::CopyMap(octomap::OcTree &tree, octomap::OcTree &tree_inflated) {
+bool OctoClass::CopyMap(const octomap::AbstractOcTree &tree) {
+    const MergedOcTree *merged = dynamic_cast<const MergedOcTree*>(&tree);
+    if (merged == NULL) {
+        return false;
+    }
     this->ResetMap();
 
-    for (octomap::OcTree::leaf_iterator it = tree.begin_leafs(),
-                                       end = tree.end_leafs();
-                                       it != end; ++it) {
-        tree_.updateNode(it.getKey(), it->getValue());
+    // Leaves are copied at their own depth, so pruned regions stay pruned
+    bulk_updater_.Clear();
+    for (MergedOcTree::leaf_iterator it = merged->begin_leafs(),
+                                     end = merged->end_leafs();
+                                     it != end; ++it) {
+        if (it->IsKnown(kSlimLayer)) {
+            bulk_updater_.AddLeaf(it.getKey(), it.getDepth(), merged->GetLogOdds(&(*it)));
+        }
+    }
+    bulk_updater_.Apply(&tree_);
+    this->RebuildInflation();  // Stencil might differ from the one the file was saved with
+    return true;
+}
+
+bool OctoClass::CopyMap(const octomap::AbstractOcTree &tree,
+                        const octomap::AbstractOcTree &tree_inflated) {
+    if ((dynamic_cast<const octomap::OcTree*>(&tree) == NULL) &&
+        (dynamic_cast<const FadingOcTree*>(&tree) == NULL)) {
+        return false;
+    }
+    this->ResetMap();
+
+    // Leaves are copied at their own depth, so pruned regions stay pruned.
+    // Fading trees are copied as persistent ones. The inflated tree is
+    // re-derived from the slim one rather than copied
+    bulk_updater_.Clear();
+    if (!this->AddLeaves<octomap::OcTree>(tree)) {
+        this->AddLeaves<FadingOcTree>(tree);
+    }
+    bulk_updater_.Apply(&tree_);
+    this->RebuildInflation();
+    return true;
+}
+
+template <typename TREE>
+bool OctoClass::AddLeaves(const octomap::AbstractOcTree &tree) {
+    const TREE *typed_tree = dynamic_cast<const TREE*>(&tree);
+    if (typed_tree == NULL) {
+        return false;
+    }
+    for (typename TREE::leaf_iterator it = typed_tree->begin_leafs(),
+                                      end = typed_tree->end_leafs();
+                                      it != end; ++it) {
+        bulk_updater_.AddLeaf(it.getKey(), it.getDepth(), it->getLogOdds());
+    }
+    return true;
+}
+
+void OctoClass::RebuildInflation() {
+    tree_.ClearInflation();
+
+    // Pruned occupied leaves contribute once per node at the maximum depth
+    std::vector<octomap::OcTreeKey> occupied;
+    for (MergedOcTree::leaf_iterator it = tree_.begin_leafs(),
+                                     end = tree_.end_leafs();
+                                     it != end; ++it) {
+        if (!tree_.IsNodeOccupied(&(*it), kSlimLayer)) {
+            continue;
+        }
+        const octomap::OcTreeKey first = it.getIndexKey();
+        const int size = 1 << (tree_depth_ - it.getDepth());
+        const int size_z = map_3d_ ? size : 1;
+        for (int x = 0; x < size; x++) {
+            for (int y = 0; y < size; y++) {
+                for (int z = 0; z < size_z; z++) {
+                    occupied.push_back(octomap::OcTreeKey(first[0] + x, first[1] + y, first[2] + z));
+                }
+            }
+        }
+    }
+
+    // Counts are computed on dense blocks and written back in one pass
+    const ros::Time t0 = ros::Time::now();
+    block_inflater_.Inflate(occupied, raycast_pool_.get(), &inflation_added_, &inflation_counts_);
+    if (window_enabled_) {
+        size_t n_kept = 0;
+        for (size_t i = 0; i < inflation_added_.size(); i++) {
+            if (this->InWindow(inflation_added_[i])) {
+                inflation_added_[n_kept] = inflation_added_[i];
+                inflation_counts_[n_kept++] = inflation_counts_[i];
+            }
+        }
+        inflation_added_.resize(n_kept);
+        inflation_counts_.resize(n_kept);
+    }
+    bulk_updater_.Clear();
+    bulk_updater_.AddInflation(inflation_added_, inflation_counts_);
+    bulk_updater_.Apply(&tree_, map_3d_);
+    ROS_DEBUG("Inflation was rebuilt from %d occupied nodes in %f seconds",
+              static_cast<int>(occupied.size()), (ros::Time::now() - t0).toSec());
+    this->MarkFullChange();
+    if (esdf_.IsEnabled()) {
+        this->RebuildDistanceField(esdf_.Center());
+    }
+    if (collision_cache_.IsEnabled()) {
+        this->RebuildCollisionCache(collision_cache_.Center());
+    }
+}
+
+void OctoClass::SetCollisionCache(const double &half_extent_xy,
+                                  const double &half_extent_z) {
+    cache_half_extent_xy_ = half_extent_xy;
+    cache_half_extent_z_ = map_3d_ ? half_extent_z : 0.0;
+    if (cache_half_extent_xy_ <= 0.0) {
+        collision_cache_.Clear();
+    } else {
+        this->RebuildCollisionCache(collision_cache_.IsEnabled() ? collision_cache_.Center() :
+                                                                   tree_.coordToKey(0.0, 0.0, 0.0));
+    }
+    ROS_DEBUG("Collision cache half extents: %f (xy), %f (z) meters", cache_half_extent_xy_, cache_half_extent_z_);
+}
+
+void OctoClass::RecenterCollisionCache(const Eigen::Vector3d &robot_position) {
+    if (!collision_cache_.IsEnabled()) {
+        return;
+    }
+    // Recenter once the robot has moved half way to the border of the box
+    const octomap::point3d center = tree_.keyToCoord(collision_cache_.Center());
+    if ((std::abs(robot_position[0] - center.x()) <= 0.5*cache_half_extent_xy_) &&
+        (std::abs(robot_position[1] - center.y()) <= 0.5*cache_half_extent_xy_) &&
+        (std::abs(robot_position[2] - center.z()) <= 0.5*cache_half_extent_z_ + resolution_)) {
+        return;
+    }
+    octomap::OcTreeKey key;
+    if (tree_.coordToKeyChecked(robot_position[0], robot_position[1], robot_position[2], key)) {
+        this->RebuildCollisionCache(key);
+    }
+}
+
+void OctoClass::RebuildCollisionCache(const octomap::OcTreeKey &center_key) {
+    const Eigen::Vector3i half_size(static_cast<int>(std::ceil(cache_half_extent_xy_/resolution_)),
+                                    static_cast<int>(std::ceil(cache_half_extent_xy_/resolution_)),
+                                    static_cast<int>(std::ceil(cache_half_extent_z_/resolution_)));
+    collision_cache_.Reset(center_key, half_size);
+
+    // Pruned leaves are copied into all their nodes inside the box
+    const octomap::OcTreeKey &min_key = collision_cache_.MinKey();
+    const Eigen::Vector3i &size = collision_cache_.Size();
+    const octomap::point3d center = tree_.keyToCoord(center_key);
+    const octomap::point3d extent(cache_half_extent_xy_, cache_half_extent_xy_, cache_half_extent_z_);
+    for (MergedOcTree::leaf_bbx_iterator it = tree_.begin_leafs_bbx(center - extent, center + extent),
+                                         end = tree_.end_leafs_bbx(); it != end; ++it) {
+        if (!it->IsKnown(kInflatedLayer)) {
+            continue;
+        }
+        const OccupancyCache::State state = tree_.IsNodeOccupied(&(*it), kInflatedLayer) ?
+                                            OccupancyCache::kOccupied : OccupancyCache::kFree;
+        const octomap::OcTreeKey first = it.getIndexKey();
+        const int leaf_size = 1 << (tree_depth_ - it.getDepth());
+        Eigen::Vector3i lo, hi;
+        for (int i = 0; i < 3; i++) {
+            lo[i] = std::max(static_cast<int>(first[i]), static_cast<int>(min_key[i]));
+            hi[i] = std::min(static_cast<int>(first[i]) + leaf_size, min_key[i] + size[i]);
+        }
+        for (int x = lo[0]; x < hi[0]; x++) {
+            for (int y = lo[1]; y < hi[1]; y++) {
+                for (int z = lo[2]; z < hi[2]; z++) {
+                    collision_cache_.Set(octomap::OcTreeKey(x, y, z), state);
+                }
+            }
+        }
+    }
+}
+
+void OctoClass::RefreshCollisionCache(const std::vector<octomap::OcTreeKey> &keys) {
+    if (!collision_cache_.IsEnabled()) {
+        return;
+    }
+    OccupancyCache::State state;
+    for (size_t i = 0; i < keys.size(); i++) {
+        if (collision_cache_.Get(keys[i], &state)) {
+            collision_cache_.Set(keys[i], this->TreeInflatedState(keys[i]));
+        }
+    }
+}
+
+OccupancyCache::State OctoClass::InflatedState(const octomap::OcTreeKey &key) const {
+    OccupancyCache::State state;
+    if (collision_cache_.Get(key, &state)) {
+        return state;
+    }
+    return this->TreeInflatedState(key);
+}
+
+OccupancyCache::State OctoClass::TreeInflatedState(const octomap::OcTreeKey &key) const {
+    const MergedNode *n = tree_.Search(key, kInflatedLayer);
+    if (n == NULL) {
+        return OccupancyCache::kUnknown;
+    }
+    return tree_.IsNodeOccupied(n, kInflatedLayer) ? OccupancyCache::kOccupied : OccupancyCache::kFree;
+}
+
+void OctoClass::SetDistanceField(const double &half_extent_xy,
+                                 const double &half_extent_z,
+                                 const double &max_distance) {
+    esdf_half_extent_xy_ = half_extent_xy;
+    esdf_half_extent_z_ = map_3d_ ? half_extent_z : 0.0;
+    esdf_max_distance_ = max_distance;
+    if (esdf_half_extent_xy_ <= 0.0) {
+        esdf_.Clear();
+    } else {
+        this->RebuildDistanceField(esdf_.IsEnabled() ? esdf_.Center() : tree_.coordToKey(0.0, 0.0, 0.0));
+    }
+    ROS_DEBUG("Distance field half extents: %f (xy), %f (z) meters, max distance: %f meters",
+              esdf_half_extent_xy_, esdf_half_extent_z_, esdf_max_distance_);
+}
+
+void OctoClass::RecenterDistanceField(const Eigen::Vector3d &robot_position) {
+    if (!esdf_.IsEnabled()) {
+        return;
+    }
+    // Recenter once the robot has moved half way to the border of the box
+    const octomap::point3d center = tree_.keyToCoord(esdf_.Center());
+    if ((std::abs(robot_position[0] - center.x()) <= 0.5*esdf_half_extent_xy_) &&
+        (std::abs(robot_position[1] - center.y()) <= 0.5*esdf_half_extent_xy_) &&
+        (std::abs(robot_position[2] - center.z()) <= 0.5*esdf_half_extent_z_ + resolution_)) {
+        return;
+    }
+    octomap::OcTreeKey key;
+    if (tree_.coordToKeyChecked(robot_position[0], robot_position[1], robot_position[2], key)) {
+        this->RebuildDistanceField(key);
+    }
+}
+
+void OctoClass::RebuildDistanceField(const octomap::OcTreeKey &center_key) {
+    const Eigen::Vector3i half_size(static_cast<int>(std::ceil(esdf_half_extent_xy_/resolution_)),
+                                    static_cast<int>(std::ceil(esdf_half_extent_xy_/resolution_)),
+                                    static_cast<int>(std::ceil(esdf_half_extent_z_/resolution_)));
+    esdf_.Reset(center_key, half_size, resolution_, esdf_max_distance_);
+
+    // Pruned leaves add all their nodes inside the box
+    const octomap::point3d center = tree_.keyToCoord(center_key);
+    const octomap::point3d extent(esdf_half_extent_xy_, esdf_half_extent_xy_, esdf_half_extent_z_);
+    for (MergedOcTree::leaf_bbx_iterator it = tree_.begin_leafs_bbx(center - extent, center + extent),
+                                         end = tree_.end_leafs_bbx(); it != end; ++it) {
+        if (!tree_.IsNodeOccupied(&(*it), kInflatedLayer)) {
+            continue;
+        }
+        const octomap::OcTreeKey first = it.getIndexKey();
+        const int size = 1 << (tree_depth_ - it.getDepth());
+        const int size_z = map_3d_ ? size : 1;
+        for (int x = 0; x < size; x++) {
+            for (int y = 0; y < size; y++) {
+                for (int z = 0; z < size_z; z++) {
+                    esdf_.SetObstacle(octomap::OcTreeKey(first[0] + x, first[1] + y, first[2] + z));
+                }
+            }
+        }
+    }
+    esdf_.Update();
+}
+
+void OctoClass::StencilKeys(const std::vector<octomap::OcTreeKey> &keys,
+                            std::vector<octomap::OcTreeKey> *stencil_keys) const {
+    stencil_keys->clear();
+    Eigen::Array3i min_key = Eigen::Array3i::Zero();
+    Eigen::Array3i max_key = Eigen::Array3i::Constant((1 << tree_depth_) - 1);
+    if (window_enabled_) {
+        min_key << window_min_key_[0], window_min_key_[1], window_min_key_[2];
+        max_key << window_max_key_[0], window_max_key_[1], window_max_key_[2];
     }
-    for (octomap::OcTree::leaf_iterator it = tree_inflated.begin_leafs(),
-                                        end = tree_inflated.end_leafs();
-                                        it != end; ++it) {
-        tree_inflated_.updateNode(it.getKey(), it->getValue());
+    for (size_t i = 0; i < keys.size(); i++) {
+        for (size_t j = 0; j < sphere_keys_.size(); j++) {
+            const Eigen::Vector3i k = Eigen::Vector3i(keys[i][0], keys[i][1], keys[i][2]) + sphere_keys_[j];
+            if ((k.array() >= min_key).all() && (k.array() <= max_key).all()) {
+                stencil_keys->push_back(octomap::OcTreeKey(k[0], k[1], k[2]));
+            }
+        }
     }
 }
 
 void OctoClass::SetOccupancyThreshold(const double &occupancy_threshold) {
+    dynamic_tree_.ApplyDecay();
+    dynamic_inflated_.ApplyDecay();
     tree_.setOccupancyThres(occupancy_threshold);
-    tree_inflated_.setOccupancyThres(occupancy_threshold);
+    dynamic_tree_.setOccupancyThres(occupancy_threshold);
+    dynamic_inflated_.setOccupancyThres(occupancy_threshold);
+    dynamic_tree_.RefreshExpiry();
+    dynamic_inflated_.RefreshExpiry();
+    this->RebuildInflation();  // Set of occupied slim nodes might have changed
     ROS_DEBUG("Occupancy probability threshold: %f", occupancy_threshold);
 }
 
@@ -160,18 +515,26 @@ void OctoClass::SetHitMissProbabilities(const double &probability_hit,
                                         const double &probability_miss) {
     tree_.setProbHit(probability_hit);
     tree_.setProbMiss(probability_miss);
-    tree_inflated_.setProbHit(probability_hit);
-    tree_inflated_.setProbMiss(probability_miss);
+    dynamic_tree_.setProbHit(probability_hit);
+    dynamic_tree_.setProbMiss(probability_miss);
+    dynamic_inflated_.setProbHit(probability_hit);
+    dynamic_inflated_.setProbMiss(probability_miss);
     ROS_DEBUG("Probability hit: %f", probability_hit);
     ROS_DEBUG("Probability miss: %f", probability_miss);
 }
 
 void OctoClass::SetClampingThresholds(const double &clamping_threshold_min,
                                       const double &clamping_threshold_max) {
+    dynamic_tree_.ApplyDecay();
+    dynamic_inflated_.ApplyDecay();
     tree_.setClampingThresMin(clamping_threshold_min);
     tree_.setClampingThresMax(clamping_threshold_max);
-    tree_inflated_.setClampingThresMin(clamping_threshold_min);
-    tree_inflated_.setClampingThresMax(clamping_threshold_max);
+    dynamic_tree_.setClampingThresMin(clamping_threshold_min);
+    dynamic_tree_.setClampingThresMax(clamping_threshold_max);
+    dynamic_inflated_.setClampingThresMin(clamping_threshold_min);
+    dynamic_inflated_.setClampingThresMax(clamping_threshold_max);
+    dynamic_tree_.RefreshExpiry();
+    dynamic_inflated_.RefreshExpiry();
     ROS_DEBUG("Clamping threshold minimum: %f", clamping_threshold_min);
     ROS_DEBUG("Clamping threshold maximum: %f", clamping_threshold_max);
 }
@@ -181,6 +544,20 @@ void OctoClass::SetMap3d(const bool &map_3d) {
     if (!map_3d_) {
         this->SetMapInflation(inflate_radius_xy_, 0.0);
     }
+    this->UpdateScanParams();
+}
+
+void OctoClass::SetRaycastThreads(const int &n_threads) {
+    if (n_threads > 0) {
+        raycast_threads_ = n_threads;
+    } else {
+        raycast_threads_ = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    }
+    // A single pool serves all mapping workers, so the number of busy
+    // threads never exceeds raycast_threads_ plus the number of workers
+    raycast_pool_.reset(new WorkerPool(raycast_threads_));
+    this->UpdateScanParams();
+    ROS_DEBUG("Raycasting threads: %d", raycast_threads_);
 }
 
 // Function obtained from https://github.com/OctoMap/octomap_ros
@@ -219,355 +596,470 @@ void OctoClass::PointsOctomapToPointCloud2(const octomap::point3d_list& points,
     }
 }
 
-void OctoClass::PclToRayOctomap(const pcl::PointCloud< pcl::PointXYZ > &cloud,
-                                const tf::StampedTransform &tf_cam2world,
+void OctoClass::PclToRayOctomap(const cloud_view::XYZView &cloud_xyz,
+                                const Eigen::Affine3d &tf_cam2world,
                                 const algebra_3d::FrustumPlanes &frustum) {
-    // set camera origin
-    tf::Vector3 v = tf_cam2world.getOrigin();
-    if (!map_3d_) {
-        v.setZ(0.0);
-    }
-    const octomap::point3d pcl_origin = octomap::point3d(v.getX(), v.getY(), v.getZ());
-    const double min_threshold_sqr = min_range_*min_range_;
-    const uint32_t width = cloud.width;
-    const uint32_t height = cloud.height;
-    static double range_sqr;
-
-    // discretize point cloud
-    // octomap::Pointcloud octoCloud, inflatedSafeCloud;
-    // octoCloud.reserve(cloud.height*cloud.width);
-    octomap::KeySet endpoints, endpoints_inflated;
-    static octomap::point3d central_point, cur_point;
-    const double max_range_sqr = max_range_*max_range_;
-    pcl::PointXYZ point;
-    for (uint32_t i = 0; i < height; i++) {
-        for (uint32_t j = 0; j < width; j++) {
-            if (cloud.is_dense) {
-                point = cloud.at(j);
-            } else {
-                point = cloud.at(j, i);
-            }
+    scan_worker_.Compute(scan_params_, cloud_xyz, tf_cam2world, &frustum, &scan_update_);
+    this->ApplyScanUpdate(scan_update_);
+}
 
-            if (!map_3d_) {
-                point.z = 0.0;
-            }
+void OctoClass::PclToRayOctomap(const cloud_view::XYZView &cloud_xyz,
+                                const Eigen::Affine3d &tf_cam2world) {
+    scan_worker_.Compute(scan_params_, cloud_xyz, tf_cam2world, NULL, &scan_update_);
+    this->ApplyScanUpdate(scan_update_);
+}
 
-            // Check if the point is invalid
-            if (std::isnan(point.x) || std::isnan(point.y) || std::isnan(point.z)) {
-                continue;
-            }
+bool OctoClass::ApplyScanUpdate(const ScanUpdate &update) {
+    // Parameters changed (and the map might have been reset) since the update was computed
+    if (update.params != scan_params_) {
+        return false;
+    }
 
-            // Check if point is within camera frustum
-            if (!frustum.IsPointWithinFrustum(Eigen::Vector3d(point.x, point.y, point.z))) {
-                continue;
-            }
+    // Nothing is mapped outside the rolling window
+    const std::vector<octomap::OcTreeKey> *occupied = &update.occupied;
+    const std::vector<octomap::OcTreeKey> *inflated_occupied = &update.inflated_occupied;
+    const std::vector<octomap::OcTreeKey> *free = &update.free;
+    if (window_enabled_) {
+        this->ClipToWindow(update.occupied, &window_occupied_);
+        this->ClipToWindow(update.inflated_occupied, &window_inflated_occupied_);
+        this->ClipToWindow(update.free, &window_free_);
+        occupied = &window_occupied_;
+        inflated_occupied = &window_inflated_occupied_;
+        free = &window_free_;
+    }
 
-            // points too close to origin of camera are not added
-            range_sqr = helper::VectorNormSquared(v.getX()-point.x,
-                                                  v.getY()-point.y,
-                                                  v.getZ()-point.z);
-            if ((range_sqr < min_threshold_sqr)) {
-                continue;
-            }
+    // Only the ancestors of updated nodes get pruned (2D maps have a single
+    // layer of nodes, so nothing there could ever be pruned)
+    if (memory_time_ > 0.0) {
+        // Hits on long-standing free space are most likely moving obstacles:
+        // they go into the dynamic layer. Misses clear both layers
+        this->SplitHits(*occupied, kSlimLayer, &persistent_hits_, &dynamic_hits_);
+        this->KnownKeys(*free, dynamic_tree_, &dynamic_misses_);
+        this->BulkUpdate(dynamic_hits_, dynamic_misses_, map_3d_, &dynamic_tree_);
+
+        this->SplitHits(*inflated_occupied, kInflatedLayer, NULL, &dynamic_hits_);
+        this->KnownKeys(*free, dynamic_inflated_, &dynamic_misses_);
+        this->BulkUpdate(dynamic_hits_, dynamic_misses_, map_3d_, &dynamic_inflated_);
+        this->MarkChanged(dynamic_hits_);
+        this->MarkChanged(dynamic_misses_);
+
+        occupied = &persistent_hits_;
+    }
 
-            // create discretized octocloud
-            octomap::OcTreeKey k = tree_.coordToKey(octomap::point3d(point.x,
-                                                                     point.y,
-                                                                     point.z));
-            // Add non-repeated nodes to keysets (inflated and non-inflated)
-            std::pair<octomap::KeySet::iterator, bool> ret = endpoints.insert(k);
-            octomap::OcTreeKey key;
-            if (ret.second) {  // insertion took place => k was not in set
-                // insert points in inflated octomap
-                if (range_sqr < max_range_sqr) {
-                    central_point = tree_.keyToCoord(k);
-                    for (uint jj = 0; jj < sphere_.size(); jj++) {
-                        cur_point = central_point + octomap::point3d(sphere_[jj][0], sphere_[jj][1], sphere_[jj][2]);
-                        // Eigen::Vector3d pt = Eigen::Vector3d(cur_point.x(), cur_point.y(), cur_point.z());
-                        if (!frustum.IsPointWithinFrustum(Eigen::Vector3d(cur_point.x(),
-                                                                          cur_point.y(),
-                                                                          cur_point.z()))) {
-                            continue;
-                        }
-                        if (tree_.coordToKeyChecked(cur_point, key)) {
-                           endpoints_inflated.insert(key);
-                        }
-                    }
-                }
-            }
+    bulk_updater_.Clear();
+    bulk_updater_.AddHits(*occupied);
+    bulk_updater_.AddMisses(*free);
+    bulk_updater_.Apply(&tree_, map_3d_);
+    known_keys_ = bulk_updater_.BecameKnown();
+
+    // Each occupied slim node adds one to the count of every node in its
+    // stencil, so only nodes that changed occupancy touch the inflated map
+    this->StencilKeys(bulk_updater_.BecameOccupied(), &inflation_added_);
+    this->StencilKeys(bulk_updater_.BecameFree(), &inflation_removed_);
+    this->UpdateInflation();
+    this->RefreshCollisionCache(known_keys_);  // Unknown nodes that are now free
+    return true;
+}
+
+void OctoClass::UpdateInflation() {
+    if (inflation_added_.empty() && inflation_removed_.empty()) {
+        return;
+    }
+    bulk_updater_.Clear();
+    bulk_updater_.AddInflation(inflation_added_, 1);
+    bulk_updater_.AddInflation(inflation_removed_, -1);
+    bulk_updater_.Apply(&tree_, map_3d_);
+
+    // Distance field, cache and path checks only see the nodes whose inflated occupancy changed
+    this->RefreshCollisionCache(bulk_updater_.BecameOccupied());
+    this->RefreshCollisionCache(bulk_updater_.BecameFree());
+    this->MarkChanged(bulk_updater_.BecameOccupied());
+    this->MarkChanged(bulk_updater_.BecameFree());
+    if (esdf_.IsEnabled()) {
+        const std::vector<octomap::OcTreeKey> &added = bulk_updater_.BecameOccupied();
+        const std::vector<octomap::OcTreeKey> &removed = bulk_updater_.BecameFree();
+        for (size_t i = 0; i < added.size(); i++) {
+            esdf_.SetObstacle(added[i]);
+        }
+        for (size_t i = 0; i < removed.size(); i++) {
+            esdf_.RemoveObstacle(removed[i]);
         }
+        esdf_.Update();
     }
+}
 
-    // Calculate free nodes
-    octomap::KeySet occ_cells_in_range, free_cells, inflated_free_cells;
-    ComputeUpdate(endpoints_inflated, endpoints, pcl_origin, max_range_,
-                  &occ_cells_in_range, &free_cells, &inflated_free_cells);
+void OctoClass::SetRollingWindow(const double &half_extent_xy,
+                                 const double &half_extent_z) {
+    window_half_extent_xy_ = half_extent_xy;
+    window_half_extent_z_ = half_extent_z;
+    window_enabled_ = (half_extent_xy > 0.0);
+    window_center_ = Eigen::Vector3d::Constant(std::numeric_limits<double>::infinity());  // Moved on next call
+    window_min_key_ = octomap::OcTreeKey(0, 0, 0);  // Whole key range until then
+    window_max_key_ = octomap::OcTreeKey((1 << tree_depth_) - 1, (1 << tree_depth_) - 1, (1 << tree_depth_) - 1);
+    ROS_DEBUG("Rolling window half extents: %f (xy), %f (z) meters", half_extent_xy, half_extent_z);
+}
 
-    for (octomap::KeySet::iterator it = endpoints_inflated.begin(); it != endpoints_inflated.end(); ++it) {
-        // Only add nodes that are being added to the slim tree as well
-        if (free_cells.find(*it) != free_cells.end()) {
-            tree_inflated_.updateNode(*it, true);
-        } else if (endpoints.find(*it) != endpoints.end()) {
-            tree_inflated_.updateNode(*it, true);
-        }
+void OctoClass::SetSpillCallback(const SpillCallback &spill) {
+    spill_ = spill;
+}
+
+void OctoClass::MoveWindow(const Eigen::Vector3d &robot_position) {
+    // The window moves in steps of a quarter of its size, so most calls return here
+    if (!window_enabled_ ||
+        ((std::abs(robot_position[0] - window_center_[0]) <= 0.25*window_half_extent_xy_) &&
+         (std::abs(robot_position[1] - window_center_[1]) <= 0.25*window_half_extent_xy_) &&
+         (!map_3d_ || (std::abs(robot_position[2] - window_center_[2]) <= 0.25*window_half_extent_z_)))) {
+        return;
     }
-    for (octomap::KeySet::iterator it = occ_cells_in_range.begin(); it != occ_cells_in_range.end(); ++it) {
-        const octomap::point3d& p = tree_.keyToCoord(*it);
-        if ((p - pcl_origin).norm() <= max_range_) {
-            tree_.updateNode(*it, true);
+    window_center_ = robot_position;
+    const octomap::OcTreeKey old_min_key = window_min_key_, old_max_key = window_max_key_;
+    const octomap::point3d extent(window_half_extent_xy_, window_half_extent_xy_, window_half_extent_z_);
+    const octomap::point3d center(robot_position[0], robot_position[1], robot_position[2]);
+    const octomap::point3d box_min = center - extent, box_max = center + extent;
+    const double max_coord = tree_.getNodeSize(0)/2.0 - resolution_;  // Clamp to the key range
+    for (int i = 0; i < 3; i++) {
+        window_min_key_[i] = tree_.coordToKey(std::max(static_cast<double>(box_min(i)), -max_coord));
+        window_max_key_[i] = tree_.coordToKey(std::min(static_cast<double>(box_max(i)), max_coord));
+    }
+    if (!map_3d_) {  // 2D maps span the whole z range
+        window_min_key_[2] = 0;
+        window_max_key_[2] = (1 << tree_depth_) - 1;
+    }
+
+    // Whole subtrees outside the window are deleted. Obstacles near the window
+    // stop inflating the nodes that remain in it
+    evicted_occupied_.clear();
+    size_t n_evicted = 0;
+    if (tree_.getRoot() != NULL) {
+        if (this->EvictOutsideWindow(&tree_, tree_.getRoot(), octomap::OcTreeKey(0, 0, 0), 0, &n_evicted)) {
+            tree_.clear();
         }
     }
-    for (octomap::KeySet::iterator it = inflated_free_cells.begin(); it != inflated_free_cells.end(); ++it) {
-            tree_inflated_.updateNode(*it, false);
-            tree_.updateNode(*it, false);
+    if ((dynamic_tree_.getRoot() != NULL) &&
+        this->EvictOutsideWindow(&dynamic_tree_, dynamic_tree_.getRoot(), octomap::OcTreeKey(0, 0, 0), 0, &n_evicted)) {
+        dynamic_tree_.clear();
+    }
+    if ((dynamic_inflated_.getRoot() != NULL) &&
+        this->EvictOutsideWindow(&dynamic_inflated_, dynamic_inflated_.getRoot(),
+                                 octomap::OcTreeKey(0, 0, 0), 0, &n_evicted)) {
+        dynamic_inflated_.clear();
+    }
+
+    // Stencils are clipped to the window. Evicted obstacles were only counted
+    // in nodes that were already in the previous window, and the nodes that
+    // just entered it are counted from the obstacles that remain
+    this->StencilKeys(evicted_occupied_, &inflation_removed_);
+    FilterByBox(old_min_key, old_max_key, true, &inflation_removed_);
+    this->OccupiedAroundEntered(old_min_key, old_max_key, &entered_sources_);
+    this->StencilKeys(entered_sources_.Keys(), &inflation_added_);
+    FilterByBox(old_min_key, old_max_key, false, &inflation_added_);
+    this->UpdateInflation();
+    if (collision_cache_.IsEnabled()) {
+        this->RebuildCollisionCache(collision_cache_.Center());  // Evicted nodes are unknown now
     }
+    this->MarkFullChange();
+    ROS_DEBUG("Rolling window moved to (%f, %f, %f): %zu subtrees evicted",
+              robot_position[0], robot_position[1], robot_position[2], n_evicted);
 }
 
-void OctoClass::PclToRayOctomap(const pcl::PointCloud< pcl::PointXYZ > &cloud,
-                                const tf::StampedTransform &tf_cam2world) {
-    // set camera origin
-    tf::Vector3 v = tf_cam2world.getOrigin();
-    if (!map_3d_) {
-        v.setZ(0.0);
-    }
-    const octomap::point3d pcl_origin = octomap::point3d(v.getX(), v.getY(), v.getZ());
-    const double min_threshold_sqr = min_range_*min_range_;
-    const uint32_t width = cloud.width;
-    const uint32_t height = cloud.height;
-    static double range_sqr;
-    // double closest_range_sqr = 100;
-    // Eigen::Vector3d closest_point, cur_position(v.getX(), v.getY(), v.getZ());
-
-    // discretize point cloud
-    // octomap::Pointcloud octoCloud, inflatedSafeCloud;
-    // octoCloud.reserve(cloud.height*cloud.width);
-    octomap::KeySet endpoints, endpoints_inflated;
-    static octomap::point3d central_point, cur_point;
-    const double max_range_sqr = max_range_*max_range_;
-    pcl::PointXYZ point;
-    for (uint32_t i = 0; i < height; i++) {
-        for (uint32_t j = 0; j < width; j++) {
-            if (cloud.is_dense) {
-                point = cloud.at(j);
-            } else {
-                point = cloud.at(j, i);
-            }
+bool OctoClass::InWindow(const octomap::OcTreeKey &key) const {
+    return InBox(key, window_min_key_, window_max_key_);
+}
 
-            if (!map_3d_) {
-                point.z = 0.0;
-            }
+bool OctoClass::InBox(const octomap::OcTreeKey &key,
+                      const octomap::OcTreeKey &min_key,
+                      const octomap::OcTreeKey &max_key) {
+    return (key[0] >= min_key[0]) && (key[0] <= max_key[0]) &&
+           (key[1] >= min_key[1]) && (key[1] <= max_key[1]) &&
+           (key[2] >= min_key[2]) && (key[2] <= max_key[2]);
+}
 
-            // Check if the point is invalid
-            if (std::isnan(point.x) || std::isnan(point.y) || std::isnan(point.z)) {
-                continue;
-            }
+void OctoClass::FilterByBox(const octomap::OcTreeKey &min_key,
+                            const octomap::OcTreeKey &max_key,
+                            const bool &inside,
+                            std::vector<octomap::OcTreeKey> *keys) {
+    size_t n_kept = 0;
+    for (size_t i = 0; i < keys->size(); i++) {
+        if (InBox((*keys)[i], min_key, max_key) == inside) {
+            (*keys)[n_kept++] = (*keys)[i];
+        }
+    }
+    keys->resize(n_kept);
+}
 
-            // points too close to origin of camera are not added
-            range_sqr = helper::VectorNormSquared(v.getX()-point.x,
-                                                  v.getY()-point.y,
-                                                  v.getZ()-point.z);
-            // if (range_sqr < closest_range_sqr) {
-            //     closest_range_sqr = range_sqr;
-            //     closest_point = Eigen::Vector3d(point.x, point.y, point.z);
-            // }
-            if ((range_sqr < min_threshold_sqr)) {
+void OctoClass::OccupiedAroundEntered(const octomap::OcTreeKey &old_min_key,
+                                      const octomap::OcTreeKey &old_max_key,
+                                      FlatKeySet *occupied) const {
+    occupied->Clear();
+    const int key_limit = (1 << tree_depth_) - 1;
+    for (int i = 0; i < 3; i++) {
+        for (int side = 0; side < 2; side++) {
+            // Slab of the window beyond one face of the previous window
+            Eigen::Array3i slab_min(window_min_key_[0], window_min_key_[1], window_min_key_[2]);
+            Eigen::Array3i slab_max(window_max_key_[0], window_max_key_[1], window_max_key_[2]);
+            if (side == 0) {
+                slab_max[i] = std::min(slab_max[i], old_min_key[i] - 1);
+            } else {
+                slab_min[i] = std::max(slab_min[i], old_max_key[i] + 1);
+            }
+            if (slab_min[i] > slab_max[i]) {
                 continue;
             }
 
-            // create discretized octocloud
-            octomap::OcTreeKey k = tree_.coordToKey(octomap::point3d(point.x,
-                                                                     point.y,
-                                                                     point.z));
-            // Add non-repeated nodes to keysets (inflated and non-inflated)
-            std::pair<octomap::KeySet::iterator, bool> ret = endpoints.insert(k);
-            octomap::OcTreeKey key;
-            if (ret.second) {  // insertion took place => k was not in set
-                // insert points in inflated octomap
-                if (range_sqr < max_range_sqr) {
-                    central_point = tree_.keyToCoord(k);
-                    for (uint jj = 0; jj < sphere_.size(); jj++) {
-                        cur_point = central_point + octomap::point3d(sphere_[jj][0], sphere_[jj][1], sphere_[jj][2]);
-                        if (tree_.coordToKeyChecked(cur_point, key)) {
-                           endpoints_inflated.insert(key);
+            // Obstacles whose stencil reaches into the slab
+            const Eigen::Array3i box_min = (slab_min - sphere_max_offset_.array()).max(0);
+            const Eigen::Array3i box_max = (slab_max + sphere_max_offset_.array()).min(key_limit);
+            const octomap::OcTreeKey min_key(box_min[0], box_min[1], box_min[2]);
+            const octomap::OcTreeKey max_key(box_max[0], box_max[1], box_max[2]);
+            for (MergedOcTree::leaf_bbx_iterator it = tree_.begin_leafs_bbx(min_key, max_key),
+                                                 end = tree_.end_leafs_bbx();
+                                                 it != end; ++it) {
+                if (!tree_.IsNodeOccupied(&(*it), kSlimLayer)) {
+                    continue;
+                }
+                // Pruned leaves contribute once per node at the maximum depth
+                const octomap::OcTreeKey first = it.getIndexKey();
+                const int size = 1 << (tree_depth_ - it.getDepth());
+                const Eigen::Array3i lo = Eigen::Array3i(first[0], first[1], first[2]).max(box_min);
+                const Eigen::Array3i hi = (Eigen::Array3i(first[0], first[1], first[2]) + (size - 1)).min(box_max);
+                const int hi_z = map_3d_ ? hi[2] : lo[2];
+                for (int x = lo[0]; x <= hi[0]; x++) {
+                    for (int y = lo[1]; y <= hi[1]; y++) {
+                        for (int z = lo[2]; z <= hi_z; z++) {
+                            occupied->Insert(octomap::OcTreeKey(x, y, z));
                         }
                     }
                 }
             }
         }
     }
-    // std::cout << "Closest range: " << sqrt(closest_range_sqr) << std::endl;
-    // std::cout << "Closest point: " << closest_point.transpose() << std::endl;
-    // std::cout << "Current point: " << cur_position.transpose() << std::endl;
+}
 
-    // Calculate free nodes
-    octomap::KeySet occ_cells_in_range, free_cells, inflated_free_cells;
-    ComputeUpdate(endpoints_inflated, endpoints, pcl_origin, max_range_,
-                  &occ_cells_in_range, &free_cells, &inflated_free_cells);
+void OctoClass::ClipToWindow(const std::vector<octomap::OcTreeKey> &keys,
+                             std::vector<octomap::OcTreeKey> *clipped) const {
+    clipped->clear();
+    for (size_t i = 0; i < keys.size(); i++) {
+        if (this->InWindow(keys[i])) {
+            clipped->push_back(keys[i]);
+        }
+    }
+}
 
-    for (octomap::KeySet::iterator it = endpoints_inflated.begin(); it != endpoints_inflated.end(); ++it) {
-        tree_inflated_.updateNode(*it, true);
+template <typename TREE>
+bool OctoClass::EvictOutsideWindow(TREE *tree,
+                                   typename TREE::NodeType *node,
+                                   const octomap::OcTreeKey &first_key,
+                                   const unsigned &depth,
+                                   size_t *n_evicted) {
+    // Node covers keys [first_key, first_key + size - 1] in each direction
+    const int size = 1 << (tree_depth_ - depth);
+    bool inside = true, outside = false;
+    for (int i = 0; i < 3; i++) {
+        const int last = first_key[i] + size - 1;
+        outside = outside || (last < window_min_key_[i]) || (first_key[i] > window_max_key_[i]);
+        inside = inside && (first_key[i] >= window_min_key_[i]) && (last <= window_max_key_[i]);
+    }
+    if (outside) {
+        this->OnEvict(tree, node, first_key, depth);
+        (*n_evicted)++;
+        return true;
     }
-    for (octomap::KeySet::iterator it = occ_cells_in_range.begin(); it != occ_cells_in_range.end(); ++it) {
-        const octomap::point3d& p = tree_.keyToCoord(*it);
-        if ((p - pcl_origin).norm() <= max_range_) {
-            tree_.updateNode(*it, true);
+    if (inside || !tree->nodeHasChildren(node)) {
+        return false;  // Leaves across the border are kept whole
+    }
+
+    const int half = size/2;
+    for (unsigned i = 0; i < 8; i++) {
+        if (!tree->nodeChildExists(node, i)) {
+            continue;
+        }
+        const octomap::OcTreeKey child_key(first_key[0] + (i & 1)*half,
+                                           first_key[1] + ((i >> 1) & 1)*half,
+                                           first_key[2] + ((i >> 2) & 1)*half);
+        if (this->EvictOutsideWindow(tree, tree->getNodeChild(node, i), child_key, depth + 1, n_evicted)) {
+            tree->deleteNodeChild(node, i);
         }
     }
-    for (octomap::KeySet::iterator it = inflated_free_cells.begin(); it != inflated_free_cells.end(); ++it) {
-            tree_inflated_.updateNode(*it, false);
-            tree_.updateNode(*it, false);
+    if (!tree->nodeHasChildren(node)) {
+        return true;  // Nothing left inside the window
     }
+    node->updateOccupancyChildren();
+    return false;
 }
 
-void OctoClass::ComputeUpdate(const octomap::KeySet &occ_inflated,  // Inflated endpoints
-                              const octomap::KeySet &occ_slim,      // Non-inflated endpoints
-                              const octomap::point3d& origin,
-                              const double &max_range,
-                              octomap::KeySet *occ_slim_in_range,
-                              octomap::KeySet *free_slim,
-                              octomap::KeySet *free_inflated) {
-    octomap::KeyRay keyray;
-    for (octomap::KeySet::const_iterator occIt = occ_slim.begin(); occIt != occ_slim.end(); ++occIt) {
-        const octomap::point3d& p = tree_inflated_.keyToCoord(*occIt);
-
-        // If in line of sight, add free cells
-        if ((max_range < 0.0) || ((p - origin).norm() <= max_range)) {  // is not max_range_ meas.
-            octomap::OcTreeKey key;
-            if (tree_.coordToKeyChecked(p, key)) {
-                occ_slim_in_range->insert(key);
+void OctoClass::OnEvict(FadingOcTree *tree,
+                        FadingNode *node,
+                        const octomap::OcTreeKey &first_key,
+                        const unsigned &depth) {}
+
+void OctoClass::OnEvict(MergedOcTree *tree,
+                        MergedNode *node,
+                        const octomap::OcTreeKey &first_key,
+                        const unsigned &depth) {
+    const int size = 1 << (tree_depth_ - depth);
+    if (tree->nodeHasChildren(node)) {
+        const int half = size/2;
+        for (unsigned i = 0; i < 8; i++) {
+            if (tree->nodeChildExists(node, i)) {
+                this->OnEvict(tree, tree->getNodeChild(node, i),
+                              octomap::OcTreeKey(first_key[0] + (i & 1)*half,
+                                                 first_key[1] + ((i >> 1) & 1)*half,
+                                                 first_key[2] + ((i >> 2) & 1)*half), depth + 1);
             }
+        }
+        return;
+    }
+    if (!node->IsKnown(kSlimLayer)) {
+        return;
+    }
+    if (spill_) {
+        spill_(first_key, depth, tree->GetLogOdds(node));
+    }
 
-            // Ray keys are already checked using coordToKeyChecked
-            tree_inflated_.computeRayKeys(origin, p, keyray);
-            free_slim->insert(keyray.begin(), keyray.end());
-            for (octomap::KeyRay::iterator it = keyray.begin(); it != keyray.end(); ++it) {
-                if (occ_inflated.find(*it) == occ_inflated.end()) {   // If not occupied
-                    free_inflated->insert(*it);
-                } else {  // If occupied
-                    break;
-                }
-            }
-        } else {  // user set a max_range_ and length is above
-            octomap::point3d direction = (p - origin).normalized();
-            octomap::point3d new_end = origin + direction * static_cast<float>(max_range);
-            tree_inflated_.computeRayKeys(origin, new_end, keyray);
-            free_slim->insert(keyray.begin(), keyray.end());
-            for (octomap::KeyRay::iterator it = keyray.begin(); it != keyray.end(); ++it) {
-                if (occ_inflated.find(*it) == occ_inflated.end()) {  // If not occupied
-                    free_inflated->insert(*it);
-                } else {  // If occupied
-                    break;
-                }
+    // Only obstacles whose stencil reaches into the window inflate nodes that are kept
+    if (!tree->IsNodeOccupied(node, kSlimLayer)) {
+        return;
+    }
+    for (int i = 0; i < 3; i++) {
+        if ((first_key[i] + size - 1 + sphere_max_offset_[i] < window_min_key_[i]) ||
+            (first_key[i] - sphere_max_offset_[i] > window_max_key_[i])) {
+            return;
+        }
+    }
+    const int size_z = map_3d_ ? size : 1;
+    for (int x = 0; x < size; x++) {
+        for (int y = 0; y < size; y++) {
+            for (int z = 0; z < size_z; z++) {
+                evicted_occupied_.push_back(octomap::OcTreeKey(first_key[0] + x, first_key[1] + y,
+                                                               first_key[2] + z));
             }
         }
     }
 }
 
-void OctoClass::FadeMemory(const double &rate) {  // rate at which this function is being called
-    const double clamp_log_max = tree_.getClampingThresMaxLog();
-    const double clamp_log_min = tree_.getClampingThresMinLog();
-    const double occ_thres = tree_.getOccupancyThres();
-    // const double probLogHit = tree.getProbHitLog();
-    const double prob_log_range_obs = clamp_log_max - occ_thres;
-    const double prob_log_range_free = clamp_log_min - occ_thres;
-    const double fading_obs_log_prob_per_run = -prob_log_range_obs/(memory_time_*rate);
-    const double fading_free_log_prob_per_run = -prob_log_range_free/(memory_time_*rate);
-
-    static bool is_occ;
-    static octomap::OcTreeKey key;
-    for (octomap::OcTree::leaf_iterator it = tree_.begin_leafs(),
-                                       end = tree_.end_leafs();
-                                       it != end; ++it) {
-        // fade obstacles and free areas
-        key = it.getKey();
-        octomap::OcTreeNode* n = tree_.search(key);
-        is_occ = tree_.isNodeOccupied(n);
-        if (is_occ) {
-            tree_.updateNodeLogOdds(n, fading_obs_log_prob_per_run);
-        } else {
-            tree_.updateNodeLogOdds(n, fading_free_log_prob_per_run);
+void OctoClass::SplitHits(const std::vector<octomap::OcTreeKey> &hits,
+                          const MapLayer &layer,
+                          std::vector<octomap::OcTreeKey> *persistent,
+                          std::vector<octomap::OcTreeKey> *dynamic) {
+    if (persistent != NULL) {
+        persistent->clear();
+    }
+    dynamic->clear();
+    for (size_t i = 0; i < hits.size(); i++) {
+        const MergedNode *node = tree_.Search(hits[i], layer);
+        if ((node != NULL) && !tree_.IsNodeOccupied(node, layer) && tree_.IsSaturated(node, -1.0f)) {
+            dynamic->push_back(hits[i]);
+        } else if (persistent != NULL) {
+            persistent->push_back(hits[i]);
         }
+    }
+}
 
-        // tree nodes that are unknown
-        if (is_occ != tree_.isNodeOccupied(n)) {  // if it was occupied then disoccupied, delete node
-            tree_.deleteNode(key, it.getDepth());
+void OctoClass::KnownKeys(const std::vector<octomap::OcTreeKey> &keys,
+                          const FadingOcTree &tree,
+                          std::vector<octomap::OcTreeKey> *known) {
+    known->clear();
+    if (tree.getRoot() == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < keys.size(); i++) {
+        if (tree.search(keys[i]) != NULL) {  // Small tree: most searches stop near the root
+            known->push_back(keys[i]);
         }
     }
 }
 
-void OctoClass::InflateObstacles(const double &thickness) {
-    // set all pixels in a sphere around the origin
-    std::vector<Eigen::Vector3d> sphere;
-    static Eigen::Vector3d xyz;
-    const int max_xyz = static_cast<int>(ceil(thickness/resolution_));
-    const float max_dist = thickness*thickness;
-    static float d_origin;
-    for (int x = -max_xyz; x <= max_xyz; x++) {
-        for (int y = -max_xyz; y <= max_xyz; y++) {
-            for (int z = -max_xyz; z <= max_xyz; z++) {
-                xyz << x*resolution_, y*resolution_, z*resolution_;
+bool OctoClass::DynamicOccupied(const FadingOcTree &tree,
+                                const octomap::OcTreeKey &key,
+                                const unsigned &depth) const {
+    if (tree.getRoot() == NULL) {
+        return false;
+    }
+    const FadingNode *node = tree.search(key, depth);
+    return (node != NULL) && tree.IsNodeOccupied(node);
+}
 
-                d_origin = xyz.dot(xyz);  // distance from origin squared
-                if (d_origin <= max_dist) {
-                    sphere.push_back(xyz);
-                }
-            }
-        }
+void OctoClass::BulkUpdate(const std::vector<octomap::OcTreeKey> &occupied,
+                           const std::vector<octomap::OcTreeKey> &free,
+                           const bool &prune,
+                           FadingOcTree *tree) {
+    bulk_updater_.Clear();
+    bulk_updater_.AddHits(occupied);
+    bulk_updater_.AddMisses(free);
+    bulk_updater_.Apply(tree, prune);
+}
+
+void OctoClass::UpdateScanParams() {
+    std::shared_ptr<ScanParams> params(new ScanParams(resolution_));
+    params->tree_depth = tree_depth_;
+    params->resolution = resolution_;
+    params->max_range = max_range_;
+    params->min_range = min_range_;
+    params->map_3d = map_3d_;
+    params->inflation_shell_only = inflation_shell_only_;
+    params->raycast_pool = raycast_pool_;
+    params->sphere_keys = sphere_keys_;
+    for (int i = 0; i < 6; i++) {
+        params->sphere_shells[i] = sphere_shells_[i];
     }
+    params->sphere_max_offset = sphere_max_offset_;
+    params->sphere_radius = sphere_radius_;
+    scan_params_ = params;
+}
 
-    // create inflated tree
-    tree_inflated_.clear();
-    const int n_sphere_nodes = sphere.size();
-    static bool is_central_occ;
-    static octomap::point3d central_point, cur_point;
-    octomap::OcTreeNode *node, *node_inflated;
-    for (octomap::OcTree::leaf_iterator it = tree_.begin_leafs(),
-                                       end = tree_.end_leafs();
-                                       it != end; ++it) {
-        // check occupancy of the current point
-        central_point = it.getCoordinate();
-        node = tree_.search(central_point);
-        is_central_occ = tree_.isNodeOccupied(node);
-
-        // populate the inflated map accordingly
-        if (is_central_occ) {  // populate the inflated with a sphere around this node
-            for (int j = 0; j < n_sphere_nodes; j++) {
-                cur_point = central_point + octomap::point3d(sphere[j][0], sphere[j][1], sphere[j][2]);
-                tree_inflated_.updateNode(cur_point, true);
-            }
-        } else {  // set as free if not uccupied already
-            node_inflated = tree_inflated_.search(central_point);
-            if (node_inflated == NULL) {
-                tree_inflated_.updateNode(central_point, false);
-            } else if (!tree_inflated_.isNodeOccupied(node_inflated)) {
-                tree_inflated_.updateNode(central_point, false);
-            }
-        }
+void OctoClass::FadeMemory() {
+    // Each node knows when it stops being remembered, so only subtrees
+    // holding expired nodes are visited
+    const size_t n_deleted = dynamic_tree_.DeleteExpired() + dynamic_inflated_.DeleteExpired();
+    if (n_deleted > 0) {
+        this->MarkFullChange();
+        ROS_DEBUG("Fading memory: deleted %zu expired nodes", n_deleted);
     }
 }
 
+void OctoClass::TakeChangedKeys(std::vector<octomap::OcTreeKey> *keys,
+                                bool *full_change) {
+    keys->clear();
+    keys->swap(changed_keys_);
+    *full_change = full_change_;
+    full_change_ = false;
+}
+
+void OctoClass::MarkChanged(const std::vector<octomap::OcTreeKey> &keys) {
+    // Nobody took the keys for a while: a full check is cheaper than the list
+    const size_t kMaxChangedKeys = 1 << 20;
+    if (full_change_) {
+        return;
+    } else if (changed_keys_.size() + keys.size() > kMaxChangedKeys) {
+        this->MarkFullChange();
+        return;
+    }
+    changed_keys_.insert(changed_keys_.end(), keys.begin(), keys.end());
+}
+
+void OctoClass::MarkFullChange() {
+    full_change_ = true;
+    changed_keys_.clear();
+}
+
 void OctoClass::FindCollidingNodesTree(const pcl::PointCloud< pcl::PointXYZ > &point_cloud,
                                        std::vector<octomap::point3d> *colliding_nodes) {
-    static octomap::point3d query, node_center;
-    static octomap::OcTreeNode* node;
-    static octomap::OcTreeKey key;
-    octomap::KeySet endpoints;
-
+    octomap::point3d query, node_center;
+    const MergedNode* node;
+    octomap::OcTreeKey key;
     const int cloudsize = point_cloud.size();
+    FlatKeySet endpoints(cloudsize);
 
     for (int j = 0; j < cloudsize; j++) {
         query = octomap::point3d(point_cloud.points[j].x,
                                  point_cloud.points[j].y,
                                  point_cloud.points[j].z);
         key = tree_.coordToKey(query);
-        std::pair<octomap::KeySet::iterator, bool> ret = endpoints.insert(key);
-
         // check if current node has not been evaluated yet
-        if (ret.second) {  // insertion took place => new node being evaluated
-            node = tree_.search(query);
-            if (node == NULL) {
-                continue;
-            } else if (tree_.isNodeOccupied(node)) {
+        if (endpoints.Insert(key)) {  // insertion took place => new node being evaluated
+            node = tree_.Search(query, kSlimLayer);
+            if (((node != NULL) && tree_.IsNodeOccupied(node, kSlimLayer)) ||
+                this->DynamicOccupied(dynamic_tree_, key)) {
                 node_center = tree_.keyToCoord(key);
                 colliding_nodes->push_back(node_center);
             }
@@ -577,59 +1069,66 @@ void OctoClass::FindCollidingNodesTree(const pcl::PointCloud< pcl::PointXYZ > &p
 
 void OctoClass::FindCollidingNodesInflated(const pcl::PointCloud< pcl::PointXYZ > &point_cloud,
                                            std::vector<octomap::point3d> *colliding_nodes) {
-    static octomap::point3d query, node_center;
-    static octomap::OcTreeNode* node;
-    static octomap::OcTreeKey key;
-    octomap::KeySet endpoints;
-
+    octomap::point3d query, node_center;
+    octomap::OcTreeKey key;
     const int cloudsize = point_cloud.size();
+    FlatKeySet endpoints(cloudsize);
 
     for (int j = 0; j < cloudsize; j++) {
         query = octomap::point3d(point_cloud.points[j].x,
                                  point_cloud.points[j].y,
                                  point_cloud.points[j].z);
-        key = tree_inflated_.coordToKey(query);
-        std::pair<octomap::KeySet::iterator, bool> ret = endpoints.insert(key);
-
+        key = tree_.coordToKey(query);
         // check if current node has not been evaluated yet
-        if (ret.second) {  // insertion took place => new node being evaluated
-            node = tree_inflated_.search(query);
-            if (node == NULL) {
-                continue;
-            } else if (tree_inflated_.isNodeOccupied(node)) {
-                node_center = tree_inflated_.keyToCoord(key);
+        if (endpoints.Insert(key)) {  // insertion took place => new node being evaluated
+            if ((this->InflatedState(key) == OccupancyCache::kOccupied) ||
+                this->DynamicOccupied(dynamic_inflated_, key)) {
+                node_center = tree_.keyToCoord(key);
                 colliding_nodes->push_back(node_center);
             }
         }
     }
 }
 
+void OctoClass::CollidingKeys(const std::vector<octomap::OcTreeKey> &keys,
+                              std::vector<octomap::OcTreeKey> *colliding) const {
+    for (size_t i = 0; i < keys.size(); i++) {
+        if ((this->InflatedState(keys[i]) == OccupancyCache::kOccupied) ||
+            this->DynamicOccupied(dynamic_inflated_, keys[i])) {
+            colliding->push_back(keys[i]);
+        }
+    }
+}
+
 // adapted from https:// ithub.com/OctoMap/octomap_mapping
 void OctoClass::TreeVisMarkers(visualization_msgs::MarkerArray* obstacles,
-                               visualization_msgs::MarkerArray* free) {
+                               visualization_msgs::MarkerArray* free) const {
     // Markers: each marker array stores a set of nodes with similar size
     obstacles->markers.resize(tree_depth_+1);
     free->markers.resize(tree_depth_+1);
     const ros::Time rostime = ros::Time::now();
 
-    // set tree min and max
-    static double min_x, min_y, min_z, max_x, max_y, max_z;
+    // set tree min and max (const overloads: the non-const ones write a cache)
+    double min_x, min_y, min_z, max_x, max_y, max_z;
     tree_.getMetricMin(min_x, min_y, min_z);
     tree_.getMetricMax(max_x, max_y, max_z);
     const double colorFactor = 1.0;   // define the gradient of colors
 
     // publish all leafs from the tree
-    static geometry_msgs::Point point_center;
-    for (octomap::OcTree::leaf_iterator it = tree_.begin_leafs(),
-                                       end = tree_.end_leafs();
-                                       it != end; ++it) {
+    geometry_msgs::Point point_center;
+    for (MergedOcTree::leaf_iterator it = tree_.begin_leafs(),
+                                     end = tree_.end_leafs();
+                                     it != end; ++it) {
+        if (!it->IsKnown(kSlimLayer)) {
+            continue;
+        }
         // set depth in the tree
         const unsigned idx = it.getDepth();
         point_center.x = it.getX();
         point_center.y = it.getY();
         point_center.z = it.getZ();
         const double h = (1.0 - std::min(std::max((point_center.z-min_z)/ (max_z - min_z), 0.0), 1.0))*colorFactor;
-        if (tree_.isNodeOccupied(*it)) {
+        if (tree_.IsNodeOccupied(&(*it), kSlimLayer)) {
             // Add point and set color based on height
             obstacles->markers[idx].points.push_back(point_center);
             obstacles->markers[idx].colors.push_back(HeightMapColor(h, 1.0));
@@ -639,6 +1138,22 @@ void OctoClass::TreeVisMarkers(visualization_msgs::MarkerArray* obstacles,
         }
     }
 
+    // Dynamic obstacles are drawn in red
+    std_msgs::ColorRGBA dynamic_color;
+    dynamic_color.r = 1.0;
+    dynamic_color.a = 1.0;
+    for (FadingOcTree::leaf_iterator it = dynamic_tree_.begin_leafs(),
+                                     end = dynamic_tree_.end_leafs();
+                                     it != end; ++it) {
+        if (dynamic_tree_.IsNodeOccupied(&(*it))) {
+            point_center.x = it.getX();
+            point_center.y = it.getY();
+            point_center.z = it.getZ();
+            obstacles->markers[it.getDepth()].points.push_back(point_center);
+            obstacles->markers[it.getDepth()].colors.push_back(dynamic_color);
+        }
+    }
+
     // set marker properties
     for (unsigned i= 0; i < obstacles->markers.size(); ++i) {
         const double size = tree_.getNodeSize(i);
@@ -674,30 +1189,33 @@ void OctoClass::TreeVisMarkers(visualization_msgs::MarkerArray* obstacles,
 
 // adapted from https:// ithub.com/OctoMap/octomap_mapping
 void OctoClass::InflatedVisMarkers(visualization_msgs::MarkerArray* obstacles,
-                                   visualization_msgs::MarkerArray* free) {  // publish occupied nodes
+                                   visualization_msgs::MarkerArray* free) const {  // publish occupied nodes
     // Markers: each marker array stores a set of nodes with similar size
     obstacles->markers.resize(tree_depth_+1);
     free->markers.resize(tree_depth_+1);
     const ros::Time rostime = ros::Time::now();
 
-    // set tree_inflated_ min and max
-    static double min_x, min_y, min_z, max_x, max_y, max_z;
-    tree_inflated_.getMetricMin(min_x, min_y, min_z);
-    tree_inflated_.getMetricMax(max_x, max_y, max_z);
+    // set inflated tree min and max (const overloads: the non-const ones write a cache)
+    double min_x, min_y, min_z, max_x, max_y, max_z;
+    tree_.getMetricMin(min_x, min_y, min_z);
+    tree_.getMetricMax(max_x, max_y, max_z);
     const double colorFactor = 1.0;   // define the gradient of colors
 
-    // publish all leafs from the tree_inflated_
-    static geometry_msgs::Point point_center;
-    for (octomap::OcTree::leaf_iterator it = tree_inflated_.begin_leafs(),
-                                       end = tree_inflated_.end_leafs();
-                                       it != end; ++it) {
-        // set depth in the tree_inflated_
+    // publish all leafs from the inflated tree
+    geometry_msgs::Point point_center;
+    for (MergedOcTree::leaf_iterator it = tree_.begin_leafs(),
+                                     end = tree_.end_leafs();
+                                     it != end; ++it) {
+        if (!it->IsKnown(kInflatedLayer)) {
+            continue;
+        }
+        // set depth in the inflated tree
         const unsigned idx = it.getDepth();
         point_center.x = it.getX();
         point_center.y = it.getY();
         point_center.z = it.getZ();
         const double h = (1.0 - std::min(std::max((point_center.z-min_z)/ (max_z - min_z), 0.0), 1.0))*colorFactor;
-        if (tree_inflated_.isNodeOccupied(*it)) {
+        if (tree_.IsNodeOccupied(&(*it), kInflatedLayer)) {
             // Add point and set color based on height
             obstacles->markers[idx].points.push_back(point_center);
             obstacles->markers[idx].colors.push_back(HeightMapColor(h, 1.0));
@@ -707,9 +1225,25 @@ void OctoClass::InflatedVisMarkers(visualization_msgs::MarkerArray* obstacles,
         }
     }
 
+    // Dynamic obstacles are drawn in red
+    std_msgs::ColorRGBA dynamic_color;
+    dynamic_color.r = 1.0;
+    dynamic_color.a = 1.0;
+    for (FadingOcTree::leaf_iterator it = dynamic_inflated_.begin_leafs(),
+                                     end = dynamic_inflated_.end_leafs();
+                                     it != end; ++it) {
+        if (dynamic_inflated_.IsNodeOccupied(&(*it))) {
+            point_center.x = it.getX();
+            point_center.y = it.getY();
+            point_center.z = it.getZ();
+            obstacles->markers[it.getDepth()].points.push_back(point_center);
+            obstacles->markers[it.getDepth()].colors.push_back(dynamic_color);
+        }
+    }
+
     // set marker properties
     for (unsigned i= 0; i < obstacles->markers.size(); ++i) {
-        const double size = tree_inflated_.getNodeSize(i);
+        const double size = tree_.getNodeSize(i);
 
         obstacles->markers[i].header.frame_id = inertial_frame_id_;
         obstacles->markers[i].header.stamp = rostime;
@@ -745,12 +1279,15 @@ void OctoClass::InflatedVisMarkers(visualization_msgs::MarkerArray* obstacles,
 
 // Returns -1 if node is unknown, 0 if its free and 1 if its occupied
 int OctoClass::CheckOccupancy(const octomap::point3d &p) {
-    static octomap::OcTreeKey key;
-    key = tree_inflated_.coordToKey(p);
-    const octomap::OcTreeNode* n = tree_inflated_.search(key);
-    if (n == NULL) {
+    octomap::OcTreeKey key;
+    key = tree_.coordToKey(p);
+    if (this->DynamicOccupied(dynamic_inflated_, key)) {
+        return 1;
+    }
+    const OccupancyCache::State state = this->InflatedState(key);
+    if (state == OccupancyCache::kUnknown) {
         return -1;
-    } else if (tree_inflated_.isNodeOccupied(n)) {
+    } else if (state == OccupancyCache::kOccupied) {
         return 1;
     }
 
@@ -772,30 +1309,7 @@ int OctoClass::CheckOccupancy(const Eigen::Vector3d &p) {
 // returns 0 (only free nodes between points)
 int OctoClass::CheckOccupancy(const octomap::point3d &p1,
                               const octomap::point3d &p2) {
-    octomap::KeyRay ray;
-    tree_inflated_.computeRayKeys(p1, p2, ray);
-    int retVal = 0;
-    const octomap::OcTreeNode* n;
-    for (octomap::KeyRay::iterator it = ray.begin(); it != ray.end(); ++it) {
-        n = tree_inflated_.search(*it);
-        if (n == NULL) {
-            retVal = -1;
-        } else if (tree_inflated_.isNodeOccupied(n)) {
-            return 1;
-        }
-    }
-
-    // computeRayKeys does not compute the final point, so we check manually
-    static octomap::OcTreeKey key;
-    key = tree_inflated_.coordToKey(p2);
-    n = tree_inflated_.search(key);
-    if (n == NULL) {
-        retVal = -1;
-    } else if (tree_inflated_.isNodeOccupied(n)) {
-        return 1;
-    }
-
-    return retVal;
+    return this->TraverseSegment(p1, p2, false);
 }
 
 int OctoClass::CheckOccupancy(const Eigen::Vector3d &p1,
@@ -805,16 +1319,14 @@ int OctoClass::CheckOccupancy(const Eigen::Vector3d &p1,
 }
 
 bool OctoClass::CheckCollision(const octomap::point3d &p) {
-    static octomap::OcTreeKey key;
-    key = tree_inflated_.coordToKey(p);
-    const octomap::OcTreeNode* n = tree_inflated_.search(key);
-    if (n == NULL) {
-        return true;
-    } else if (tree_inflated_.isNodeOccupied(n)) {
+    octomap::OcTreeKey key;
+    key = tree_.coordToKey(p);
+    if (this->DynamicOccupied(dynamic_inflated_, key)) {
         return true;
     }
 
-    return false;
+    // Unknown nodes are treated as colliding
+    return this->InflatedState(key) != OccupancyCache::kFree;
 }
 
 bool OctoClass::CheckCollision(const Eigen::Vector3d &p) {
@@ -823,29 +1335,136 @@ bool OctoClass::CheckCollision(const Eigen::Vector3d &p) {
 
 bool OctoClass::CheckCollision(const octomap::point3d &p1,
                                const octomap::point3d &p2) {
-    octomap::KeyRay ray;
-    tree_inflated_.computeRayKeys(p1, p2, ray);
-    const octomap::OcTreeNode* n;
-    for (octomap::KeyRay::iterator it = ray.begin(); it != ray.end(); ++it) {
-        n = tree_inflated_.search(*it);
-        if (n == NULL) {
-            return true;
-        } else if (tree_inflated_.isNodeOccupied(n)) {
-            return true;
+    // Unknown nodes are treated as colliding
+    return this->TraverseSegment(p1, p2, true) != 0;
+}
+
+int OctoClass::TraverseSegment(const octomap::point3d &p1,
+                               const octomap::point3d &p2,
+                               const bool &stop_at_unknown) const {
+    octomap::OcTreeKey key, end_key;
+    if (!tree_.coordToKeyChecked(p1, key) || !tree_.coordToKeyChecked(p2, end_key)) {
+        return -1;  // Outside the map
+    }
+
+    // Segment in key units: node k spans [k, k + 1) in each direction
+    const double factor = 1.0/resolution_;
+    const double offset = 1 << (tree_depth_ - 1);
+    Eigen::Vector3d u1, du;
+    for (int i = 0; i < 3; i++) {
+        u1[i] = p1(i)*factor + offset;
+        du[i] = p2(i)*factor + offset - u1[i];
+    }
+
+    int result = 0;
+    double t_entry = 0.0;
+    int size = 1;
+    while (true) {
+        unsigned depth;
+        const int state = this->SegmentNodeState(key, &depth);
+        if (state == 1) {
+            return 1;
+        }
+        if (state == -1) {
+            result = -1;
+            if (stop_at_unknown) {
+                return result;
+            }
+        }
+        if (key == end_key) {
+            return result;
         }
+
+        // Step to the node after the face where the segment leaves this one
+        size = 1 << (tree_depth_ - depth);
+        double t_exit = std::numeric_limits<double>::infinity();
+        int axis = -1;
+        for (int i = 0; i < 3; i++) {
+            if (du[i] == 0.0) {
+                continue;
+            }
+            const int first = key[i] & ~(size - 1);
+            const double t = (((du[i] > 0.0) ? first + size : first) - u1[i])/du[i];
+            if (t < t_exit) {
+                t_exit = t;
+                axis = i;
+            }
+        }
+
+        // Segment ends inside this node, the walk stopped making progress or the
+        // next node is outside the map (rounding): the end node is still checked
+        const int first = (axis < 0) ? 0 : key[axis] & ~(size - 1);
+        const int next = (axis < 0) ? -1 : ((du[axis] > 0.0) ? first + size : first - 1);
+        if ((t_exit > 1.0) || (t_exit < t_entry) || (next < 0) || (next > 0xFFFF)) {
+            break;
+        }
+        for (int i = 0; i < 3; i++) {
+            if (i == axis) {
+                key[i] = next;
+            } else {
+                const double k = std::floor(u1[i] + t_exit*du[i]);
+                key[i] = static_cast<uint16_t>(std::min(std::max(k, 0.0), 65535.0));
+            }
+        }
+        t_entry = t_exit;
     }
 
-    // computeRayKeys does not compute the final point, so we check manually
-    static octomap::OcTreeKey key;
-    key = tree_inflated_.coordToKey(p2);
-    n = tree_inflated_.search(key);
-    if (n == NULL) {
-        return true;
-    } else if (tree_inflated_.isNodeOccupied(n)) {
-        return true;
+    bool end_checked = true;
+    for (int i = 0; i < 3; i++) {
+        end_checked &= ((key[i] ^ end_key[i]) & ~(size - 1)) == 0;
+    }
+    if (end_checked) {
+        return result;
     }
+    unsigned depth;
+    const int state = this->SegmentNodeState(end_key, &depth);
+    return (state != 0) ? state : result;
+}
 
-    return false;
+int OctoClass::SegmentNodeState(const octomap::OcTreeKey &key,
+                                unsigned *depth) const {
+    // Smallest node containing key in either layer: the state is the same
+    // everywhere inside it. The cache only knows single nodes
+    OccupancyCache::State state;
+    *depth = tree_depth_;
+    if (!collision_cache_.Get(key, &state)) {
+        const MergedNode *node = LeafAt(tree_, key, depth);
+        if ((node == NULL) || !node->IsKnown(kInflatedLayer)) {
+            state = OccupancyCache::kUnknown;
+        } else {
+            state = tree_.IsNodeOccupied(node, kInflatedLayer) ? OccupancyCache::kOccupied : OccupancyCache::kFree;
+        }
+    }
+    unsigned dynamic_depth;
+    const FadingNode *dynamic_node = LeafAt(dynamic_inflated_, key, &dynamic_depth);
+    *depth = std::max(*depth, dynamic_depth);
+    if ((state == OccupancyCache::kOccupied) ||
+        ((dynamic_node != NULL) && dynamic_inflated_.IsNodeOccupied(dynamic_node))) {
+        return 1;
+    }
+    return (state == OccupancyCache::kUnknown) ? -1 : 0;
+}
+
+template <typename TREE>
+const typename TREE::NodeType* OctoClass::LeafAt(const TREE &tree,
+                                                 const octomap::OcTreeKey &key,
+                                                 unsigned *depth) const {
+    const typename TREE::NodeType *node = tree.getRoot();
+    *depth = 0;
+    if (node == NULL) {
+        return NULL;
+    }
+    while (tree.nodeHasChildren(node)) {
+        const unsigned bit = tree_depth_ - 1 - *depth;
+        const unsigned child = ((key[0] >> bit) & 1) | (((key[1] >> bit) & 1) << 1) |
+                               (((key[2] >> bit) & 1) << 2);
+        (*depth)++;
+        if (!tree.nodeChildExists(node, child)) {
+            return NULL;
+        }
+        node = tree.getNodeChild(node, child);
+    }
+    return node;
 }
 
 bool OctoClass::CheckCollision(const Eigen::Vector3d &p1,
@@ -859,76 +1478,56 @@ bool OctoClass::CheckCollision(const Eigen::Vector3d &p1,
 void OctoClass::BBXFreeVolume(const Eigen::Vector3d &box_min,
                               const Eigen::Vector3d &box_max,
                               double *volume) {
-    // Initialize vector with zeros
-    std::vector<uint> n_nodes_per_depth(tree_depth_ + 1);
-    for (uint i = 0; i < n_nodes_per_depth.size(); i++) {
-        n_nodes_per_depth[i] = 0;
-    }
-
-    // Count number of nodes per depth in the tree
-    octomap::OcTree::leaf_bbx_iterator it;
-    uint depth;
-    const octomap::OcTreeNode* n;
-    for (it = tree_inflated_.begin_leafs_bbx(octomap::point3d(box_min[0], box_min[1], box_min[2]),
-                                             octomap::point3d(box_max[0], box_max[1], box_max[2]));
-                                             it != tree_inflated_.end_leafs_bbx(); ++it) {
-        n = tree_inflated_.search(it.getKey());
-        if (n == NULL) {
-            continue;
-        }
-
-        // Count free nodes per depth
-        if (!tree_inflated_.isNodeOccupied(n)) {
-            depth = it.getDepth();
-            n_nodes_per_depth[depth] = n_nodes_per_depth[depth] + 1;
-        }
-    }
-
-    // Calculate final volume
-    *volume = 0;
-    for (uint i = 0; i < n_nodes_per_depth.size(); i++) {
-        // ROS_INFO("Nodes in depth %d: %d", int(i), int(n_nodes_per_depth[i]));
-        *volume = *volume + static_cast<double>(n_nodes_per_depth[i]) * depth_volumes_[i];
-    }
-    // ROS_INFO("Volume calculated: %f", volume);
+    double occupied;
+    this->BBXVolumes(box_min, box_max, volume, &occupied);
 }
 
 // Calculate the volume of obstacles in the bounding box
 void OctoClass::BBXOccVolume(const Eigen::Vector3d &box_min,
                              const Eigen::Vector3d &box_max,
                              double *volume) {
-    // Initialize vector with zeros
-    std::vector<uint> n_nodes_per_depth(tree_depth_ + 1);
-    for (uint i = 0; i < n_nodes_per_depth.size(); i++) {
-        n_nodes_per_depth[i] = 0;
-    }
-
-    // Count number of nodes per depth in the bounding box
-    octomap::OcTree::leaf_bbx_iterator it;
-    uint depth;
-    const octomap::OcTreeNode* n;
-    for (it = tree_inflated_.begin_leafs_bbx(octomap::point3d(box_min[0], box_min[1], box_min[2]),
-                                           octomap::point3d(box_max[0], box_max[1], box_max[2]));
-                                           it != tree_inflated_.end_leafs_bbx(); ++it) {
-        n = tree_inflated_.search(it.getKey());
-        if (n == NULL) {
-            continue;
-        }
+    double free;
+    this->BBXVolumes(box_min, box_max, &free, volume);
+}
 
-        // Count free nodes per depth
-        if (tree_inflated_.isNodeOccupied(n)) {
-            depth = it.getDepth();
-            n_nodes_per_depth[depth] = n_nodes_per_depth[depth] + 1;
-        }
+void OctoClass::BBXVolumes(const Eigen::Vector3d &box_min,
+                           const Eigen::Vector3d &box_max,
+                           double *free,
+                           double *occupied) const {
+    *free = 0.0;
+    *occupied = 0.0;
+    octomap::OcTreeKey min_key, max_key;
+    if (!tree_.coordToKeyChecked(octomap::point3d(box_min[0], box_min[1], box_min[2]), min_key) ||
+        !tree_.coordToKeyChecked(octomap::point3d(box_max[0], box_max[1], box_max[2]), max_key)) {
+        return;
     }
 
-    // Calculate final volume
-    *volume = 0;
-    for (uint i = 0; i < n_nodes_per_depth.size(); i++) {
-        // ROS_INFO("Nodes in depth %d: %d", int(i), int(n_nodes_per_depth[i]));
-        *volume = *volume + static_cast<double>(n_nodes_per_depth[i]) * depth_volumes_[i];
+    // Persistent map from the aggregates in the tree
+    tree_.BoxVolumes(min_key, max_key, free, occupied);
+
+    // Nodes overlapping dynamic obstacles are not free, and are obstacles
+    // where the persistent map is not occupied already
+    const double node_volume = pow(resolution_, 3);
+    FadingOcTree::leaf_bbx_iterator it;
+    for (it = dynamic_inflated_.begin_leafs_bbx(min_key, max_key);
+         it != dynamic_inflated_.end_leafs_bbx(); ++it) {
+        if (!dynamic_inflated_.IsNodeOccupied(&(*it))) {
+            continue;
+        }
+        const int size = 1 << (tree_depth_ - it.getDepth());
+        octomap::OcTreeKey first, last;
+        double volume = node_volume;
+        for (int i = 0; i < 3; i++) {
+            const int node_first = it.getKey()[i] & ~(size - 1);
+            first[i] = std::max(node_first, static_cast<int>(min_key[i]));
+            last[i] = std::min(node_first + size - 1, static_cast<int>(max_key[i]));
+            volume *= last[i] - first[i] + 1;
+        }
+        double node_free, node_occupied;
+        tree_.BoxVolumes(first, last, &node_free, &node_occupied);
+        *free -= node_free;
+        *occupied += volume - node_occupied;
     }
-    // ROS_INFO("Volume calculated: %f", volume);
 }
 
 // Return all free nodes within a bounding box
@@ -936,24 +1535,25 @@ void OctoClass::BBXFreeNodes(const Eigen::Vector3d &box_min,
                              const Eigen::Vector3d &box_max,
                              std::vector<octomap::OcTreeKey> *node_keys,
                              std::vector<double> *node_sizes) {
-    octomap::OcTree::leaf_bbx_iterator it;
+    MergedOcTree::leaf_bbx_iterator it;
     // uint depth;
-    const octomap::OcTreeNode* n;
+    const MergedNode* n;
     // octomap::point3d nodeCenter;
     octomap::OcTreeKey key;
-    for (it = tree_inflated_.begin_leafs_bbx(octomap::point3d(box_min[0], box_min[1], box_min[2]),
+    for (it = tree_.begin_leafs_bbx(octomap::point3d(box_min[0], box_min[1], box_min[2]),
                                              octomap::point3d(box_max[0], box_max[1], box_max[2]));
-                                             it != tree_inflated_.end_leafs_bbx(); ++it) {
+                                             it != tree_.end_leafs_bbx(); ++it) {
         key = it.getKey();
-        n = tree_inflated_.search(key);
+        n = tree_.Search(key, kInflatedLayer);
         if (n == NULL) {
             continue;
         }
 
-        if (!tree_inflated_.isNodeOccupied(n)) {
+        if (!tree_.IsNodeOccupied(n, kInflatedLayer) &&
+            !this->DynamicOccupied(dynamic_inflated_, key, it.getDepth())) {
             // nodeCenter = tree.keyToCoord(key);
             node_keys->push_back(key);
-            node_sizes->push_back(tree_inflated_.getNodeSize(it.getDepth()));
+            node_sizes->push_back(tree_.getNodeSize(it.getDepth()));
         }
     }
 }
@@ -963,22 +1563,23 @@ void OctoClass::BBXFreeNodes(const Eigen::Vector3d &box_min,
                              const Eigen::Vector3d &box_max,
                              IndexedKeySet *indexed_node_keys,
                              std::vector<double> *node_sizes) {
-    octomap::OcTree::leaf_bbx_iterator it;
-    const octomap::OcTreeNode* n;
+    MergedOcTree::leaf_bbx_iterator it;
+    const MergedNode* n;
     octomap::OcTreeKey key;
     uint index = 0;
-    for (it = tree_inflated_.begin_leafs_bbx(octomap::point3d(box_min[0], box_min[1], box_min[2]),
+    for (it = tree_.begin_leafs_bbx(octomap::point3d(box_min[0], box_min[1], box_min[2]),
                                              octomap::point3d(box_max[0], box_max[1], box_max[2]));
-                                             it != tree_inflated_.end_leafs_bbx(); ++it) {
+                                             it != tree_.end_leafs_bbx(); ++it) {
         key = it.getKey();
-        n = tree_inflated_.search(key);
+        n = tree_.Search(key, kInflatedLayer);
         if (n == NULL) {
             continue;
         }
 
-        if (!tree_inflated_.isNodeOccupied(n)) {
+        if (!tree_.IsNodeOccupied(n, kInflatedLayer) &&
+            !this->DynamicOccupied(dynamic_inflated_, key, it.getDepth())) {
             indexed_node_keys->Insert(key, index);
-            node_sizes->push_back(tree_inflated_.getNodeSize(it.getDepth()));
+            node_sizes->push_back(tree_.getNodeSize(it.getDepth()));
             index++;
         }
     }
@@ -988,22 +1589,22 @@ void OctoClass::OccNodesWithinBox(const Eigen::Vector3d &box_min,
                                   const Eigen::Vector3d &box_max,
                                   std::vector<Eigen::Vector3d> *node_center,
                                   std::vector<double> *node_sizes) {
-    octomap::OcTree::leaf_bbx_iterator it;
-    const octomap::OcTreeNode* n;
+    MergedOcTree::leaf_bbx_iterator it;
+    const MergedNode* n;
     octomap::OcTreeKey key;
-    for (it = tree_inflated_.begin_leafs_bbx(octomap::point3d(box_min[0], box_min[1], box_min[2]),
+    for (it = tree_.begin_leafs_bbx(octomap::point3d(box_min[0], box_min[1], box_min[2]),
                                              octomap::point3d(box_max[0], box_max[1], box_max[2]));
-                                             it != tree_inflated_.end_leafs_bbx(); ++it) {
+                                             it != tree_.end_leafs_bbx(); ++it) {
         key = it.getKey();
-        n = tree_inflated_.search(key);
+        n = tree_.Search(key, kInflatedLayer);
         if (n == NULL) {
             continue;
         }
 
-        if (tree_inflated_.isNodeOccupied(n)) {
+        if (tree_.IsNodeOccupied(n, kInflatedLayer)) {
             octomap::point3d pos = it.getCoordinate();
             node_center->push_back(Eigen::Vector3d(pos.x(), pos.y(), pos.z()));
-            const double size = tree_inflated_.getNodeSize(it.getDepth());
+            const double size = tree_.getNodeSize(it.getDepth());
             node_sizes->push_back(size);
             if (size != resolution_) {
                 // I did not write code to take into account that nodes in an octomap
@@ -1015,6 +1616,43 @@ void OctoClass::OccNodesWithinBox(const Eigen::Vector3d &box_min,
             }
         }
     }
+
+    // Dynamic obstacles that are not already obstacles in the persistent tree
+    this->DynamicOccNodesWithinBox(box_min, box_max, node_center, node_sizes);
+}
+
+void OctoClass::DynamicOccNodesWithinBox(const Eigen::Vector3d &box_min,
+                                         const Eigen::Vector3d &box_max,
+                                         std::vector<Eigen::Vector3d> *node_center,
+                                         std::vector<double> *node_sizes) {
+    FadingOcTree::leaf_bbx_iterator dit;
+    const MergedNode* n;
+    for (dit = dynamic_inflated_.begin_leafs_bbx(octomap::point3d(box_min[0], box_min[1], box_min[2]),
+                                                 octomap::point3d(box_max[0], box_max[1], box_max[2]));
+                                                 dit != dynamic_inflated_.end_leafs_bbx(); ++dit) {
+        n = tree_.Search(dit.getKey(), kInflatedLayer);
+        if (dynamic_inflated_.IsNodeOccupied(&(*dit)) && ((n == NULL) || !tree_.IsNodeOccupied(n, kInflatedLayer))) {
+            octomap::point3d pos = dit.getCoordinate();
+            node_center->push_back(Eigen::Vector3d(pos.x(), pos.y(), pos.z()));
+            node_sizes->push_back(dynamic_inflated_.getNodeSize(dit.getDepth()));
+        }
+    }
+}
+
+bool OctoClass::DistanceToObstacle(const Eigen::Vector3d &point,
+                                   double *distance,
+                                   Eigen::Vector3d *node_center,
+                                   Eigen::Vector3d *gradient) const {
+    octomap::OcTreeKey key, nearest;
+    if (!esdf_.IsEnabled() || !tree_.coordToKeyChecked(point[0], point[1], point[2], key) ||
+        !esdf_.Distance(key, distance, &nearest)) {
+        return false;
+    }
+    const octomap::point3d pos = tree_.keyToCoord(nearest);
+    *node_center = Eigen::Vector3d(pos.x(), pos.y(), pos.z());
+    *distance = (*node_center - point).norm();  // Field stores the distance from the center of the key
+    esdf_.Gradient(key, gradient);
+    return true;
 }
 
 void OctoClass::OccNodesWithinRadius(const geometry_msgs::Point &center_pt,
@@ -1057,8 +1695,21 @@ bool OctoClass::NearestOccNodeWithinRadius(const geometry_msgs::Point &center_pt
     *distance = std::numeric_limits<double>::infinity();
     *node_center = Eigen::Vector3d(0.0, 0.0, 0.0);
 
-    // get all occupied nodes within a box
-    this->OccNodesWithinBox(box_min, box_max, &candidates, &node_sizes);
+    // Persistent obstacles come from the distance field if it covers the
+    // radius: only the dynamic layer has to be scanned
+    octomap::OcTreeKey key;
+    if (esdf_.IsEnabled() && (radius <= esdf_.MaxDistance()) &&
+        tree_.coordToKeyChecked(center[0], center[1], center[2], key) && esdf_.Contains(key)) {
+        double field_distance;
+        Eigen::Vector3d field_center, gradient;
+        if (this->DistanceToObstacle(center, &field_distance, &field_center, &gradient)) {
+            candidates.push_back(field_center);
+        }
+        this->DynamicOccNodesWithinBox(box_min, box_max, &candidates, &node_sizes);
+    } else {
+        // get all occupied nodes within a box
+        this->OccNodesWithinBox(box_min, box_max, &candidates, &node_sizes);
+    }
 
     if (candidates.size() == 0) {
         return false;
@@ -1089,7 +1740,7 @@ void OctoClass::GetNodeNeighbors(const octomap::OcTreeKey &node_key,
     const Eigen::Vector3d Bounds = Eigen::Vector3d((node_size + resolution_)/2.0,
                                                    (node_size + resolution_)/2.0,
                                                    (node_size + resolution_)/2.0);
-    octomap::point3d node_pos = tree_inflated_.keyToCoord(node_key);
+    octomap::point3d node_pos = tree_.keyToCoord(node_key);
     Eigen::Vector3d pos = Eigen::Vector3d(node_pos.x(), node_pos.y(), node_pos.z());
 
     // Get free nodes within a bounding box
@@ -1111,18 +1762,18 @@ void OctoClass::GetNodeNeighbors(const octomap::OcTreeKey &node_key,
 
 // Returns size of node. Returns zero if node doesn't exist
 double OctoClass::GetNodeSize(const octomap::OcTreeKey &key) {
-    const octomap::OcTreeNode* n;
-    n = tree_inflated_.search(key);
+    const MergedNode* n;
+    n = tree_.Search(key, kInflatedLayer);
     if (n == NULL) {
         return 0.0;
     } else {
         const octomap::point3d bounds = octomap::point3d(resolution_/4.0,
                                                          resolution_/4.0,
                                                          resolution_/4.0);
-        const octomap::point3d pos = tree_inflated_.keyToCoord(key);
-        octomap::OcTree::leaf_bbx_iterator it;
-        it = tree_inflated_.begin_leafs_bbx(pos-bounds, pos+bounds);
-        return tree_inflated_.getNodeSize(it.getDepth());
+        const octomap::point3d pos = tree_.keyToCoord(key);
+        MergedOcTree::leaf_bbx_iterator it;
+        it = tree_.begin_leafs_bbx(pos-bounds, pos+bounds);
+        return tree_.getNodeSize(it.getDepth());
     }
 }
 
@@ -1137,7 +1788,7 @@ void OctoClass::PrintQueryInfo(octomap::point3d query,
 
 // extracted from https://github.com/OctoMap/octomap_mapping
 std_msgs::ColorRGBA OctoClass::HeightMapColor(const double &height,
-                                              const double &alpha) {
+                                              const double &alpha) const {
   std_msgs::ColorRGBA color;
   color.a = alpha;
   // blend over HSV-values (more colors)
@@ -13,16 +13,16 @@ void OctoClass::PathPruning(const std::vector<Eigen::Vector3d> &path,
                             const bool &free_space_only,
                             std::vector<Eigen::Vector3d> *compressed_path) {
     // the minimum number of points for final vector
-    static int min_points = 2;
+    int min_points = 2;
 
     // initialize compressed points as all samples
     *compressed_path = path;
     int compressed_points = path.size();
 
     // first delete colinear points
-    static double epsilon = 0.0001, dist;
-    static int delete_index;
-    static Eigen::Vector3d p1, p2, p;
+    double epsilon = 0.0001, dist;
+    int delete_index;
+    Eigen::Vector3d p1, p2, p;
     while (true) {
         delete_index = -1;
         for (int i = 1; i < compressed_points-1; i++) {
@@ -51,7 +51,7 @@ void OctoClass::PathPruning(const std::vector<Eigen::Vector3d> &path,
     }
 
     // Compress the remaining points
-    static double max_dist;
+    double max_dist;
     int col_check;
     while (compressed_points > min_points) {
         // first find the point that deviates the least in the whole set
@@ -170,8 +170,8 @@ bool OctoClass::OctoRRG(const Eigen::Vector3d &p0,
 
     // Run RRG until maximum allowed time
     Eigen::Vector3d sample, neighbor_pos;
-    static double cost;
-    static uint min_index, n_nodes, final_index = 0;
+    double cost;
+    uint min_index, n_nodes, final_index = 0;
     n_nodes = obj_rrg.rrgraph_.n_nodes_;
     bool connected_graph = false;  // Becomes true when a path has been found from p0 to pf
     while (((ros::Time::now() - t0).toSec() < max_time) && (n_nodes < max_nodes)) {
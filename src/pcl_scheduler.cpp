@@ -0,0 +1,167 @@
+/* Copyright (c) 2017, United States Government, as represented by the
+ * Administrator of the National Aeronautics and Space Administration.
+ *
+ * All rights reserved.
+ *
+ * The Astrobee platform is licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with the
+ * License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "mapper/pcl_scheduler.h"
+
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace mapper {
+
+bool SchedulingPolicyFromString(const std::string &name, SchedulingPolicy *policy) {
+    if (name == "round_robin") {
+        *policy = kScheduleRoundRobin;
+    } else if (name == "oldest_first") {
+        *policy = kScheduleOldestFirst;
+    } else if (name == "weighted") {
+        *policy = kScheduleWeighted;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+void PclScheduler::Initialize(const std::vector<sensorInput*> &inputs,
+                              const SchedulingPolicy &policy,
+                              const double &max_staleness) {
+    inputs_ = inputs;
+    policy_ = policy;
+    max_staleness_ = max_staleness;
+    staged_.assign(inputs.size(), stampedPcl());
+    has_staged_.assign(inputs.size(), false);
+    current_weight_.assign(inputs.size(), 0.0);
+    latency_.assign(inputs.size(), LatencyStats());
+    next_ = 0;
+    last_log_ = ros::Time::now();
+}
+
+bool PclScheduler::Next(stampedPcl *pcl, uint *input_index) {
+    const ros::Time now = ros::Time::now();
+    const uint n_inputs = inputs_.size();
+    for (uint i = 0; i < n_inputs; i++) {
+        this->Refill(i, now);
+    }
+
+    int best = -1;
+    if (policy_ == kScheduleRoundRobin) {
+        for (uint k = 0; k < n_inputs; k++) {
+            const uint i = (next_ + k) % n_inputs;
+            if (has_staged_[i]) {
+                best = i;
+                break;
+            }
+        }
+        if (best >= 0) {
+            next_ = (best + 1) % n_inputs;
+        }
+    } else if (policy_ == kScheduleOldestFirst) {
+        for (uint i = 0; i < n_inputs; i++) {
+            if (has_staged_[i] && ((best < 0) ||
+                (staged_[i].receive_time < staged_[best].receive_time))) {
+                best = i;
+            }
+        }
+    } else {
+        // Smooth weighted round-robin: every waiting sensor gains its priority,
+        // the winner pays back the total, so turns interleave by weight
+        double total_weight = 0.0;
+        for (uint i = 0; i < n_inputs; i++) {
+            if (!has_staged_[i]) {
+                continue;
+            }
+            current_weight_[i] += inputs_[i]->priority;
+            total_weight += inputs_[i]->priority;
+            if ((best < 0) || (current_weight_[i] > current_weight_[best])) {
+                best = i;
+            }
+        }
+        if (best >= 0) {
+            current_weight_[best] -= total_weight;
+        }
+    }
+
+    if (best < 0) {
+        return false;
+    }
+    *pcl = std::move(staged_[best]);
+    staged_[best] = stampedPcl();  // Release the message
+    has_staged_[best] = false;
+    *input_index = best;
+    return true;
+}
+
+void PclScheduler::Integrated(const uint &input_index, const stampedPcl &pcl) {
+    const double latency = (ros::Time::now() - pcl.receive_time).toSec();
+    LatencyStats &stats = latency_[input_index];
+    stats.count++;
+    stats.sum += latency;
+    if (latency > stats.max) {
+        stats.max = latency;
+    }
+    inputs_[input_index]->integrated++;
+}
+
+void PclScheduler::LogStats(const double &period) {
+    const ros::Time now = ros::Time::now();
+    if ((now - last_log_).toSec() < period) {
+        return;
+    }
+    last_log_ = now;
+
+    for (uint i = 0; i < inputs_.size(); i++) {
+        LatencyStats &stats = latency_[i];
+        const double mean = (stats.count > 0) ? stats.sum/stats.count : 0.0;
+        ROS_DEBUG("[mapper]: %s: %lu integrated, %lu dropped, %lu stale, latency mean %f max %f (s)",
+                  inputs_[i]->name.c_str(),
+                  static_cast<unsigned long>(inputs_[i]->integrated.load()),
+                  static_cast<unsigned long>(inputs_[i]->dropped.load()),
+                  static_cast<unsigned long>(inputs_[i]->stale.load()),
+                  mean, stats.max);
+        stats = LatencyStats();
+    }
+}
+
+void PclScheduler::Refill(const uint &i, const ros::Time &now) {
+    sensorInput &input = *inputs_[i];
+    if (has_staged_[i] && this->IsStale(staged_[i], now)) {
+        input.stale++;
+        staged_[i] = stampedPcl();
+        has_staged_[i] = false;
+    }
+
+    // Latest-only sensors replace their staged cloud by anything newer
+    stampedPcl pcl;
+    while ((!has_staged_[i] || input.latest_only) && input.queue.TryPop(&pcl)) {
+        if (this->IsStale(pcl, now)) {
+            input.stale++;
+            continue;
+        }
+        if (has_staged_[i]) {
+            input.dropped++;
+        }
+        staged_[i] = std::move(pcl);
+        has_staged_[i] = true;
+    }
+}
+
+bool PclScheduler::IsStale(const stampedPcl &pcl, const ros::Time &now) const {
+    return (max_staleness_ > 0.0) && ((now - pcl.receive_time).toSec() > max_staleness_);
+}
+
+}  // namespace mapper
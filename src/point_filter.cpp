@@ -0,0 +1,396 @@
+/* Copyright (c) 2017, United States Government, as represented by the
+ * Administrator of the National Aeronautics and Space Administration.
+ *
+ * All rights reserved.
+ *
+ * The Astrobee platform is licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with the
+ * License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "mapper/point_filter.h"
+
+#include <stdint.h>
+#include <cmath>
+#include <algorithm>
+#include <limits>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MAPPER_X86_SIMD
+#endif
+
+namespace point_filter {
+
+FilterParams::FilterParams(const Eigen::Affine3d &tf_sensor2world,
+                           const algebra_3d::FrustumPlanes *frustum,
+                           const bool &map_3d,
+                           const double &min_range,
+                           const double &resolution,
+                           const int &tree_depth) {
+    const Eigen::Matrix3f rot_f = tf_sensor2world.linear().cast<float>();
+    const Eigen::Vector3d t = tf_sensor2world.translation();
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            rot[3*i + j] = rot_f(i, j);
+        }
+        trans[i] = static_cast<float>(t[i]);
+        origin[i] = static_cast<float>(t[i]);
+    }
+    flatten_z = !map_3d;
+    if (flatten_z) {
+        origin[2] = 0.0;
+    }
+
+    use_frustum = (frustum != NULL);
+    if (use_frustum) {
+        const algebra_3d::Plane3d *frustum_planes[4] = {&frustum->left_plane_, &frustum->right_plane_,
+                                                        &frustum->up_plane_, &frustum->down_plane_};
+        for (int i = 0; i < 4; i++) {
+            const Eigen::Vector3d &n = frustum_planes[i]->normal_;
+            planes[i][0] = static_cast<float>(n[0]);
+            planes[i][1] = static_cast<float>(n[1]);
+            planes[i][2] = static_cast<float>(n[2]);
+            planes[i][3] = static_cast<float>(-n.dot(frustum_planes[i]->origin_));
+        }
+    }
+
+    min_range_sqr = static_cast<float>(min_range*min_range);
+    resolution_factor = 1.0/resolution;  // Same as in octomap
+    tree_max_val = 1 << (tree_depth - 1);
+}
+
+namespace {
+
+const int kBlockSize = 16;
+
+// Block of points in structure-of-arrays layout
+struct PointBlock {
+    alignas(64) float x[kBlockSize];
+    alignas(64) float y[kBlockSize];
+    alignas(64) float z[kBlockSize];
+};
+
+// Filters a block of points, writes the valid ones into keys/range_sqr and returns how many there were
+typedef size_t (*BlockFilter)(const PointBlock &block,
+                              const FilterParams &p,
+                              octomap::OcTreeKey *keys,
+                              float *range_sqr);
+
+// Write the points flagged in mask into the output, dropping keys outside the octomap
+inline size_t CompactBlock(uint32_t mask,
+                           const int *kx, const int *ky, const int *kz,
+                           const float *rsq,
+                           const int &tree_max_val,
+                           octomap::OcTreeKey *keys,
+                           float *range_sqr) {
+    const uint32_t n_keys = 2*tree_max_val;
+    size_t n = 0;
+    while (mask != 0) {
+        const int i = __builtin_ctz(mask);
+        mask &= mask - 1;
+        if ((static_cast<uint32_t>(kx[i]) >= n_keys) ||
+            (static_cast<uint32_t>(ky[i]) >= n_keys) ||
+            (static_cast<uint32_t>(kz[i]) >= n_keys)) {
+            continue;
+        }
+        keys[n] = octomap::OcTreeKey(kx[i], ky[i], kz[i]);
+        range_sqr[n] = rsq[i];
+        n++;
+    }
+    return n;
+}
+
+// Same as octomap's coordToKey, but returns -1 when out of the key range
+inline int CoordToKey(const float &coord, const FilterParams &p) {
+    const double k = std::floor(p.resolution_factor*static_cast<double>(coord));
+    if ((k < -p.tree_max_val) || (k >= p.tree_max_val)) {
+        return -1;
+    }
+    return static_cast<int>(k) + p.tree_max_val;
+}
+
+// Reference implementation: all SIMD versions follow the same operation order
+size_t FilterBlockScalar(const PointBlock &block,
+                         const FilterParams &p,
+                         octomap::OcTreeKey *keys,
+                         float *range_sqr) {
+    int kx[kBlockSize], ky[kBlockSize], kz[kBlockSize];
+    float rsq[kBlockSize];
+    uint32_t mask = 0;
+    for (int i = 0; i < kBlockSize; i++) {
+        const float x = block.x[i], y = block.y[i], z = block.z[i];
+        if (!std::isfinite(x) || !std::isfinite(y) || !std::isfinite(z)) {
+            continue;
+        }
+
+        // Transform into world frame
+        const float wx = p.rot[0]*x + p.rot[1]*y + p.rot[2]*z + p.trans[0];
+        const float wy = p.rot[3]*x + p.rot[4]*y + p.rot[5]*z + p.trans[1];
+        const float wz = p.flatten_z ? 0.0f : p.rot[6]*x + p.rot[7]*y + p.rot[8]*z + p.trans[2];
+
+        // Check frustum
+        bool in_frustum = true;
+        for (int j = 0; p.use_frustum && (j < 4); j++) {
+            if (p.planes[j][0]*wx + p.planes[j][1]*wy + p.planes[j][2]*wz + p.planes[j][3] < 0.0f) {
+                in_frustum = false;
+                break;
+            }
+        }
+        if (!in_frustum) {
+            continue;
+        }
+
+        // Check minimum range
+        const float dx = wx - p.origin[0], dy = wy - p.origin[1], dz = wz - p.origin[2];
+        rsq[i] = dx*dx + dy*dy + dz*dz;
+        if (rsq[i] < p.min_range_sqr) {
+            continue;
+        }
+
+        kx[i] = CoordToKey(wx, p);
+        ky[i] = CoordToKey(wy, p);
+        kz[i] = CoordToKey(wz, p);
+        mask |= (1u << i);
+    }
+    return CompactBlock(mask, kx, ky, kz, rsq, p.tree_max_val, keys, range_sqr);
+}
+
+#ifdef MAPPER_X86_SIMD
+
+// 8 points at a time (two passes per block)
+__attribute__((target("avx2")))
+size_t FilterBlockAVX2(const PointBlock &block,
+                       const FilterParams &p,
+                       octomap::OcTreeKey *keys,
+                       float *range_sqr) {
+    alignas(32) int kx[kBlockSize], ky[kBlockSize], kz[kBlockSize];
+    alignas(32) float rsq[kBlockSize];
+    uint32_t mask = 0;
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256d res_factor = _mm256_set1_pd(p.resolution_factor);
+    const __m128i max_val = _mm_set1_epi32(p.tree_max_val);
+    for (int base = 0; base < kBlockSize; base += 8) {
+        const __m256 x = _mm256_load_ps(block.x + base);
+        const __m256 y = _mm256_load_ps(block.y + base);
+        const __m256 z = _mm256_load_ps(block.z + base);
+
+        // v - v is zero unless v is NaN or inf
+        __m256 valid = _mm256_and_ps(_mm256_cmp_ps(_mm256_sub_ps(x, x), zero, _CMP_EQ_OQ),
+                                     _mm256_cmp_ps(_mm256_sub_ps(y, y), zero, _CMP_EQ_OQ));
+        valid = _mm256_and_ps(valid, _mm256_cmp_ps(_mm256_sub_ps(z, z), zero, _CMP_EQ_OQ));
+
+        // Transform into world frame
+        __m256 w[3];
+        for (int i = 0; i < 3; i++) {
+            w[i] = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(
+                       _mm256_mul_ps(_mm256_set1_ps(p.rot[3*i]), x),
+                       _mm256_mul_ps(_mm256_set1_ps(p.rot[3*i + 1]), y)),
+                       _mm256_mul_ps(_mm256_set1_ps(p.rot[3*i + 2]), z)),
+                       _mm256_set1_ps(p.trans[i]));
+        }
+        if (p.flatten_z) {
+            w[2] = zero;
+        }
+
+        // Check frustum
+        for (int j = 0; p.use_frustum && (j < 4); j++) {
+            const __m256 dist = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(
+                _mm256_mul_ps(_mm256_set1_ps(p.planes[j][0]), w[0]),
+                _mm256_mul_ps(_mm256_set1_ps(p.planes[j][1]), w[1])),
+                _mm256_mul_ps(_mm256_set1_ps(p.planes[j][2]), w[2])),
+                _mm256_set1_ps(p.planes[j][3]));
+            valid = _mm256_and_ps(valid, _mm256_cmp_ps(dist, zero, _CMP_GE_OQ));
+        }
+
+        // Check minimum range
+        const __m256 dx = _mm256_sub_ps(w[0], _mm256_set1_ps(p.origin[0]));
+        const __m256 dy = _mm256_sub_ps(w[1], _mm256_set1_ps(p.origin[1]));
+        const __m256 dz = _mm256_sub_ps(w[2], _mm256_set1_ps(p.origin[2]));
+        const __m256 r = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)),
+                                       _mm256_mul_ps(dz, dz));
+        valid = _mm256_and_ps(valid, _mm256_cmp_ps(r, _mm256_set1_ps(p.min_range_sqr), _CMP_GE_OQ));
+        _mm256_store_ps(rsq + base, r);
+        mask |= static_cast<uint32_t>(_mm256_movemask_ps(valid)) << base;
+
+        // Keys are computed in double precision, as octomap does
+        int *k[3] = {kx + base, ky + base, kz + base};
+        for (int i = 0; i < 3; i++) {
+            const __m256d lo = _mm256_floor_pd(_mm256_mul_pd(
+                _mm256_cvtps_pd(_mm256_castps256_ps128(w[i])), res_factor));
+            const __m256d hi = _mm256_floor_pd(_mm256_mul_pd(
+                _mm256_cvtps_pd(_mm256_extractf128_ps(w[i], 1)), res_factor));
+            _mm_store_si128(reinterpret_cast<__m128i*>(k[i]), _mm_add_epi32(_mm256_cvttpd_epi32(lo), max_val));
+            _mm_store_si128(reinterpret_cast<__m128i*>(k[i] + 4), _mm_add_epi32(_mm256_cvttpd_epi32(hi), max_val));
+        }
+    }
+    return CompactBlock(mask, kx, ky, kz, rsq, p.tree_max_val, keys, range_sqr);
+}
+
+// 16 points at a time (one pass per block)
+__attribute__((target("avx512f")))
+size_t FilterBlockAVX512(const PointBlock &block,
+                         const FilterParams &p,
+                         octomap::OcTreeKey *keys,
+                         float *range_sqr) {
+    alignas(64) int kx[kBlockSize], ky[kBlockSize], kz[kBlockSize];
+    alignas(64) float rsq[kBlockSize];
+    const __m512 zero = _mm512_setzero_ps();
+    const __m512 x = _mm512_load_ps(block.x);
+    const __m512 y = _mm512_load_ps(block.y);
+    const __m512 z = _mm512_load_ps(block.z);
+
+    // v - v is zero unless v is NaN or inf
+    __mmask16 valid = _mm512_cmp_ps_mask(_mm512_sub_ps(x, x), zero, _CMP_EQ_OQ) &
+                      _mm512_cmp_ps_mask(_mm512_sub_ps(y, y), zero, _CMP_EQ_OQ) &
+                      _mm512_cmp_ps_mask(_mm512_sub_ps(z, z), zero, _CMP_EQ_OQ);
+
+    // Transform into world frame
+    __m512 w[3];
+    for (int i = 0; i < 3; i++) {
+        w[i] = _mm512_add_ps(_mm512_add_ps(_mm512_add_ps(
+                   _mm512_mul_ps(_mm512_set1_ps(p.rot[3*i]), x),
+                   _mm512_mul_ps(_mm512_set1_ps(p.rot[3*i + 1]), y)),
+                   _mm512_mul_ps(_mm512_set1_ps(p.rot[3*i + 2]), z)),
+                   _mm512_set1_ps(p.trans[i]));
+    }
+    if (p.flatten_z) {
+        w[2] = zero;
+    }
+
+    // Check frustum
+    for (int j = 0; p.use_frustum && (j < 4); j++) {
+        const __m512 dist = _mm512_add_ps(_mm512_add_ps(_mm512_add_ps(
+            _mm512_mul_ps(_mm512_set1_ps(p.planes[j][0]), w[0]),
+            _mm512_mul_ps(_mm512_set1_ps(p.planes[j][1]), w[1])),
+            _mm512_mul_ps(_mm512_set1_ps(p.planes[j][2]), w[2])),
+            _mm512_set1_ps(p.planes[j][3]));
+        valid &= _mm512_cmp_ps_mask(dist, zero, _CMP_GE_OQ);
+    }
+
+    // Check minimum range
+    const __m512 dx = _mm512_sub_ps(w[0], _mm512_set1_ps(p.origin[0]));
+    const __m512 dy = _mm512_sub_ps(w[1], _mm512_set1_ps(p.origin[1]));
+    const __m512 dz = _mm512_sub_ps(w[2], _mm512_set1_ps(p.origin[2]));
+    const __m512 r = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(dx, dx), _mm512_mul_ps(dy, dy)),
+                                   _mm512_mul_ps(dz, dz));
+    valid &= _mm512_cmp_ps_mask(r, _mm512_set1_ps(p.min_range_sqr), _CMP_GE_OQ);
+    _mm512_store_ps(rsq, r);
+
+    // Keys are computed in double precision, as octomap does
+    const __m512d res_factor = _mm512_set1_pd(p.resolution_factor);
+    const __m256i max_val = _mm256_set1_epi32(p.tree_max_val);
+    int *k[3] = {kx, ky, kz};
+    for (int i = 0; i < 3; i++) {
+        const __m256 w_lo = _mm512_castps512_ps256(w[i]);
+        const __m256 w_hi = _mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(w[i]), 1));
+        const __m512d lo = _mm512_roundscale_pd(_mm512_mul_pd(_mm512_cvtps_pd(w_lo), res_factor),
+                                                _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+        const __m512d hi = _mm512_roundscale_pd(_mm512_mul_pd(_mm512_cvtps_pd(w_hi), res_factor),
+                                                _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+        _mm256_store_si256(reinterpret_cast<__m256i*>(k[i]), _mm256_add_epi32(_mm512_cvttpd_epi32(lo), max_val));
+        _mm256_store_si256(reinterpret_cast<__m256i*>(k[i] + 8), _mm256_add_epi32(_mm512_cvttpd_epi32(hi), max_val));
+    }
+    return CompactBlock(valid, kx, ky, kz, rsq, p.tree_max_val, keys, range_sqr);
+}
+
+#endif  // MAPPER_X86_SIMD
+
+// Block filters supported by the CPU, widest first
+std::vector<std::pair<std::string, BlockFilter> > SupportedBlockFilters() {
+    std::vector<std::pair<std::string, BlockFilter> > filters;
+#ifdef MAPPER_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        filters.push_back(std::make_pair(std::string("AVX-512"), &FilterBlockAVX512));
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        filters.push_back(std::make_pair(std::string("AVX2"), &FilterBlockAVX2));
+    }
+#endif
+    filters.push_back(std::make_pair(std::string("scalar"), &FilterBlockScalar));
+    return filters;
+}
+
+const std::vector<std::pair<std::string, BlockFilter> > block_filters = SupportedBlockFilters();
+
+void FilterPointsWith(const BlockFilter &block_filter,
+                      const cloud_view::XYZView &cloud,
+                      const FilterParams &params,
+                      FilteredPoints *out) {
+    // Output buffers only grow, so they are allocated once for the largest cloud
+    const size_t n_points = cloud.Size();
+    if (out->keys.size() < n_points + kBlockSize) {
+        out->keys.resize(n_points + kBlockSize);
+        out->range_sqr.resize(n_points + kBlockSize);
+    }
+
+    // Gather points row by row into blocks. The last block of each
+    // row is padded with NaNs, which are discarded by the filter
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    const uint32_t width = cloud.Width();
+    const uint32_t height = cloud.Height();
+    PointBlock block;
+    size_t n_out = 0;
+    for (uint32_t row = 0; row < height; row++) {
+        for (uint32_t col = 0; col < width; col += kBlockSize) {
+            const int n = std::min(static_cast<uint32_t>(kBlockSize), width - col);
+            for (int i = 0; i < n; i++) {
+                cloud.GetPoint(row, col + i, &block.x[i], &block.y[i], &block.z[i]);
+            }
+            for (int i = n; i < kBlockSize; i++) {
+                block.x[i] = nan;
+                block.y[i] = nan;
+                block.z[i] = nan;
+            }
+            n_out += block_filter(block, params, &out->keys[n_out], &out->range_sqr[n_out]);
+        }
+    }
+    out->size = n_out;
+}
+
+}  // namespace
+
+void FilterPoints(const cloud_view::XYZView &cloud,
+                  const FilterParams &params,
+                  FilteredPoints *out) {
+    FilterPointsWith(block_filters.front().second, cloud, params, out);
+}
+
+bool FilterPoints(const cloud_view::XYZView &cloud,
+                  const FilterParams &params,
+                  const std::string &instruction_set,
+                  FilteredPoints *out) {
+    for (size_t i = 0; i < block_filters.size(); i++) {
+        if (block_filters[i].first == instruction_set) {
+            FilterPointsWith(block_filters[i].second, cloud, params, out);
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* InstructionSet() {
+    return block_filters.front().first.c_str();
+}
+
+std::vector<std::string> SupportedInstructionSets() {
+    std::vector<std::string> names;
+    for (size_t i = 0; i < block_filters.size(); i++) {
+        names.push_back(block_filters[i].first);
+    }
+    return names;
+}
+
+}  // namespace point_filter
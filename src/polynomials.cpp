@@ -53,7 +53,7 @@ void Polynomial::PrintPolyCoeff() {
 // convolute with another polynomial
 void Polynomial::PolyConv(const Polynomial *poly2,
                           Polynomial *poly_out) {
-    static int m, n, n_coeff_out, j_min, j_max;
+    int m, n, n_coeff_out, j_min, j_max;
     m = order_ + 1;
     n = poly2->order_ + 1;
     n_coeff_out = m + n - 1;
@@ -70,8 +70,8 @@ void Polynomial::PolyConv(const Polynomial *poly2,
 // square a polynomial
 void Polynomial::PolySquare(Polynomial *poly_out) {
     if (order_ == 2) {  // closed form solution
-        static Eigen::VectorXd coeff_out(5);
-        static double a, b, c;
+        Eigen::VectorXd coeff_out(5);
+        double a, b, c;
         // Polynomial poly_copy = &this;
         // poly_copy = this;
         a = coeff_(0);
@@ -88,7 +88,7 @@ void Polynomial::PolySquare(Polynomial *poly_out) {
 
 // set the derivative of a polynomial
 void Polynomial::PolyDiff(Polynomial *poly_out) {
-    static int power;
+    int power;
     for (int i = 0; i < order_; i++) {
         power = order_ - i;
         poly_out->coeff_(i) = coeff_(i)*power;
@@ -98,8 +98,8 @@ void Polynomial::PolyDiff(Polynomial *poly_out) {
 // return polynomial value at given time
 void Polynomial::PolyAtTime(const double time,
                             double *result) const {
-    static int m, power;
-    static double t;
+    int m, power;
+    double t;
     m = order_ + 1;
     *result = 0.0;
 
@@ -148,14 +148,14 @@ std::vector<std::complex<double>> Polynomial::Roots2ndOrderPoly() {
 // algebraic solution from https://en.wikipedia.org/wiki/Casus_irreducibilis
 std::vector<std::complex<double>> Polynomial::Roots3rdOrderPoly() {
     // set the coefficients in friendly form
-    static double a, b, c, d;
+    double a, b, c, d;
     a = coeff_(0);
     b = coeff_(1);
     c = coeff_(2);
     d = coeff_(3);
 
     // set Cardano's coefficients
-    static double p, q;
+    double p, q;
     p = (3*a*c - b*b)/(3*a*a);
     q = (2*b*b*b - 9*a*b*c + 27*a*a*d)/(27*a*a*a);
 
@@ -166,7 +166,7 @@ std::vector<std::complex<double>> Polynomial::Roots3rdOrderPoly() {
     w.push_back(std::complex<double>(-0.5, -0.5*sqrt(3)));
 
     // implementation of the solution
-    static double delta, term, term1, term2;
+    double delta, term, term1, term2;
     std::vector<std::complex<double>> solution;
     delta = q*q/4.0 + p*p*p/27.0;
     term = b/(3.0*a);
@@ -101,7 +101,7 @@ void RRG::NodesWithinRadius(const double radius,
                             std::vector<Eigen::Vector3d> *nodes,
                             std::vector<double> *costs) {
     std::vector<Eigen::Vector3d> candidates;
-    static Eigen::Vector3d boxMin, boxMax;
+    Eigen::Vector3d boxMin, boxMax;
     boxMin << center[0]-radius,
               center[1]-radius,
               center[2]-radius;
@@ -129,9 +129,9 @@ void RRG::NodesWithinRadius(const double radius,
     std::vector<Eigen::Vector3d> node_pos;
     NodesWithinRadius(radius, center, &node_pos, costs);
 
-    static octomap::point3d query;
-    static octomap::OcTreeKey key;
-    static uint index;
+    octomap::point3d query;
+    octomap::OcTreeKey key;
+    uint index;
     for (uint i = 0; i < node_pos.size(); i++) {
         query = octomap::point3d(node_pos[i][0], node_pos[i][1], node_pos[i][2]);
         key = node_octree_.coordToKey(query);
@@ -143,8 +143,8 @@ void RRG::NodesWithinRadius(const double radius,
 void RRG::OctoNN(const Eigen::Vector3d &sample,
                  uint *nn_index,
                  double *nn_cost) {
-    static Eigen::Vector3d boxMin, boxMax;
-    static float step, radius;
+    Eigen::Vector3d boxMin, boxMax;
+    float step, radius;
     step = 1.5;
     std::vector<Eigen::Vector3d> candidates, radiusCandidates;
     do {
@@ -171,8 +171,8 @@ void RRG::OctoNN(const Eigen::Vector3d &sample,
 
     // Search for the nearest neighbor within candidates
     *nn_cost = std::numeric_limits<float>::infinity();
-    static double cur_dist;
-    static uint min_index;
+    double cur_dist;
+    uint min_index;
     min_index = 0;
     for (uint i = 0; i < radiusCandidates.size(); i++) {
         cur_dist = (radiusCandidates[i] - sample).norm();
@@ -183,8 +183,8 @@ void RRG::OctoNN(const Eigen::Vector3d &sample,
     }
 
     // Find the graph index of the nearest neighbor
-    static octomap::point3d query;
-    static octomap::OcTreeKey key;
+    octomap::point3d query;
+    octomap::OcTreeKey key;
     // static std::tr1::unordered_set<IndexedOcTreeKey, IndexedOcTreeKey::KeyHash>::const_iterator key2index;
     query = octomap::point3d(radiusCandidates[min_index][0],
                              radiusCandidates[min_index][1],
@@ -200,7 +200,7 @@ void RRG::Steer(const uint &node_index,
                 Eigen::Vector3d *sample,
                 double *cost) {
     // Change the values of sample and cost based on distance from nearest neighbor
-    static Eigen::Vector3d direction;
+    Eigen::Vector3d direction;
     if (*cost > steer_param_) {
         direction = *sample - rrgraph_.nodes_[node_index].pos_;
         *sample = rrgraph_.nodes_[node_index].pos_ + steer_param_*direction.normalized();
@@ -57,7 +57,7 @@ Eigen::Vector3d RRT::SampleNodeBox(const Eigen::Vector3d &center,
 void RRT::BruteNN(const Eigen::Vector3d &sample,
                   uint *NNindex,
                   double *NNcost) {
-    static double curDist;
+    double curDist;
     *NNcost = std::numeric_limits<float>::infinity();
     *NNindex = 0;
     for (uint i = 0; i < rrtree_.n_nodes_; i++) {
@@ -74,7 +74,7 @@ void RRT::Steer(const uint &node_index,
                 Eigen::Vector3d *sample,
                 double *cost) {
     // Change the values of sample and cost based on distance from nearest neighbor
-    static Eigen::Vector3d direction;
+    Eigen::Vector3d direction;
     if (*cost > steer_param_) {
         direction = *sample - rrtree_.tree_[node_index].pos_;
         *sample = rrtree_.tree_[node_index].pos_ + steer_param_*direction.normalized();
@@ -181,8 +181,8 @@ void OctoRRT::NodesWithinBox(const Eigen::Vector3d &box_min,
 void OctoRRT::OctoNN(const Eigen::Vector3d &sample,
                      uint *nn_index,
                      double *nn_cost) {
-    static Eigen::Vector3d box_min, box_max;
-    static float step, radius;
+    Eigen::Vector3d box_min, box_max;
+    float step, radius;
     step = 1.5;
     std::vector<Eigen::Vector3d> candidates, radius_candidates;
     do {
@@ -209,8 +209,8 @@ void OctoRRT::OctoNN(const Eigen::Vector3d &sample,
 
     // Search for the nearest neighbor within candidates
     *nn_cost = std::numeric_limits<float>::infinity();
-    static double cur_dist;
-    static uint min_index;
+    double cur_dist;
+    uint min_index;
     min_index = 0;
     for (uint i = 0; i < radius_candidates.size(); i++) {
         cur_dist = (radius_candidates[i] - sample).norm();
@@ -221,9 +221,9 @@ void OctoRRT::OctoNN(const Eigen::Vector3d &sample,
     }
 
     // Find the graph index of the nearest neighbor
-    static octomap::point3d query;
-    static octomap::OcTreeKey key;
-    static std::tr1::unordered_set<IndexedOcTreeKey, IndexedOcTreeKey::KeyHash>::const_iterator key2index;
+    octomap::point3d query;
+    octomap::OcTreeKey key;
+    std::tr1::unordered_set<IndexedOcTreeKey, IndexedOcTreeKey::KeyHash>::const_iterator key2index;
     query = octomap::point3d(radius_candidates[min_index][0],
                              radius_candidates[min_index][1],
                              radius_candidates[min_index][2]);
@@ -236,7 +236,7 @@ void OctoRRT::OctoNN(const Eigen::Vector3d &sample,
 void OctoRRT::SteerToRoot(Eigen::Vector3d *sample,
                           const double &steer_param) {
     // Change the values of sample and cost based on distance from nearest neighbor
-    static Eigen::Vector3d direction;
+    Eigen::Vector3d direction;
     direction = *sample - this->GetRootPos();
     const double directionNorm = direction.norm();
     if (directionNorm > steer_param) {
@@ -249,7 +249,7 @@ void OctoRRT::Steer(const uint &node_index,
                     Eigen::Vector3d *sample,
                     double *cost) {
     // Change the values of sample and cost based on distance from nearest neighbor
-    static Eigen::Vector3d direction;
+    Eigen::Vector3d direction;
     if (*cost > steer_param_) {
         direction = *sample - rrtree_.tree_[node_index].pos_;
         *sample = rrtree_.tree_[node_index].pos_ + steer_param_*direction.normalized();
@@ -26,7 +26,7 @@ namespace sampled_traj {
 
 SampledTrajectory3D::SampledTrajectory3D(const double &dt,
                                          const polynomials::Trajectory3D &poly_trajectories) {
-    static double t0, tf, delta_t;
+    double t0, tf, delta_t;
     t0 = poly_trajectories.t0_;
     tf = poly_trajectories.tf_;
     delta_t = tf - t0;
@@ -147,7 +147,7 @@ void SampledTrajectory3D::DeleteSample(const int &index) {
 
 void SampledTrajectory3D::CompressSamples() {
     // the minimum number of points for final vector
-    static int min_points = 2;
+    int min_points = 2;
 
     // initialize compressed points as all samples
     compressed_pos_.resize(n_points_);
@@ -158,9 +158,9 @@ void SampledTrajectory3D::CompressSamples() {
     n_compressed_points_ = n_points_;
 
     // first delete colinear points
-    static double epsilon = 0.0001, dist;
-    static int delete_index;
-    static Eigen::Vector3d p1, p2, p;
+    double epsilon = 0.0001, dist;
+    int delete_index;
+    Eigen::Vector3d p1, p2, p;
     // static algebra_3d::Line3d line;
     while (true) {
         int delete_index = -1;
@@ -256,7 +256,7 @@ void SampledTrajectory3D::Bresenham(const Eigen::Vector3d &p0,
                                     const Eigen::Vector3d &pf,
                                     std::vector<octomap::point3d> *points) {
     // Get initial and final pixel positions
-    static int x1, x2, y1, y2, z1, z2;
+    int x1, x2, y1, y2, z1, z2;
     x1 = round(p0[0]/resolution_);
     x2 = round(pf[0]/resolution_);
     y1 = round(p0[1]/resolution_);
@@ -265,7 +265,7 @@ void SampledTrajectory3D::Bresenham(const Eigen::Vector3d &p0,
     z2 = round(pf[2]/resolution_);
 
     // Get the output vector length
-    static int dx, dy, dz;
+    int dx, dy, dz;
     dx = x2 - x1;
     dy = y2 - y1;
     dz = z2 - z1;
@@ -274,7 +274,7 @@ void SampledTrajectory3D::Bresenham(const Eigen::Vector3d &p0,
     points->reserve(d);
 
     // Extra variables
-    static int ax, ay, az, sx, sy, sz, x, y, z, xd, yd, zd;
+    int ax, ay, az, sx, sy, sz, x, y, z, xd, yd, zd;
     ax = abs(dx)*2;
     ay = abs(dy)*2;
     az = abs(dz)*2;
@@ -388,7 +388,7 @@ void SampledTrajectory3D::Bresenham(const Eigen::Vector3d &p0,
 void SampledTrajectory3D::ThickBresenham(const Eigen::Vector3d &p0,
                                          const Eigen::Vector3d &pf) {
     // Get vector in the direction of the trajectory (if length is greater than 0)
-    static Eigen::Vector3d v1 = pf - p0;
+    Eigen::Vector3d v1 = pf - p0;
     if (v1.norm() > 0) {
         v1 = v1/v1.norm();
     } else {
@@ -399,10 +399,10 @@ void SampledTrajectory3D::ThickBresenham(const Eigen::Vector3d &p0,
     // Set all pixels in a sphere around the origin
     // The pixels are assigned as initialEdge, finalEdge or trajectory padding
     std::vector<octomap::point3d> padding, init_edge_padding, final_edge_padding;
-    static octomap::point3d xyz, v1_point3d;
+    octomap::point3d xyz, v1_point3d;
     const int max_xyz = static_cast<int>(round(thickness_/resolution_));
     const float max_dist = thickness_*thickness_;
-    static float d_origin, d_plane;
+    float d_origin, d_plane;
     v1_point3d = octomap::point3d(v1[0], v1[1], v1[2]);
     for (int x = -max_xyz; x <= max_xyz; x++) {
         for (int y = -max_xyz; y <= max_xyz; y++) {
@@ -434,7 +434,7 @@ void SampledTrajectory3D::ThickBresenham(const Eigen::Vector3d &p0,
     // Vector that is used to displace pixels based on origin at 0
     // to pixels in octree based origin (there is no pixel at the)
     // origin in octrees
-    static octomap::point3d ds;
+    octomap::point3d ds;
     ds = octomap::point3d(resolution_/2.0, resolution_/2.0, resolution_/2.0);
 
     // Add padding around thin_bresenham to get thick_bresenham
@@ -0,0 +1,249 @@
+/* Copyright (c) 2017, United States Government, as represented by the
+ * Administrator of the National Aeronautics and Space Administration.
+ *
+ * All rights reserved.
+ *
+ * The Astrobee platform is licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with the
+ * License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "mapper/scan_update.h"
+
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <vector>
+
+namespace octoclass {
+
+void ScanWorker::Compute(const std::shared_ptr<const ScanParams> &params,
+                         const cloud_view::XYZView &cloud_xyz,
+                         const Eigen::Affine3d &tf_sensor2world,
+                         const algebra_3d::FrustumPlanes *frustum,
+                         ScanUpdate *update) {
+    params_ = params.get();
+
+    // set sensor origin
+    Eigen::Vector3d v = tf_sensor2world.translation();
+    if (!params_->map_3d) {
+        v[2] = 0.0;
+    }
+    const octomap::point3d pcl_origin = octomap::point3d(v[0], v[1], v[2]);
+
+    // Transform points into world frame, filter them and discretize them into keys
+    const point_filter::FilterParams filter_params(tf_sensor2world, frustum, params_->map_3d,
+                                                   params_->min_range, params_->resolution,
+                                                   params_->tree_depth);
+    point_filter::FilterPoints(cloud_xyz, filter_params, &filtered_points_);
+
+    // Add non-repeated nodes to keysets (inflated and non-inflated)
+    endpoints_.Clear();
+    endpoints_inflated_.Clear();
+    full_stencil_endpoints_.Clear();
+    const float max_range_sqr = params_->max_range*params_->max_range;
+    for (size_t i = 0; i < filtered_points_.size; i++) {
+        const octomap::OcTreeKey &k = filtered_points_.keys[i];
+        if (endpoints_.Insert(k)) {  // insertion took place => k was not in set
+            // insert points in inflated octomap
+            if (filtered_points_.range_sqr[i] < max_range_sqr) {
+                InflateEndpoint(k, frustum);
+            }
+        }
+    }
+
+    // Calculate free nodes
+    ComputeUpdate(endpoints_inflated_, endpoints_, pcl_origin, params_->max_range,
+                  &occ_cells_in_range_, &free_cells_, &inflated_free_cells_);
+
+    update->params = params;
+    update->inflated_occupied.clear();
+    for (FlatKeySet::const_iterator it = endpoints_inflated_.begin(); it != endpoints_inflated_.end(); ++it) {
+        // Cameras only add nodes that are being added to the slim tree as well
+        if ((frustum == NULL) || free_cells_.Contains(*it) || endpoints_.Contains(*it)) {
+            update->inflated_occupied.push_back(*it);
+        }
+    }
+    update->occupied.clear();
+    for (FlatKeySet::const_iterator it = occ_cells_in_range_.begin(); it != occ_cells_in_range_.end(); ++it) {
+        const octomap::point3d& p = params_->key_tree.keyToCoord(*it);
+        if ((p - pcl_origin).norm() <= params_->max_range) {
+            update->occupied.push_back(*it);
+        }
+    }
+    update->free.assign(inflated_free_cells_.begin(), inflated_free_cells_.end());
+
+    params_ = NULL;
+}
+
+void ScanWorker::InflateEndpoint(const octomap::OcTreeKey &k,
+                                 const algebra_3d::FrustumPlanes *frustum) {
+    const int max_key = std::numeric_limits<octomap::key_type>::max();
+
+    // Check once whether the whole stencil fits within the key space
+    bool in_bounds = true;
+    for (int i = 0; i < 3; i++) {
+        if ((k[i] < params_->sphere_max_offset[i]) || (k[i] > max_key - params_->sphere_max_offset[i])) {
+            in_bounds = false;
+        }
+    }
+
+    // If the endpoint is deep enough inside the frustum, so is its whole stencil
+    const octomap::point3d central_point = params_->key_tree.keyToCoord(k);
+    const bool in_frustum = (frustum == NULL) ||
+        (frustum->DistanceToBoundary(Eigen::Vector3d(central_point.x(),
+                                                     central_point.y(),
+                                                     central_point.z())) >= params_->sphere_radius);
+
+    // Only insert the shell if a neighbour endpoint already inserted its whole stencil
+    const std::vector<Eigen::Vector3i> *stencil = &params_->sphere_keys;
+    if (params_->inflation_shell_only) {
+        for (int i = 0; i < 6; i++) {
+            const Eigen::Vector3i neighbor = Eigen::Vector3i(k[0], k[1], k[2]) - ScanParams::FaceDirection(i);
+            if ((neighbor.minCoeff() < 0) || (neighbor.maxCoeff() > max_key)) {
+                continue;
+            }
+            if (full_stencil_endpoints_.Contains(octomap::OcTreeKey(neighbor[0], neighbor[1], neighbor[2]))) {
+                stencil = &params_->sphere_shells[i];
+                break;
+            }
+        }
+    }
+
+    octomap::OcTreeKey key;
+    octomap::point3d cur_point;
+    for (uint j = 0; j < stencil->size(); j++) {
+        const Eigen::Vector3i &offset = (*stencil)[j];
+        if (in_bounds) {
+            key = octomap::OcTreeKey(k[0] + offset[0], k[1] + offset[1], k[2] + offset[2]);
+        } else {
+            const Eigen::Vector3i cur_key = Eigen::Vector3i(k[0], k[1], k[2]) + offset;
+            if ((cur_key.minCoeff() < 0) || (cur_key.maxCoeff() > max_key)) {
+                continue;
+            }
+            key = octomap::OcTreeKey(cur_key[0], cur_key[1], cur_key[2]);
+        }
+        if (!in_frustum) {
+            cur_point = central_point + octomap::point3d(offset[0]*params_->resolution,
+                                                         offset[1]*params_->resolution,
+                                                         offset[2]*params_->resolution);
+            if (!frustum->IsPointWithinFrustum(Eigen::Vector3d(cur_point.x(),
+                                                               cur_point.y(),
+                                                               cur_point.z()))) {
+                continue;
+            }
+        }
+        endpoints_inflated_.Insert(key);
+    }
+
+    // Neighbours of this endpoint can rely on its whole stencil being inserted
+    if (in_bounds && in_frustum) {
+        full_stencil_endpoints_.Insert(k);
+    }
+}
+
+void ScanWorker::ComputeUpdate(const FlatKeySet &occ_inflated,  // Inflated endpoints
+                               const FlatKeySet &occ_slim,      // Non-inflated endpoints
+                               const octomap::point3d& origin,
+                               const double &max_range,
+                               FlatKeySet *occ_slim_in_range,
+                               FlatKeySet *free_slim,
+                               FlatKeySet *free_inflated) {
+    occ_slim_in_range->Clear();
+    free_slim->Clear();
+    free_inflated->Clear();
+
+    // Endpoints are split in contiguous chunks (one per thread)
+    const std::vector<octomap::OcTreeKey> &endpoints = occ_slim.Keys();
+    const size_t n_endpoints = endpoints.size();
+
+    // Spawning threads is not worth it for small clouds
+    const size_t min_endpoints_per_thread = 256;
+    const size_t n_threads = std::max(static_cast<size_t>(1),
+        std::min(static_cast<size_t>(params_->raycast_pool->Size()), n_endpoints/min_endpoints_per_thread));
+    if (thread_keyrays_.size() < n_threads) {
+        thread_keyrays_.resize(n_threads);
+    }
+    if (n_threads == 1) {
+        ComputeUpdateChunk(endpoints, 0, n_endpoints, occ_inflated, origin, max_range,
+                           &thread_keyrays_[0], occ_slim_in_range, free_slim, free_inflated);
+        return;
+    }
+
+    // Each thread fills its own key sets, which are merged afterwards
+    if (thread_occ_.size() < n_threads) {
+        thread_occ_.resize(n_threads);
+        thread_free_.resize(n_threads);
+        thread_free_inflated_.resize(n_threads);
+    }
+    // Chunks are raycast by the pool shared with the other mapping workers
+    const size_t chunk_size = (n_endpoints + n_threads - 1)/n_threads;
+    params_->raycast_pool->Run(n_threads, [&](const size_t &i) {
+        const size_t first = std::min(i*chunk_size, n_endpoints);
+        const size_t last = std::min(first + chunk_size, n_endpoints);
+        thread_occ_[i].Clear();
+        thread_free_[i].Clear();
+        thread_free_inflated_[i].Clear();
+        this->ComputeUpdateChunk(endpoints, first, last, occ_inflated, origin, max_range,
+                                 &thread_keyrays_[i], &thread_occ_[i],
+                                 &thread_free_[i], &thread_free_inflated_[i]);
+    });
+    for (size_t i = 0; i < n_threads; i++) {
+        occ_slim_in_range->Insert(thread_occ_[i]);
+        free_slim->Insert(thread_free_[i]);
+        free_inflated->Insert(thread_free_inflated_[i]);
+    }
+}
+
+void ScanWorker::ComputeUpdateChunk(const std::vector<octomap::OcTreeKey> &endpoints,
+                                    const size_t &first,
+                                    const size_t &last,
+                                    const FlatKeySet &occ_inflated,
+                                    const octomap::point3d &origin,
+                                    const double &max_range,
+                                    octomap::KeyRay *keyray,
+                                    FlatKeySet *occ_slim_in_range,
+                                    FlatKeySet *free_slim,
+                                    FlatKeySet *free_inflated) const {
+    for (size_t i = first; i < last; i++) {
+        const octomap::point3d& p = params_->key_tree.keyToCoord(endpoints[i]);
+
+        // If in line of sight, add free cells
+        if ((max_range < 0.0) || ((p - origin).norm() <= max_range)) {  // is not max_range_ meas.
+            octomap::OcTreeKey key;
+            if (params_->key_tree.coordToKeyChecked(p, key)) {
+                occ_slim_in_range->Insert(key);
+            }
+
+            // Ray keys are already checked using coordToKeyChecked
+            params_->key_tree.computeRayKeys(origin, p, *keyray);
+        } else {  // user set a max_range_ and length is above
+            octomap::point3d direction = (p - origin).normalized();
+            octomap::point3d new_end = origin + direction * static_cast<float>(max_range);
+            params_->key_tree.computeRayKeys(origin, new_end, *keyray);
+        }
+
+        bool blocked = false;
+        for (octomap::KeyRay::iterator it = keyray->begin(); it != keyray->end(); ++it) {
+            free_slim->Insert(*it);
+            if (blocked) {
+                continue;
+            } else if (occ_inflated.Contains(*it)) {  // If occupied
+                blocked = true;
+            } else {   // If not occupied
+                free_inflated->Insert(*it);
+            }
+        }
+    }
+}
+
+}  // namespace octoclass
@@ -17,7 +17,10 @@
  */
 
 #include <mapper/mapper_class.h>
+#include <fstream>
 #include <limits>
+#include <memory>
+#include <sstream>
 #include <vector>
 #include <string>
 
@@ -48,10 +51,9 @@ bool MapperClass::UpdateMemoryTime(pensa_msgs::SetFloat::Request &req,
 bool MapperClass::MapInflation(pensa_msgs::SetFloat::Request &req,
                                pensa_msgs::SetFloat::Response &res) {
     mutexes_.octomap.lock();
-        globals_.octomap.SetMapInflation(req.data);
+        res.success = globals_.octomap.SetMapInflation(req.data);
     mutexes_.octomap.unlock();
 
-    res.success = true;
     return true;
 }
 
@@ -69,26 +71,75 @@ bool MapperClass::ResetMap(std_srvs::Trigger::Request &req,
 bool MapperClass::SaveMap(std_srvs::Trigger::Request &req,
                           std_srvs::Trigger::Response &res) {
     std::string filename1 = local_path_ + "/maps/octomap.ot";
-    std::string filename2 = local_path_ + "/maps/octomap_inflated.ot";
-    mutexes_.octomap.lock();
-        globals_.octomap.tree_.write(filename1);
-        globals_.octomap.tree_inflated_.write(filename2);
-    mutexes_.octomap.unlock();
+    // Serialize in memory (a fraction of the size of the tree), so that
+    // mapping does not wait for the disk
+    std::stringstream data;
+    mutexes_.octomap.lock_shared();
+        globals_.octomap.tree_.write(data);  // Slim and inflated maps
+    mutexes_.octomap.unlock_shared();
+    std::ofstream file(filename1.c_str(), std::ios_base::out | std::ios_base::binary);
+    if (!file.is_open() || !(file << data.rdbuf())) {
+        ROS_ERROR("Could not write map to:\n%s\n", filename1.c_str());
+        res.success = false;
+        res.message = "Could not write map to " + filename1;
+        return false;
+    }
 
-    ROS_INFO("Maps saved in:\n%s \n%s\n", filename1.c_str(), filename2.c_str());
+    ROS_INFO("Map saved in:\n%s\n", filename1.c_str());
+    res.success = true;
+    res.message = "Map saved in " + filename1;
+    return true;
 }
 
 bool MapperClass::LoadMap(std_srvs::Trigger::Request &req,
                           std_srvs::Trigger::Response &res) {
+    res.success = this->ReadMapFiles(&res.message);
+    return res.success;
+}
+
+bool MapperClass::ReadMapFiles(std::string *message) {
     std::string filename1 = local_path_ + "/maps/octomap.ot";
     std::string filename2 = local_path_ + "/maps/octomap_inflated.ot";
-    octomap::OcTree* tree = dynamic_cast<octomap::OcTree*>(octomap::OcTree::read(filename1));
-    octomap::OcTree* tree_inflated = dynamic_cast<octomap::OcTree*>(octomap::OcTree::read(filename2));
-    if (tree && tree_inflated) {
-        mutexes_.octomap.lock();
-            globals_.octomap.CopyMap(*tree, *tree_inflated);
-        mutexes_.octomap.unlock();
+    octomap::AbstractOcTree* tree = octomap::AbstractOcTree::read(filename1);
+    if (tree == NULL) {
+        *message = "Could not read map from " + filename1;
+        ROS_ERROR("%s", message->c_str());
+        return false;
     }
+
+    // Maps saved before slim and inflated maps were merged come in two files
+    const std::string tree_type = tree->getTreeType();
+    octomap::AbstractOcTree* tree_inflated = NULL;
+    if (tree_type != "MergedOcTree") {
+        tree_inflated = octomap::AbstractOcTree::read(filename2);
+        if (tree_inflated == NULL) {
+            delete tree;
+            *message = "Map in " + filename1 + " is of type " + tree_type +
+                       ", but its inflated map could not be read from " + filename2;
+            ROS_ERROR("%s", message->c_str());
+            return false;
+        }
+    }
+
+    bool copied;
+    mutexes_.octomap.lock();
+        if (tree_inflated != NULL) {
+            copied = globals_.octomap.CopyMap(*tree, *tree_inflated);
+        } else {
+            copied = globals_.octomap.CopyMap(*tree);
+        }
+    mutexes_.octomap.unlock();
+    delete tree;
+    delete tree_inflated;
+    if (!copied) {
+        *message = "Map in " + filename1 + " is of unsupported type " + tree_type;
+        ROS_ERROR("%s", message->c_str());
+        return false;
+    }
+
+    *message = "Map loaded from " + filename1;
+    ROS_INFO("%s", message->c_str());
+    return true;
 }
 
 bool MapperClass::OctomapProcessPCL(std_srvs::SetBool::Request &req,
@@ -107,8 +158,14 @@ bool MapperClass::RRGService(pensa_msgs::RRT_RRG_PRM::Request &req,
                              pensa_msgs::RRT_RRG_PRM::Response &res) {
     std::vector<Eigen::Vector3d> e_path;
     visualization_msgs::Marker graph_markers;
-    mutexes_.octomap.lock();
-    res.success = globals_.octomap.OctoRRG(
+    // Plan on a snapshot of the map: copying it takes a fraction of the
+    // planning time, and mapping and collision checks go on meanwhile
+    ros::Time t0 = ros::Time::now();
+    mutexes_.octomap.lock_shared();
+        std::unique_ptr<octoclass::OctoClass> snapshot = globals_.octomap.PlanningSnapshot();
+    mutexes_.octomap.unlock_shared();
+    ROS_DEBUG("Map snapshot taken in %f seconds", (ros::Time::now() - t0).toSec());
+    res.success = snapshot->OctoRRG(
         msg_conversions::ros_point_to_eigen_vector(req.origin),
         msg_conversions::ros_point_to_eigen_vector(req.destination),
         msg_conversions::ros_point_to_eigen_vector(req.box_min),
@@ -116,7 +173,6 @@ bool MapperClass::RRGService(pensa_msgs::RRT_RRG_PRM::Request &req,
         req.max_time, req.max_nodes, req.steer_param, req.free_space_only,
         req.prune_result, req.publish_rviz, &res.planning_time, &res.n_nodes,
         &e_path, &graph_markers);
-    mutexes_.octomap.unlock();
     for (uint i = 0 ; i < e_path.size(); i++) {
         res.path.push_back(msg_conversions::eigen_to_ros_point(e_path[i]));
     }
@@ -0,0 +1,98 @@
+/* Copyright (c) 2017, United States Government, as represented by the
+ * Administrator of the National Aeronautics and Space Administration.
+ *
+ * All rights reserved.
+ *
+ * The Astrobee platform is licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with the
+ * License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#include "mapper/shifted_keys.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace octoclass {
+
+void ShiftedKeys::Reset(const pcl::PointCloud<pcl::PointXYZ> &points,
+                        const double &resolution,
+                        const unsigned &tree_depth) {
+    resolution_factor_ = 1.0/resolution;
+    max_key_ = (1 << tree_depth) - 1;
+    const int32_t offset = 1 << (tree_depth - 1);
+    points_.resize(points.size());
+    for (int i = 0; i < 3; i++) {
+        sorted_frac_[i].resize(points.size());
+    }
+
+    // Same discretization as OcTreeKey::coordToKey
+    for (size_t j = 0; j < points.size(); j++) {
+        const double coord[3] = {points.points[j].x, points.points[j].y, points.points[j].z};
+        for (int i = 0; i < 3; i++) {
+            const double scaled = coord[i]*resolution_factor_;
+            const double node = std::floor(scaled);
+            const int32_t frac = static_cast<int32_t>((scaled - node)*kFracOne);
+            points_[j].node[i] = static_cast<int32_t>(node) + offset;
+            points_[j].frac[i] = static_cast<uint16_t>(std::min(frac, kFracOne - 1));
+            sorted_frac_[i][j] = points_[j].frac[i];
+        }
+    }
+    for (int i = 0; i < 3; i++) {
+        std::sort(sorted_frac_[i].begin(), sorted_frac_[i].end());
+    }
+    shifted_ = false;
+}
+
+bool ShiftedKeys::Shift(const Eigen::Vector3d &shift,
+                        FlatKeySet *keys) {
+    // Whole nodes, and the number of points the residue pushes one node further
+    int32_t nodes[3], threshold[3];
+    size_t crossing[3];
+    bool same = shifted_;
+    for (int i = 0; i < 3; i++) {
+        const double scaled = shift[i]*resolution_factor_;
+        const double whole = std::floor(scaled);
+        const int32_t residue = std::min(static_cast<int32_t>((scaled - whole)*kFracOne), kFracOne - 1);
+        nodes[i] = static_cast<int32_t>(whole);
+        threshold[i] = kFracOne - residue;  // frac + residue >= kFracOne
+        crossing[i] = sorted_frac_[i].end() -
+                      std::lower_bound(sorted_frac_[i].begin(), sorted_frac_[i].end(), threshold[i]);
+        same = same && (nodes[i] == last_nodes_[i]) && (crossing[i] == last_crossing_[i]);
+    }
+    if (same) {
+        return false;
+    }
+
+    keys->Clear();
+    for (size_t j = 0; j < points_.size(); j++) {
+        const Point &p = points_[j];
+        int32_t key[3];
+        for (int i = 0; i < 3; i++) {
+            key[i] = p.node[i] + nodes[i] + ((p.frac[i] >= threshold[i]) ? 1 : 0);
+        }
+        if ((key[0] < 0) || (key[1] < 0) || (key[2] < 0) ||
+            (key[0] > max_key_) || (key[1] > max_key_) || (key[2] > max_key_)) {
+            continue;
+        }
+        keys->Insert(octomap::OcTreeKey(key[0], key[1], key[2]));
+    }
+    for (int i = 0; i < 3; i++) {
+        last_nodes_[i] = nodes[i];
+        last_crossing_[i] = crossing[i];
+    }
+    shifted_ = true;
+    return true;
+}
+
+}  // namespace octoclass
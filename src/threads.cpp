@@ -18,9 +18,16 @@
 
 #include <mapper/mapper_class.h>
 #include <mapper/helper.h>
+#include <mapper/pcl_conversions.h>
 #include <string>
 #include <vector>
 #include <algorithm>
+#include <limits>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <fstream>
+#include <sstream>
 
 namespace mapper {
 
@@ -28,18 +35,23 @@ namespace mapper {
 void MapperClass::FadeTask() {
     ROS_DEBUG("[mapper]: Fading Memory Thread started with rate %f: ", fading_memory_update_rate_);
 
-    // Rate at which this thread will run
-    ros::Rate loop_rate(1.1);
+    // Rate at which this thread will run. Nodes fade lazily: this only
+    // sets how long expired nodes can stay in the map before being deleted
+    ros::Rate loop_rate(fading_memory_update_rate_);
 
     while (!terminate_node_) {
         // Get time for when this task started
         const ros::Time t0 = ros::Time::now();
 
         mutexes_.octomap.lock();
-            if (globals_.octomap.memory_time_ > 0) {
-                globals_.octomap.FadeMemory(fading_memory_update_rate_);
+            const bool fading = (globals_.octomap.memory_time_ > 0);
+            if (fading) {
+                globals_.octomap.FadeMemory();
             }
         mutexes_.octomap.unlock();
+        if (fading) {
+            sem_post(&semaphores_.collision_check);  // Expired obstacles might have been on the path
+        }
 
         // ros::Duration fade_time = ros::Time::now() - t0;
         // ROS_INFO("Fading memory execution time: %f", fade_time.toSec());
@@ -118,8 +130,9 @@ void MapperClass::LidarTfTask(const std::string& parent_frame,
 void MapperClass::PathCollisionCheckTask() {
     ROS_DEBUG("[mapper]: collisionCheck Thread started!");
 
-    // Rate at which the collision checker will run
-    ros::Rate loop_rate(collision_check_rate_);
+    // The checker wakes up after every map or trajectory change, and at
+    // collision_check_rate_ otherwise to follow the robot along the path
+    const double wait_timeout = 1.0/collision_check_rate_;
 
     // visualization markers
     visualization_msgs::MarkerArray traj_markers, samples_markers;
@@ -138,21 +151,52 @@ void MapperClass::PathCollisionCheckTask() {
     mutexes_.sampled_traj.unlock();
     double octomap_resolution;
 
+    // Trajectory of the last check (discretized once), the keys it sweeps and the ones colliding
+    pcl::PointCloud<pcl::PointXYZ> point_cloud_traj, point_cloud_traj_through_drone;
+    uint64_t traj_version = std::numeric_limits<uint64_t>::max();
+    octoclass::ShiftedKeys traj_shifted_keys;
+    octoclass::FlatKeySet traj_keys, changed_traj_keys;
+    std::vector<octomap::OcTreeKey> changed_keys, colliding_keys, still_colliding;
+    bool check_all = true;  // Changed keys were dropped without being checked
+
     while (!terminate_node_) {
-        // Get time for when this task started
-        ros::Time time_now = ros::Time::now();
+        struct timespec ts = helper::TimeFromNow(wait_timeout);
+        sem_timedwait(&semaphores_.collision_check, &ts);
+        while (sem_trywait(&semaphores_.collision_check) == 0) {}  // Several changes are checked at once
 
-        // Copy trajectory into local point cloud and get visualization markers for path
-        std::vector<octomap::point3d> colliding_nodes;
+        // Nodes changed by the map updates since the last check
+        bool full_change;
+        mutexes_.octomap.lock();
+            globals_.octomap.TakeChangedKeys(&changed_keys, &full_change);
+        mutexes_.octomap.unlock();
+
+        // Copy trajectory into local point cloud (only when it is a new one)
         mutexes_.sampled_traj.lock();
-            const pcl::PointCloud<pcl::PointXYZ> point_cloud_traj = globals_.sampled_traj.point_cloud_traj_;
-            globals_.sampled_traj.GetVisMarkers(&traj_markers, &samples_markers, &compressed_samples_markers);
+            const bool new_traj = (globals_.sampled_traj_version != traj_version);
+            if (new_traj) {
+                point_cloud_traj = globals_.sampled_traj.point_cloud_traj_;
+                traj_version = globals_.sampled_traj_version;
+            }
         mutexes_.sampled_traj.unlock();
 
+        // Keys depend on the map resolution, which only changes with a full change
+        if (new_traj || full_change) {
+            this->DiscretizeTrajectory(point_cloud_traj, &traj_shifted_keys);
+        }
+
         // Stop execution if there are no points in the trajectory structure
-        if (point_cloud_traj.size() <= 0) {
-            visualization_functions::DrawCollidingNodes(colliding_nodes, inertial_frame_id_, 0.015, &collision_markers);
-            this->PublishPathMarkers(collision_markers, traj_markers, samples_markers, compressed_samples_markers);
+        std::vector<octomap::point3d> colliding_nodes;
+        const bool pub_markers = (path_marker_pub_.getNumSubscribers() > 0);
+        if (traj_shifted_keys.Empty()) {
+            colliding_keys.clear();
+            check_all = true;
+            if (new_traj && pub_markers) {
+                mutexes_.sampled_traj.lock();
+                    globals_.sampled_traj.GetVisMarkers(&traj_markers, &samples_markers, &compressed_samples_markers);
+                mutexes_.sampled_traj.unlock();
+                visualization_functions::DrawCollidingNodes(colliding_nodes, inertial_frame_id_, 0.015, &collision_markers);
+                this->PublishPathMarkers(collision_markers, traj_markers, samples_markers, compressed_samples_markers);
+            }
             continue;
         }
 
@@ -161,6 +205,7 @@ void MapperClass::PathCollisionCheckTask() {
 
         // Find point in trajectory that the robot is closest to
         if (!this->RobotPosProjectedOnTrajectory(robot_position, &robot_projected_on_traj)) {
+            check_all = true;
             continue;
         }
 
@@ -173,15 +218,44 @@ void MapperClass::PathCollisionCheckTask() {
             current_set_point.z = 0.0;
         }
 
-        // Shift trajectory PCL so it passes along drone position
+        // Shift trajectory keys so they pass along drone position. The swept
+        // keys only change when the shift moves a point into another node
         Eigen::Vector3d vec_traj_to_drone;
-        pcl::PointCloud<pcl::PointXYZ> point_cloud_traj_through_drone;
         helper::SubtractRosPoints(robot_projected_on_traj, robot_position, &vec_traj_to_drone);
-        helper::ShiftPcl(point_cloud_traj, vec_traj_to_drone, &point_cloud_traj_through_drone);
-
-        // Check if trajectory collides with points in the map
-        this->GetCollidingNodesPcl(point_cloud_traj_through_drone, &colliding_nodes);
-        // ROS_INFO("Colliding nodes: %d", int(colliding_nodes.size()) );
+        const bool moved = traj_shifted_keys.Shift(vec_traj_to_drone, &traj_keys);
+
+        // Check the whole trajectory if it moved or the map changed wholesale,
+        // otherwise only the changed nodes it sweeps
+        if (moved || full_change || check_all) {
+            colliding_keys.clear();
+            this->GetCollidingKeys(traj_keys.Keys(), &colliding_keys);
+            check_all = false;
+        } else {
+            changed_traj_keys.Clear();
+            for (size_t i = 0; i < changed_keys.size(); i++) {
+                if (traj_keys.Contains(changed_keys[i])) {
+                    changed_traj_keys.Insert(changed_keys[i]);
+                }
+            }
+            if (changed_traj_keys.Size() == 0) {
+                // Nothing changed on the path: only the distance to the collision did
+                if (colliding_keys.size() > 0) {
+                    this->GetNodeCenters(colliding_keys, &colliding_nodes);
+                    helper::FindNearestCollision(colliding_nodes, robot_position, &nearest_collision, &collision_distance);
+                    this->PublishNearestCollision(nearest_collision, collision_distance);
+                }
+                continue;
+            }
+            still_colliding.clear();
+            for (size_t i = 0; i < colliding_keys.size(); i++) {
+                if (!changed_traj_keys.Contains(colliding_keys[i])) {
+                    still_colliding.push_back(colliding_keys[i]);
+                }
+            }
+            colliding_keys.swap(still_colliding);
+            this->GetCollidingKeys(changed_traj_keys.Keys(), &colliding_keys);
+        }
+        this->GetNodeCenters(colliding_keys, &colliding_nodes);
 
         // If there are collisions, find the nearest one and publish it
         if (colliding_nodes.size() > 0) {
@@ -191,7 +265,15 @@ void MapperClass::PathCollisionCheckTask() {
         }
 
         // Visualization markers -------------------------------------------------------------------------------------
+        if (!pub_markers) {
+            continue;
+        }
+        mutexes_.sampled_traj.lock();
+            globals_.sampled_traj.GetVisMarkers(&traj_markers, &samples_markers, &compressed_samples_markers);
+        mutexes_.sampled_traj.unlock();
+
         // Visualization markers for shifted trajectory
+        helper::ShiftPcl(point_cloud_traj, vec_traj_to_drone, &point_cloud_traj_through_drone);
         visualization_functions::TrajVisMarkers(point_cloud_traj_through_drone,
             inertial_frame_id_, traj_sample_size, &traj_markers);
 
@@ -207,11 +289,6 @@ void MapperClass::PathCollisionCheckTask() {
 
         // Publish all markers
         this->PublishPathMarkers(collision_markers, traj_markers, samples_markers, compressed_samples_markers);
-
-        // ros::Duration solver_time = ros::Time::now() - time_now;
-        // ROS_INFO("Collision check time: %f", solver_time.toSec());
-
-        loop_rate.sleep();
     }
 
     ROS_DEBUG("[mapper]: Exiting collisionCheck Thread...");
@@ -252,10 +329,13 @@ void MapperClass::RadiusCollisionCheck() {
         Eigen::Vector3d nearest_node_center;
         double nearest_node_dist;
         mutexes_.octomap.lock();
+            globals_.octomap.RecenterDistanceField(center);
+        mutexes_.octomap.unlock();
+        mutexes_.octomap.lock_shared();
             const bool there_are_nodes =
                 globals_.octomap.NearestOccNodeWithinRadius(robot_position, radius,
                                                             &nearest_node_center, &nearest_node_dist);
-        mutexes_.octomap.unlock();
+        mutexes_.octomap.unlock_shared();
 
         if (!there_are_nodes) {
             continue;
@@ -273,37 +353,79 @@ void MapperClass::RadiusCollisionCheck() {
 
 void MapperClass::OctomappingTask() {
     ROS_DEBUG("[mapper]: OctomappingTask Thread started!");
-    tf::StampedTransform tf_cam2world;
-    pcl::PointCloud< pcl::PointXYZ > pcl_world;
 
+    // Picks the next cloud among all sensors (cameras first, then lidars)
+    std::vector<sensorInput*> inputs;
+    for (uint i = 0; i < globals_.cam_inputs.size(); i++) {
+        inputs.push_back(globals_.cam_inputs[i].get());
+    }
+    for (uint i = 0; i < globals_.lidar_inputs.size(); i++) {
+        inputs.push_back(globals_.lidar_inputs[i].get());
+    }
+    mutexes_.pcl_scheduler.lock();
+        pcl_scheduler_.Initialize(inputs, pcl_scheduling_policy_, pcl_max_staleness_);
+        next_pcl_ticket_ = 0;
+    mutexes_.pcl_scheduler.unlock();
+    mutexes_.scan_apply.lock();
+        next_apply_ticket_ = 0;
+    mutexes_.scan_apply.unlock();
+
+    // Each scheduled cloud gets a ticket. Workers preprocess clouds in
+    // parallel, but apply their map updates in ticket order
+    std::vector<std::thread> workers;
+    for (int i = 1; i < mapping_workers_; i++) {
+        workers.push_back(std::thread(&MapperClass::MappingWorker, this, i));
+    }
+    this->MappingWorker(0);
+    for (uint i = 0; i < workers.size(); i++) {
+        workers[i].join();
+    }
+
+    ROS_DEBUG("[mapper]: Exiting OctomappingTask Thread...");
+}
+
+void MapperClass::MappingWorker(const uint &worker_index) {
+    // Buffers are reused from one point cloud to the next
+    point_filter::VoxelDownsampler downsampler;
+    pcl::PointCloud<pcl::PointXYZ> converted_cloud;  // Clouds that cannot be read in place
+    octoclass::ScanWorker scan_worker;
+    octoclass::ScanUpdate scan_update;
+
+    const double stats_period = 5.0;  // seconds
     uint semaphore_timeout = 1;  // seconds
 
     while (!terminate_node_) {
-        // Wait until there is new pcl data
-        struct timespec ts = helper::TimeFromNow(semaphore_timeout);
-        if (sem_timedwait(&semaphores_.pcl, &ts) == -1) {
-            // the point of this is to go back and check if (terminate_node_.GetValue() == true)
+        // Get Point Cloud. Wait for new pcl data only if no sensor has any
+        // (the semaphore may have been posted for a cloud that was dropped)
+        stampedPcl new_pcl;
+        uint input_index;
+        uint64_t ticket = 0;
+        mutexes_.pcl_scheduler.lock();
+            if (worker_index == 0) {
+                pcl_scheduler_.LogStats(stats_period);
+            }
+            const bool has_pcl = pcl_scheduler_.Next(&new_pcl, &input_index);
+            if (has_pcl) {
+                ticket = next_pcl_ticket_++;
+            }
+        mutexes_.pcl_scheduler.unlock();
+        if (!has_pcl) {
+            struct timespec ts = helper::TimeFromNow(semaphore_timeout);
+            // the point of the timeout is to go back and check if (terminate_node_.GetValue() == true)
+            sem_timedwait(&semaphores_.pcl, &ts);
             continue;
         }
 
         // Get time for when this task started
         const ros::Time t0 = ros::Time::now();
 
-        // Get Point Cloud
-        mutexes_.point_cloud.lock();
-            // Get data from queue
-            pcl::PointCloud< pcl::PointXYZ > point_cloud = globals_.pcl_queue.front().cloud;
-            const tf::StampedTransform tf_cam2world = globals_.pcl_queue.front().tf_cam2world;
-            const bool is_lidar = globals_.pcl_queue.front().is_lidar;
+        const sensor_msgs::PointCloud2::ConstPtr point_cloud = new_pcl.cloud;
+        const tf::StampedTransform &tf_cam2world = new_pcl.tf_cam2world;
+        const bool is_lidar = new_pcl.is_lidar;
+        const uint sensor_index = new_pcl.sensor_index;
 
-            // Remove data from queue
-            globals_.pcl_queue.pop();
-        mutexes_.point_cloud.unlock();
-
-        // Check if a tf message has been received already. If not, return
-        if (tf_cam2world.stamp_.toSec() == 0) {
-            continue;
-        }
+        // Check if a tf message has been received already. If not, skip this cloud
+        const bool has_tf = (tf_cam2world.stamp_.toSec() != 0);
 
         // Get camera transform
         tf::Quaternion q = tf_cam2world.getRotation();
@@ -312,35 +434,72 @@ void MapperClass::OctomappingTask() {
         transform.translation() << v.getX(), v.getY(), v.getZ();
         transform.rotate(Eigen::Quaterniond(q.getW(), q.getX(), q.getY(), q.getZ()));
 
-        // Update frustum orientation
+        // Update frustum orientation and get the current mapping parameters
         algebra_3d::FrustumPlanes world_frustum;
-        mutexes_.octomap.lock();
+        mutexes_.octomap.lock_shared();
             globals_.octomap.cam_frustum_.TransformFrustum(transform, &world_frustum);
-        mutexes_.octomap.unlock();
+            const std::shared_ptr<const octoclass::ScanParams> scan_params = globals_.octomap.GetScanParams();
+        mutexes_.octomap.unlock_shared();
 
         // Should we process PCL data?
         mutexes_.update_map.lock();
             const bool update_map = globals_.update_map;
         mutexes_.update_map.unlock();
 
-        // Process PCL data
-        if (update_map) {
-            // Transform pcl into world frame
-            pcl::transformPointCloud(point_cloud, pcl_world, transform);
+        // Compute the map update without holding the map lock
+        bool has_update = false;
+        if (has_tf && update_map) {
+            // Points are read straight from the message buffer. Clouds with
+            // another layout or byte order go through the pcl conversion
+            cloud_view::XYZView cloud_xyz(*point_cloud);
+            if (!cloud_xyz.IsValid() && cloud_xyz.HasXYZFields()) {
+                pcl_conversions::FromROSMsg(*point_cloud, &converted_cloud);
+                cloud_xyz = cloud_view::XYZView(reinterpret_cast<const float*>(converted_cloud.points.data()),
+                                                converted_cloud.points.size(), sizeof(pcl::PointXYZ));
+            }
+            if (cloud_xyz.IsValid()) {
+                // Downsample in sensor frame (no-op if disabled for this sensor)
+                const point_filter::DownsampleParams &downsample_params =
+                    is_lidar ? lidar_downsample_[sensor_index] : cam_downsample_[sensor_index];
+                const cloud_view::XYZView cloud_sensor = downsampler.Downsample(cloud_xyz, downsample_params);
+
+                // Points are transformed into world frame on the fly
+                scan_worker.Compute(scan_params, cloud_sensor, transform,
+                                    is_lidar ? NULL : &world_frustum, &scan_update);
+                has_update = true;
+            } else {
+                ROS_WARN("[mapper]: Point cloud from frame `%s` has no valid xyz fields!",
+                         point_cloud->header.frame_id.c_str());
+            }
+        }
 
-            // Save into octomap
+        // Save into octomap, in the order clouds were scheduled
+        if (!this->WaitForScanApplyTurn(ticket)) {
+            break;
+        }
+        if (has_update) {
+            const Eigen::Vector3d robot_position =
+                msg_conversions::ros_point_to_eigen_vector(this->GetTfBodyToWorld());
             mutexes_.octomap.lock();
-                if (is_lidar) {
-                    globals_.octomap.PclToRayOctomap(pcl_world, tf_cam2world);
-                } else {
-                    globals_.octomap.PclToRayOctomap(pcl_world, tf_cam2world, world_frustum);
-                }
-                if (globals_.map_3d) {
-                    globals_.octomap.tree_.prune();   // prune the tree before visualizing
-                }
+                // Subtrees that left the rolling window are evicted first (no-op if disabled)
+                globals_.octomap.MoveWindow(robot_position);
+                globals_.octomap.RecenterCollisionCache(robot_position);
+                // Touched subtrees are pruned while applying (3D maps)
+                const bool applied = globals_.octomap.ApplyScanUpdate(scan_update);
             mutexes_.octomap.unlock();
+            if (applied) {
+                mutexes_.pcl_scheduler.lock();
+                    pcl_scheduler_.Integrated(input_index, new_pcl);
+                mutexes_.pcl_scheduler.unlock();
+                // Notify the collision checker to check for collision due to map update
+                sem_post(&semaphores_.collision_check);
+            }
         }
+        this->EndScanApplyTurn();
 
+        if (!has_tf) {
+            continue;
+        }
 
         // Publish visualization markers iff at least one node is subscribed to it
         bool pub_obstacles, pub_free, pub_obstacles_inflated, pub_free_inflated;
@@ -352,9 +511,9 @@ void MapperClass::OctomappingTask() {
         if (pub_obstacles || pub_free) {
             visualization_msgs::MarkerArray obstacle_markers;
             visualization_msgs::MarkerArray free_markers;
-            mutexes_.octomap.lock();
+            mutexes_.octomap.lock_shared();
                 globals_.octomap.TreeVisMarkers(&obstacle_markers, &free_markers);
-            mutexes_.octomap.unlock();
+            mutexes_.octomap.unlock_shared();
             if (pub_obstacles) {
                 obstacle_marker_pub_.publish(obstacle_markers);
             }
@@ -366,9 +525,9 @@ void MapperClass::OctomappingTask() {
         if (pub_obstacles_inflated || pub_free_inflated) {
             visualization_msgs::MarkerArray inflated_markers;
             visualization_msgs::MarkerArray inflated_free_markers;
-            mutexes_.octomap.lock();
+            mutexes_.octomap.lock_shared();
                 globals_.octomap.InflatedVisMarkers(&inflated_markers, &inflated_free_markers);
-            mutexes_.octomap.unlock();
+            mutexes_.octomap.unlock_shared();
             if (pub_obstacles_inflated) {
                 inflated_obstacle_marker_pub_.publish(inflated_markers);
             }
@@ -379,9 +538,9 @@ void MapperClass::OctomappingTask() {
 
         if ((!is_lidar) && (cam_frustum_pub_.getNumSubscribers() > 0)) {
             visualization_msgs::Marker frustum_markers;
-            mutexes_.octomap.lock();
-                globals_.octomap.cam_frustum_.VisualizeFrustum(point_cloud.header.frame_id, &frustum_markers);
-            mutexes_.octomap.unlock();
+            mutexes_.octomap.lock_shared();
+                globals_.octomap.cam_frustum_.VisualizeFrustum(point_cloud->header.frame_id, &frustum_markers);
+            mutexes_.octomap.unlock_shared();
             cam_frustum_pub_.publish(frustum_markers);
         } else if ((is_lidar) && (cam_frustum_pub_.getNumSubscribers() > 0)) {
             visualization_msgs::Marker lidar_range_marker;
@@ -389,22 +548,36 @@ void MapperClass::OctomappingTask() {
             if (!globals_.map_3d) {
                 lidar_origin[2] = 0.0;
             }
-            mutexes_.octomap.lock();
+            mutexes_.octomap.lock_shared();
                 globals_.octomap.lidar_range_.VisualizeRange(
                     globals_.octomap.GetInertialFrameId(), lidar_origin,
                     &lidar_range_marker);
-            mutexes_.octomap.unlock();
+            mutexes_.octomap.unlock_shared();
             cam_frustum_pub_.publish(lidar_range_marker);
         }
 
-        // // Notify the collision checker to check for collision due to map update
-        // sem_post(&semaphores_.collision_check);
-
         // ros::Duration map_time = ros::Time::now() - t0;
         // ROS_INFO("Mapping time: %f", map_time.toSec());
     }
+}
+
+bool MapperClass::WaitForScanApplyTurn(const uint64_t &ticket) {
+    std::unique_lock<std::mutex> lock(mutexes_.scan_apply);
+    while (next_apply_ticket_ != ticket) {
+        if (terminate_node_) {
+            return false;
+        }
+        // Time out once in a while to check if the node is terminating
+        mutexes_.scan_apply_turn.wait_for(lock, std::chrono::seconds(1));
+    }
+    return true;
+}
 
-    ROS_DEBUG("[mapper]: Exiting OctomappingTask Thread...");
+void MapperClass::EndScanApplyTurn() {
+    mutexes_.scan_apply.lock();
+        next_apply_ticket_++;
+    mutexes_.scan_apply.unlock();
+    mutexes_.scan_apply_turn.notify_all();
 }
 
 void MapperClass::KeyboardTask() {
@@ -416,22 +589,21 @@ void MapperClass::KeyboardTask() {
         ROS_INFO("Received command: %s", input_string.c_str());
 
         std::string filename1 = local_path_ + "/maps/octomap.ot";
-        std::string filename2 = local_path_ + "/maps/octomap_inflated.ot";
         if (input_string == "save_map") {
-            mutexes_.octomap.lock();
-                globals_.octomap.tree_.write(filename1);
-                globals_.octomap.tree_inflated_.write(filename2);
-            mutexes_.octomap.unlock();
-
-            ROS_INFO("Maps saved in:\n%s \n%s\n", filename1.c_str(), filename2.c_str());
-        } else if (input_string == "load_map") {
-            octomap::OcTree* tree = dynamic_cast<octomap::OcTree*>(octomap::OcTree::read(filename1));
-            octomap::OcTree* tree_inflated = dynamic_cast<octomap::OcTree*>(octomap::OcTree::read(filename2));
-            if (tree && tree_inflated) {
-                mutexes_.octomap.lock();
-                    globals_.octomap.CopyMap(*tree, *tree_inflated);
-                mutexes_.octomap.unlock();
+            // Serialize in memory, so that mapping does not wait for the disk
+            std::stringstream data;
+            mutexes_.octomap.lock_shared();
+                globals_.octomap.tree_.write(data);  // Slim and inflated maps
+            mutexes_.octomap.unlock_shared();
+            std::ofstream file(filename1.c_str(), std::ios_base::out | std::ios_base::binary);
+            if (!file.is_open() || !(file << data.rdbuf())) {
+                ROS_ERROR("Could not write map to:\n%s\n", filename1.c_str());
+            } else {
+                ROS_INFO("Map saved in:\n%s\n", filename1.c_str());
             }
+        } else if (input_string == "load_map") {
+            std::string message;
+            this->ReadMapFiles(&message);  // Reports the outcome
         }
     }
 
@@ -0,0 +1,173 @@
+/* Copyright (c) 2017, United States Government, as represented by the
+ * Administrator of the National Aeronautics and Space Administration.
+ *
+ * All rights reserved.
+ *
+ * The Astrobee platform is licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with the
+ * License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "mapper/voxel_downsampler.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <algorithm>
+#include <string>
+
+namespace point_filter {
+
+bool DownsampleModeFromString(const std::string &name, DownsampleMode *mode) {
+    if (name == "none") {
+        *mode = kDownsampleNone;
+    } else if (name == "nearest") {
+        *mode = kDownsampleNearest;
+    } else if (name == "centroid") {
+        *mode = kDownsampleCentroid;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+cloud_view::XYZView VoxelDownsampler::Downsample(const cloud_view::XYZView &cloud,
+                                                 const DownsampleParams &params) {
+    if ((params.mode == kDownsampleNone) || (params.voxel_size <= 0.0)) {
+        return cloud;
+    }
+
+    // Start a new generation: all slots from previous clouds become empty
+    voxels_.clear();
+    points_.clear();
+    sums_.clear();
+    counts_.clear();
+    range_sqr_.clear();
+    generation_++;
+    if (generation_ == 0) {  // Wrapped around
+        for (size_t i = 0; i < slots_.size(); i++) {
+            slots_[i].generation = 0;
+        }
+        generation_ = 1;
+    }
+    if (slots_.empty()) {
+        Grow(4096);
+    }
+
+    // Voxel coordinates are packed in 21 bits each
+    const int64_t max_coord = 1 << 20;
+    const double inv_voxel_size = 1.0/params.voxel_size;
+    float x, y, z;
+    for (uint32_t row = 0; row < cloud.Height(); row++) {
+        for (uint32_t col = 0; col < cloud.Width(); col++) {
+            cloud.GetPoint(row, col, &x, &y, &z);
+            if (!std::isfinite(x) || !std::isfinite(y) || !std::isfinite(z)) {
+                continue;
+            }
+
+            // Range check before the cast: huge coordinates would overflow int64_t
+            const double fx = std::floor(x*inv_voxel_size);
+            const double fy = std::floor(y*inv_voxel_size);
+            const double fz = std::floor(z*inv_voxel_size);
+            if ((std::abs(fx) >= max_coord) || (std::abs(fy) >= max_coord) || (std::abs(fz) >= max_coord)) {
+                continue;  // Too far away from the sensor to be mapped anyway
+            }
+            const int64_t ix = static_cast<int64_t>(fx);
+            const int64_t iy = static_cast<int64_t>(fy);
+            const int64_t iz = static_cast<int64_t>(fz);
+            const uint64_t voxel = static_cast<uint64_t>(ix + max_coord)
+                                 | (static_cast<uint64_t>(iy + max_coord) << 21)
+                                 | (static_cast<uint64_t>(iz + max_coord) << 42);
+
+            bool inserted;
+            const uint32_t i = FindOrInsert(voxel, &inserted);
+            if (params.mode == kDownsampleNearest) {
+                // Sensor is at the origin: keep the point with the smallest norm
+                const float range_sqr = x*x + y*y + z*z;
+                if (inserted || (range_sqr < range_sqr_[i])) {
+                    points_[3*i] = x;
+                    points_[3*i + 1] = y;
+                    points_[3*i + 2] = z;
+                    range_sqr_[i] = range_sqr;
+                }
+            } else {
+                sums_[3*i] += x;
+                sums_[3*i + 1] += y;
+                sums_[3*i + 2] += z;
+                counts_[i]++;
+            }
+        }
+    }
+
+    const uint32_t n_voxels = voxels_.size();
+    if (params.mode == kDownsampleCentroid) {
+        for (uint32_t i = 0; i < 3*n_voxels; i++) {
+            points_[i] = static_cast<float>(sums_[i]/counts_[i/3]);
+        }
+    }
+    return cloud_view::XYZView(points_.data(), n_voxels);
+}
+
+uint32_t VoxelDownsampler::FindOrInsert(const uint64_t &voxel, bool *inserted) {
+    if (2*(voxels_.size() + 1) > slots_.size()) {
+        Grow(2*slots_.size());
+    }
+
+    // Fibonacci hashing + linear probing
+    for (size_t i = static_cast<size_t>((voxel*0x9E3779B97F4A7C15ULL) >> shift_); ; i = (i + 1) & mask_) {
+        Slot &slot = slots_[i];
+        if (slot.generation != generation_) {
+            const uint32_t index = voxels_.size();
+            slot.voxel = voxel;
+            slot.index = index;
+            slot.generation = generation_;
+            voxels_.push_back(voxel);
+            points_.resize(3*(index + 1), 0.0f);
+            sums_.resize(3*(index + 1), 0.0);
+            counts_.resize(index + 1, 0);
+            range_sqr_.resize(index + 1, 0.0f);
+            *inserted = true;
+            return index;
+        } else if (slot.voxel == voxel) {
+            *inserted = false;
+            return slot.index;
+        }
+    }
+}
+
+void VoxelDownsampler::Grow(const size_t &min_slots) {
+    size_t n_slots = 1;
+    int log_slots = 0;
+    while (n_slots < min_slots) {
+        n_slots *= 2;
+        log_slots++;
+    }
+    Slot empty;
+    empty.voxel = 0;
+    empty.index = 0;
+    empty.generation = 0;
+    slots_.assign(n_slots, empty);
+    mask_ = n_slots - 1;
+    shift_ = 64 - log_slots;
+
+    // Re-insert the voxels of the current cloud
+    for (uint32_t j = 0; j < voxels_.size(); j++) {
+        for (size_t i = static_cast<size_t>((voxels_[j]*0x9E3779B97F4A7C15ULL) >> shift_); ; i = (i + 1) & mask_) {
+            if (slots_[i].generation != generation_) {
+                slots_[i].voxel = voxels_[j];
+                slots_[i].index = j;
+                slots_[i].generation = generation_;
+                break;
+            }
+        }
+    }
+}
+
+}  // namespace point_filter
@@ -0,0 +1,108 @@
+/* Copyright (c) 2017, United States Government, as represented by the
+ * Administrator of the National Aeronautics and Space Administration.
+ *
+ * All rights reserved.
+ *
+ * The Astrobee platform is licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with the
+ * License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#include "mapper/worker_pool.h"
+
+#include <algorithm>
+
+namespace octoclass {
+
+WorkerPool::WorkerPool(const int &n_threads) {
+    for (int i = 1; i < std::max(n_threads, 1); i++) {
+        threads_.push_back(std::thread(&WorkerPool::WorkerLoop, this));
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    mutex_.lock();
+        stop_ = true;
+    mutex_.unlock();
+    work_available_.notify_all();
+    for (size_t i = 0; i < threads_.size(); i++) {
+        threads_[i].join();
+    }
+}
+
+void WorkerPool::Run(const size_t &n_tasks,
+                     const std::function<void(const size_t&)> &task) {
+    if (n_tasks == 0) {
+        return;
+    }
+    if (threads_.empty() || (n_tasks == 1)) {
+        for (size_t i = 0; i < n_tasks; i++) {
+            task(i);
+        }
+        return;
+    }
+
+    Batch batch;
+    batch.task = &task;
+    batch.n_tasks = n_tasks;
+    std::unique_lock<std::mutex> lock(mutex_);
+    batches_.push_back(&batch);
+    work_available_.notify_all();
+
+    // The calling thread works on its own batch too
+    while (batch.next < batch.n_tasks) {
+        const size_t index = batch.next++;
+        if (batch.next == batch.n_tasks) {
+            batches_.erase(std::find(batches_.begin(), batches_.end(), &batch));
+        }
+        lock.unlock();
+        task(index);
+        lock.lock();
+        batch.done++;
+    }
+
+    // Pool threads still hold pointers to the batch until their tasks complete
+    while (batch.done < batch.n_tasks) {
+        batch.finished.wait(lock);
+    }
+}
+
+WorkerPool::Batch *WorkerPool::NextTask(size_t *index) {
+    Batch *batch = batches_.front();
+    *index = batch->next++;
+    if (batch->next == batch->n_tasks) {
+        batches_.pop_front();
+    }
+    return batch;
+}
+
+void WorkerPool::WorkerLoop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        while (!stop_ && batches_.empty()) {
+            work_available_.wait(lock);
+        }
+        if (stop_) {
+            return;
+        }
+        size_t index;
+        Batch *batch = this->NextTask(&index);
+        lock.unlock();
+        (*batch->task)(index);
+        lock.lock();
+        if (++batch->done == batch->n_tasks) {
+            batch->finished.notify_one();
+        }
+    }
+}
+
+}  // namespace octoclass
@@ -0,0 +1,128 @@
+/* Copyright (c) 2017, United States Government, as represented by the
+ * Administrator of the National Aeronautics and Space Administration.
+ *
+ * All rights reserved.
+ *
+ * The Astrobee platform is licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with the
+ * License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+
+#include <gtest/gtest.h>
+
+#include <map>
+#include <random>
+#include <set>
+#include <tuple>
+#include <vector>
+
+#include "mapper/block_inflater.h"
+#include "mapper/worker_pool.h"
+
+namespace {
+
+typedef std::tuple<int, int, int> KeyTuple;
+
+// Ellipsoid of key offsets, like the stencil of OctoClass::SetMapInflation
+std::vector<Eigen::Vector3i> Ellipsoid(const int &radius_xy, const int &radius_z) {
+    std::vector<Eigen::Vector3i> stencil;
+    for (int x = -radius_xy; x <= radius_xy; x++) {
+        for (int y = -radius_xy; y <= radius_xy; y++) {
+            for (int z = -radius_z; z <= radius_z; z++) {
+                const double a = static_cast<double>(x)/radius_xy, b = static_cast<double>(y)/radius_xy;
+                const double c = (radius_z > 0) ? static_cast<double>(z)/radius_z : 0.0;
+                if (a*a + b*b + c*c <= 1.0001) {
+                    stencil.push_back(Eigen::Vector3i(x, y, z));
+                }
+            }
+        }
+    }
+    return stencil;
+}
+
+// Unique occupied keys scattered over a few blocks, some at the edges of the key range
+std::vector<octomap::OcTreeKey> RandomOccupied(const size_t &n_keys, std::mt19937 *rng) {
+    std::uniform_int_distribution<int> xy(32768 - 50, 32768 + 50), z(32768 - 20, 32768 + 20);
+    std::set<KeyTuple> unique;
+    std::vector<octomap::OcTreeKey> keys;
+    for (size_t i = 0; i < n_keys; i++) {
+        const octomap::OcTreeKey key(xy(*rng), xy(*rng), z(*rng));
+        if (unique.insert(std::make_tuple(key[0], key[1], key[2])).second) {
+            keys.push_back(key);
+        }
+    }
+    keys.push_back(octomap::OcTreeKey(0, 1, 2));
+    keys.push_back(octomap::OcTreeKey(65535, 65534, 65533));
+    return keys;
+}
+
+// Count of every node covered by the stencil of an occupied key (clipped to the key range)
+std::map<KeyTuple, int> BruteForce(const std::vector<octomap::OcTreeKey> &occupied,
+                                   const std::vector<Eigen::Vector3i> &stencil) {
+    std::map<KeyTuple, int> counts;
+    for (size_t i = 0; i < occupied.size(); i++) {
+        for (size_t j = 0; j < stencil.size(); j++) {
+            const Eigen::Vector3i node(occupied[i][0] + stencil[j][0],
+                                       occupied[i][1] + stencil[j][1],
+                                       occupied[i][2] + stencil[j][2]);
+            if ((node.minCoeff() >= 0) && (node.maxCoeff() <= 65535)) {
+                counts[std::make_tuple(node[0], node[1], node[2])]++;
+            }
+        }
+    }
+    return counts;
+}
+
+void ExpectBruteForceCounts(const int &radius_xy, const int &radius_z, const int &n_threads) {
+    std::mt19937 rng(radius_xy + 10*radius_z + 100*n_threads);
+    const std::vector<octomap::OcTreeKey> occupied = RandomOccupied(2000, &rng);
+    const std::vector<Eigen::Vector3i> stencil = Ellipsoid(radius_xy, radius_z);
+
+    octoclass::BlockInflater inflater;
+    inflater.SetStencil(stencil);
+    octoclass::WorkerPool pool(n_threads);
+    std::vector<octomap::OcTreeKey> keys;
+    std::vector<uint16_t> counts;
+    inflater.Inflate(occupied, &pool, &keys, &counts);
+
+    const std::map<KeyTuple, int> expected = BruteForce(occupied, stencil);
+    ASSERT_EQ(keys.size(), counts.size());
+    EXPECT_EQ(expected.size(), keys.size());
+    std::set<KeyTuple> seen;
+    for (size_t i = 0; i < keys.size(); i++) {
+        const KeyTuple key = std::make_tuple(keys[i][0], keys[i][1], keys[i][2]);
+        EXPECT_TRUE(seen.insert(key).second) << "repeated key " << i;
+        const std::map<KeyTuple, int>::const_iterator it = expected.find(key);
+        ASSERT_TRUE(it != expected.end()) << "unexpected key " << i;
+        EXPECT_EQ(it->second, counts[i]) << "key " << i;
+    }
+}
+
+}  // namespace
+
+TEST(BlockInflater, MatchesBruteForce3d) {
+    ExpectBruteForceCounts(3, 2, 1);
+}
+
+TEST(BlockInflater, MatchesBruteForceThreaded) {
+    ExpectBruteForceCounts(6, 4, 4);
+}
+
+TEST(BlockInflater, MatchesBruteForce2d) {
+    ExpectBruteForceCounts(5, 0, 2);
+}
+
+int main(int argc, char **argv) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,118 @@
+/* Copyright (c) 2017, United States Government, as represented by the
+ * Administrator of the National Aeronautics and Space Administration.
+ *
+ * All rights reserved.
+ *
+ * The Astrobee platform is licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with the
+ * License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+
+#include <gtest/gtest.h>
+#include <octomap/octomap.h>
+#include <octomap/OcTree.h>
+
+#include <random>
+#include <vector>
+
+#include "mapper/bulk_update.h"
+
+namespace {
+
+const double kResolution = 0.1;
+
+// Hits and misses clustered in a small box, so that keys repeat, nodes
+// saturate and whole subtrees become prunable over a few batches
+class BulkUpdateTest : public ::testing::Test {
+ protected:
+    BulkUpdateTest() : sequential_(kResolution), bulk_(kResolution), rng_(1) {}
+
+    std::vector<octomap::OcTreeKey> RandomKeys(const size_t &n_keys, const int &half_size) {
+        std::uniform_int_distribution<int> offset(-half_size, half_size - 1);
+        std::vector<octomap::OcTreeKey> keys(n_keys);
+        for (size_t i = 0; i < n_keys; i++) {
+            keys[i] = octomap::OcTreeKey(32768 + offset(rng_), 32768 + offset(rng_), 32768 + offset(rng_));
+        }
+        return keys;
+    }
+
+    // Same batch into both trees. Within a batch, all hits come before all misses
+    void ApplyBatch(const std::vector<octomap::OcTreeKey> &hits,
+                    const std::vector<octomap::OcTreeKey> &misses,
+                    const bool &prune) {
+        const bool lazy_eval = !prune;  // updateNode prunes unless evaluation is lazy
+        for (size_t i = 0; i < hits.size(); i++) {
+            sequential_.updateNode(hits[i], true, lazy_eval);
+        }
+        for (size_t i = 0; i < misses.size(); i++) {
+            sequential_.updateNode(misses[i], false, lazy_eval);
+        }
+        if (lazy_eval) {
+            sequential_.updateInnerOccupancy();
+        }
+
+        updater_.Clear();
+        updater_.AddHits(hits);
+        updater_.AddMisses(misses);
+        updater_.Apply(&bulk_, prune);
+    }
+
+    // Same number of nodes (so the same pruning), same log-odds at the keys and at the root
+    void ExpectSameTrees(const std::vector<octomap::OcTreeKey> &keys) const {
+        EXPECT_EQ(sequential_.size(), bulk_.size());
+        for (size_t i = 0; i < keys.size(); i++) {
+            const octomap::OcTreeNode *expected = sequential_.search(keys[i]);
+            const octomap::OcTreeNode *actual = bulk_.search(keys[i]);
+            ASSERT_TRUE(expected != NULL);
+            ASSERT_TRUE(actual != NULL) << "key " << i;
+            EXPECT_FLOAT_EQ(expected->getLogOdds(), actual->getLogOdds()) << "key " << i;
+        }
+        const octomap::OcTreeNode *expected_root = sequential_.getRoot();
+        const octomap::OcTreeNode *actual_root = bulk_.getRoot();
+        ASSERT_TRUE((expected_root != NULL) && (actual_root != NULL));
+        EXPECT_FLOAT_EQ(expected_root->getLogOdds(), actual_root->getLogOdds());
+    }
+
+    void ExpectSameAsUpdateNode(const bool &prune) {
+        std::vector<octomap::OcTreeKey> touched;
+        for (int batch = 0; batch < 30; batch++) {
+            // Early batches are mostly hits, later ones mostly misses
+            const std::vector<octomap::OcTreeKey> hits = RandomKeys((batch < 15) ? 3000 : 300, 8);
+            const std::vector<octomap::OcTreeKey> misses = RandomKeys((batch < 15) ? 300 : 3000, 8);
+            this->ApplyBatch(hits, misses, prune);
+            touched.insert(touched.end(), hits.begin(), hits.end());
+            touched.insert(touched.end(), misses.begin(), misses.end());
+            SCOPED_TRACE(batch);
+            this->ExpectSameTrees(touched);
+        }
+    }
+
+    octomap::OcTree sequential_, bulk_;
+    octoclass::BulkUpdater updater_;
+    std::mt19937 rng_;
+};
+
+}  // namespace
+
+TEST_F(BulkUpdateTest, MatchesUpdateNode) {
+    ExpectSameAsUpdateNode(false);
+}
+
+TEST_F(BulkUpdateTest, MatchesUpdateNodeWithPruning) {
+    ExpectSameAsUpdateNode(true);
+}
+
+int main(int argc, char **argv) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,152 @@
+/* Copyright (c) 2017, United States Government, as represented by the
+ * Administrator of the National Aeronautics and Space Administration.
+ *
+ * All rights reserved.
+ *
+ * The Astrobee platform is licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with the
+ * License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include "mapper/distance_field.h"
+
+namespace {
+
+// Binary fractions, so that the max distance is exactly 4 cells
+const double kResolution = 0.25;
+const double kMaxDistance = 1.0;
+const int kMaxDistSqr = 16;  // In cells
+
+// Field over a small box with obstacles that come and go, checked against
+// a brute force search over the obstacles after each update
+class DistanceFieldTest : public ::testing::Test {
+ protected:
+    DistanceFieldTest() : center_(32768, 32768, 32768), half_size_(10, 10, 6), rng_(1) {}
+
+    void SetUp() {
+        field_.Reset(center_, half_size_, kResolution, kMaxDistance);
+    }
+
+    octomap::OcTreeKey RandomKey() {
+        std::uniform_int_distribution<int> x(-half_size_[0], half_size_[0]);
+        std::uniform_int_distribution<int> y(-half_size_[1], half_size_[1]);
+        std::uniform_int_distribution<int> z(-half_size_[2], half_size_[2]);
+        return octomap::OcTreeKey(center_[0] + x(rng_), center_[1] + y(rng_), center_[2] + z(rng_));
+    }
+
+    // Squared distance (in cells) from key to the nearest obstacle (-1 if there are none)
+    int BruteForceDistSqr(const octomap::OcTreeKey &key) const {
+        int best = -1;
+        for (size_t i = 0; i < obstacles_.size(); i++) {
+            int dist_sqr = 0;
+            for (int j = 0; j < 3; j++) {
+                const int d = static_cast<int>(key[j]) - obstacles_[i][j];
+                dist_sqr += d*d;
+            }
+            if ((best < 0) || (dist_sqr < best)) {
+                best = dist_sqr;
+            }
+        }
+        return best;
+    }
+
+    void ExpectBruteForceDistances() const {
+        for (int x = -half_size_[0]; x <= half_size_[0]; x++) {
+            for (int y = -half_size_[1]; y <= half_size_[1]; y++) {
+                for (int z = -half_size_[2]; z <= half_size_[2]; z++) {
+                    const octomap::OcTreeKey key(center_[0] + x, center_[1] + y, center_[2] + z);
+                    const int expected = this->BruteForceDistSqr(key);
+                    double distance;
+                    octomap::OcTreeKey nearest;
+                    const bool found = field_.Distance(key, &distance, &nearest);
+                    if ((expected < 0) || (expected > kMaxDistSqr)) {
+                        EXPECT_FALSE(found) << "cell (" << x << ", " << y << ", " << z << ")";
+                        continue;
+                    }
+                    ASSERT_TRUE(found) << "cell (" << x << ", " << y << ", " << z << ")";
+                    EXPECT_DOUBLE_EQ(std::sqrt(static_cast<double>(expected))*kResolution, distance)
+                        << "cell (" << x << ", " << y << ", " << z << ")";
+                    // Nearest obstacle may be any of the ones at that distance
+                    int dist_sqr = 0;
+                    for (int j = 0; j < 3; j++) {
+                        const int d = static_cast<int>(key[j]) - nearest[j];
+                        dist_sqr += d*d;
+                    }
+                    EXPECT_EQ(expected, dist_sqr) << "cell (" << x << ", " << y << ", " << z << ")";
+                }
+            }
+        }
+    }
+
+    octoclass::DistanceField field_;
+    octomap::OcTreeKey center_;
+    Eigen::Vector3i half_size_;
+    std::mt19937 rng_;
+    std::vector<octomap::OcTreeKey> obstacles_;
+};
+
+}  // namespace
+
+TEST_F(DistanceFieldTest, EmptyFieldHasNoDistances) {
+    field_.Update();
+    ExpectBruteForceDistances();
+    double distance;
+    octomap::OcTreeKey nearest;
+    const octomap::OcTreeKey outside(center_[0] + half_size_[0] + 1, center_[1], center_[2]);
+    EXPECT_FALSE(field_.Contains(outside));
+    EXPECT_FALSE(field_.Distance(outside, &distance, &nearest));
+}
+
+TEST_F(DistanceFieldTest, MatchesBruteForceAsObstaclesChange) {
+    for (int round = 0; round < 20; round++) {
+        // Remove about a third of the obstacles and add new ones
+        std::vector<octomap::OcTreeKey> kept;
+        for (size_t i = 0; i < obstacles_.size(); i++) {
+            if (rng_() % 3 == 0) {
+                field_.RemoveObstacle(obstacles_[i]);
+            } else {
+                kept.push_back(obstacles_[i]);
+            }
+        }
+        obstacles_.swap(kept);
+        for (int i = 0; i < 8; i++) {
+            const octomap::OcTreeKey key = this->RandomKey();
+            if (this->BruteForceDistSqr(key) != 0) {
+                obstacles_.push_back(key);
+            }
+            field_.SetObstacle(key);
+        }
+        field_.Update();
+        SCOPED_TRACE(round);
+        ExpectBruteForceDistances();
+    }
+
+    // Removing every obstacle empties the field
+    for (size_t i = 0; i < obstacles_.size(); i++) {
+        field_.RemoveObstacle(obstacles_[i]);
+    }
+    obstacles_.clear();
+    field_.Update();
+    ExpectBruteForceDistances();
+}
+
+int main(int argc, char **argv) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,112 @@
+/* Copyright (c) 2017, United States Government, as represented by the
+ * Administrator of the National Aeronautics and Space Administration.
+ *
+ * All rights reserved.
+ *
+ * The Astrobee platform is licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with the
+ * License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+
+#include <gtest/gtest.h>
+
+#include <random>
+#include <set>
+#include <tuple>
+#include <vector>
+
+#include "mapper/flat_key_set.h"
+
+namespace {
+
+typedef std::tuple<int, int, int> KeyTuple;
+
+KeyTuple ToTuple(const octomap::OcTreeKey &key) {
+    return std::make_tuple(key[0], key[1], key[2]);
+}
+
+// Keys clustered around the center of the map (as from a scan), so that many repeat
+std::vector<octomap::OcTreeKey> RandomKeys(const size_t &n_keys, std::mt19937 *rng) {
+    std::uniform_int_distribution<int> coord(32768 - 20, 32768 + 20);
+    std::vector<octomap::OcTreeKey> keys(n_keys);
+    for (size_t i = 0; i < n_keys; i++) {
+        keys[i] = octomap::OcTreeKey(coord(*rng), coord(*rng), coord(*rng));
+    }
+    return keys;
+}
+
+}  // namespace
+
+// Insert and Contains agree with std::set, and the dense keys keep insertion order
+TEST(FlatKeySet, MatchesStdSet) {
+    std::mt19937 rng(1);
+    const std::vector<octomap::OcTreeKey> keys = RandomKeys(50000, &rng);
+    octoclass::FlatKeySet set;
+    std::set<KeyTuple> reference;
+    std::vector<KeyTuple> order;
+    for (size_t i = 0; i < keys.size(); i++) {
+        const bool inserted = reference.insert(ToTuple(keys[i])).second;
+        EXPECT_EQ(inserted, set.Insert(keys[i]));
+        if (inserted) {
+            order.push_back(ToTuple(keys[i]));
+        }
+    }
+    ASSERT_EQ(reference.size(), set.Size());
+    for (size_t i = 0; i < order.size(); i++) {
+        EXPECT_TRUE(order[i] == ToTuple(set.Keys()[i]));
+    }
+
+    const std::vector<octomap::OcTreeKey> queries = RandomKeys(10000, &rng);
+    for (size_t i = 0; i < queries.size(); i++) {
+        EXPECT_EQ(reference.count(ToTuple(queries[i])) > 0, set.Contains(queries[i]));
+    }
+    // Keys that only differ in the bits of one coordinate do not collide
+    EXPECT_FALSE(set.Contains(octomap::OcTreeKey(0, 0, 0)));
+    EXPECT_FALSE(set.Contains(octomap::OcTreeKey(65535, 65535, 65535)));
+}
+
+// Clear empties the set, including after the generation counter wraps around
+TEST(FlatKeySet, ClearForgetsKeys) {
+    const octomap::OcTreeKey a(1, 2, 3), b(3, 2, 1);
+    octoclass::FlatKeySet set(16);
+    EXPECT_FALSE(set.Contains(a));
+    for (int generation = 0; generation < 70000; generation++) {
+        const octomap::OcTreeKey &key = (generation % 2 == 0) ? a : b;
+        const octomap::OcTreeKey &other = (generation % 2 == 0) ? b : a;
+        ASSERT_TRUE(set.Insert(key)) << "generation " << generation;
+        ASSERT_FALSE(set.Insert(key));
+        ASSERT_FALSE(set.Contains(other)) << "generation " << generation;
+        set.Clear();
+        ASSERT_TRUE(set.Empty());
+        ASSERT_FALSE(set.Contains(key));
+    }
+}
+
+// Growing the table while filling it keeps every key, and inserting a set merges it
+TEST(FlatKeySet, GrowAndMerge) {
+    octoclass::FlatKeySet set, other;
+    for (int i = 0; i < 1000; i++) {
+        set.Insert(octomap::OcTreeKey(i, 0, 0));
+        other.Insert(octomap::OcTreeKey(i + 500, 0, 0));
+    }
+    set.Insert(other);
+    EXPECT_EQ(1500u, set.Size());
+    for (int i = 0; i < 1600; i++) {
+        EXPECT_EQ(i < 1500, set.Contains(octomap::OcTreeKey(i, 0, 0))) << i;
+    }
+}
+
+int main(int argc, char **argv) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
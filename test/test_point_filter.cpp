@@ -0,0 +1,125 @@
+/* Copyright (c) 2017, United States Government, as represented by the
+ * Administrator of the National Aeronautics and Space Administration.
+ *
+ * All rights reserved.
+ *
+ * The Astrobee platform is licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with the
+ * License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "mapper/point_filter.h"
+
+namespace {
+
+// Random points around the sensor, with invalid and out of range ones mixed in
+std::vector<float> RandomCloud(const size_t &n_points, std::mt19937 *rng) {
+    std::uniform_real_distribution<float> coord(-8.0, 8.0);
+    std::uniform_int_distribution<int> special(0, 19);
+    std::vector<float> xyz(3*n_points);
+    for (size_t i = 0; i < xyz.size(); i++) {
+        xyz[i] = coord(*rng);
+        switch (special(*rng)) {
+            case 0: xyz[i] = std::numeric_limits<float>::quiet_NaN(); break;
+            case 1: xyz[i] = std::numeric_limits<float>::infinity(); break;
+            case 2: xyz[i] = 1e30f; break;
+            case 3: xyz[i] *= 0.01f; break;  // Close to the sensor (min range)
+            default: break;
+        }
+    }
+    return xyz;
+}
+
+void ExpectSameOutput(const point_filter::FilteredPoints &expected,
+                      const point_filter::FilteredPoints &actual,
+                      const std::string &instruction_set) {
+    ASSERT_EQ(expected.size, actual.size) << instruction_set;
+    for (size_t i = 0; i < expected.size; i++) {
+        for (int j = 0; j < 3; j++) {
+            EXPECT_EQ(expected.keys[i][j], actual.keys[i][j]) << instruction_set << " point " << i;
+        }
+        EXPECT_EQ(expected.range_sqr[i], actual.range_sqr[i]) << instruction_set << " point " << i;
+    }
+}
+
+}  // namespace
+
+// Every SIMD path must give bitwise the same keys and ranges as the scalar one
+TEST(PointFilter, InstructionSetsMatchScalar) {
+    const std::vector<std::string> instruction_sets = point_filter::SupportedInstructionSets();
+    ASSERT_EQ("scalar", instruction_sets.back());
+    EXPECT_EQ(instruction_sets.front(), point_filter::InstructionSet());
+
+    std::mt19937 rng(1);
+    Eigen::Affine3d tf = Eigen::Affine3d::Identity();
+    tf.translation() << 1.3, -2.1, 0.7;
+    tf.rotate(Eigen::AngleAxisd(0.7, Eigen::Vector3d(1, 2, 3).normalized()));
+    algebra_3d::FrustumPlanes frustum(0.8, 1.3), world_frustum;
+    frustum.TransformFrustum(tf, &world_frustum);
+
+    point_filter::FilteredPoints scalar, simd;
+    for (int mode = 0; mode < 4; mode++) {
+        const bool camera = (mode & 1);
+        const bool map_3d = (mode < 2);
+        const point_filter::FilterParams params(tf, camera ? &world_frustum : NULL, map_3d, 0.3, 0.05, 16);
+        for (int it = 0; it < 200; it++) {
+            const uint32_t n_points = 1 + it*7;  // Partial blocks included
+            const std::vector<float> xyz = RandomCloud(n_points, &rng);
+            const cloud_view::XYZView cloud(xyz.data(), n_points);
+            ASSERT_TRUE(point_filter::FilterPoints(cloud, params, "scalar", &scalar));
+            for (size_t i = 0; i + 1 < instruction_sets.size(); i++) {
+                ASSERT_TRUE(point_filter::FilterPoints(cloud, params, instruction_sets[i], &simd));
+                ExpectSameOutput(scalar, simd, instruction_sets[i]);
+            }
+        }
+    }
+}
+
+// The scalar path matches octomap's coordinate to key conversion
+TEST(PointFilter, ScalarMatchesKeyConversion) {
+    const double resolution = 0.05;
+    const int tree_max_val = 1 << 15;
+    const float xyz[] = {0.0f, 0.0f, 0.0f,
+                         0.049f, -0.049f, 1.0f,
+                         -3.21f, 4.56f, -0.001f};
+    const cloud_view::XYZView cloud(xyz, 3);
+    const point_filter::FilterParams params(Eigen::Affine3d::Identity(), NULL, true, 0.0, resolution, 16);
+    point_filter::FilteredPoints out;
+    ASSERT_TRUE(point_filter::FilterPoints(cloud, params, "scalar", &out));
+    ASSERT_EQ(3u, out.size);
+    for (size_t i = 0; i < out.size; i++) {
+        for (int j = 0; j < 3; j++) {
+            const int key = static_cast<int>(std::floor(xyz[3*i + j]/resolution)) + tree_max_val;
+            EXPECT_EQ(key, out.keys[i][j]);
+        }
+    }
+}
+
+TEST(PointFilter, UnknownInstructionSet) {
+    const float xyz[] = {1.0f, 2.0f, 3.0f};
+    const point_filter::FilterParams params(Eigen::Affine3d::Identity(), NULL, true, 0.0, 0.05, 16);
+    point_filter::FilteredPoints out;
+    EXPECT_FALSE(point_filter::FilterPoints(cloud_view::XYZView(xyz, 1), params, "SSE9", &out));
+}
+
+int main(int argc, char **argv) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,116 @@
+/* Copyright (c) 2017, United States Government, as represented by the
+ * Administrator of the National Aeronautics and Space Administration.
+ *
+ * All rights reserved.
+ *
+ * The Astrobee platform is licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with the
+ * License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#include <gtest/gtest.h>
+#include <ros/time.h>
+
+#include <vector>
+
+#include "mapper/octoclass.h"
+
+namespace {
+
+const double kResolution = 0.1;
+const double kInflation = 0.3;
+
+// Map with a rolling window of 2 m around the origin, and one obstacle
+// whose stencil crosses the +x face of the window
+class RollingWindowTest : public ::testing::Test {
+ protected:
+    RollingWindowTest() : map_(kResolution, "world", true) {}
+
+    void SetUp() {
+        map_.SetMaxRange(10.0);
+        map_.SetMinRange(0.0);
+        map_.SetMapInflation(kInflation);
+        map_.SetRollingWindow(1.0, 1.0);
+        map_.MoveWindow(Eigen::Vector3d::Zero());
+
+        const float point[] = {0.95f, -0.45f, 0.05f};
+        map_.PclToRayOctomap(cloud_view::XYZView(point, 1), Eigen::Affine3d::Identity());
+        obstacle_ = map_.tree_.coordToKey(octomap::point3d(point[0], point[1], point[2]));
+        ASSERT_TRUE(map_.tree_.IsNodeOccupied(map_.tree_.Search(obstacle_, octoclass::kSlimLayer),
+                                              octoclass::kSlimLayer));
+    }
+
+    // Inflation count of the obstacle's stencil at an offset (0 outside of it)
+    static int ExpectedCount(const int &dx, const int &dy, const int &dz) {
+        const double x = dx*kResolution/kInflation, y = dy*kResolution/kInflation, z = dz*kResolution/kInflation;
+        return (x*x + y*y + z*z <= 1.0001) ? 1 : 0;
+    }
+
+    // Inflation count stored at an offset from the obstacle (0 if the node is not in the inflated map)
+    int Count(const int &dx, const int &dy, const int &dz) const {
+        const octomap::OcTreeKey key(obstacle_[0] + dx, obstacle_[1] + dy, obstacle_[2] + dz);
+        const octoclass::MergedNode *node = map_.tree_.Search(key, octoclass::kInflatedLayer);
+        return (node == NULL) ? 0 : node->GetInflation();
+    }
+
+    octoclass::OctoClass map_;
+    octomap::OcTreeKey obstacle_;
+};
+
+}  // namespace
+
+// Stencil nodes beyond the window are only counted once the window reaches them
+TEST_F(RollingWindowTest, EnteredNodesAreInflated) {
+    EXPECT_EQ(1, Count(1, 0, 0));
+    EXPECT_EQ(0, Count(2, 0, 0));  // Outside the window
+    EXPECT_EQ(0, Count(3, 0, 0));
+
+    // Window now spans [-0.4, 1.6] in x: the obstacle stays, its whole stencil is inside
+    map_.MoveWindow(Eigen::Vector3d(0.6, 0.0, 0.0));
+    ASSERT_TRUE(map_.tree_.IsNodeOccupied(map_.tree_.Search(obstacle_, octoclass::kSlimLayer),
+                                          octoclass::kSlimLayer));
+    for (int dx = -4; dx <= 4; dx++) {
+        for (int dy = -4; dy <= 4; dy++) {
+            for (int dz = -4; dz <= 4; dz++) {
+                EXPECT_EQ(ExpectedCount(dx, dy, dz), Count(dx, dy, dz))
+                    << "offset (" << dx << ", " << dy << ", " << dz << ")";
+            }
+        }
+    }
+}
+
+// Evicting the obstacle removes its inflation from the nodes that were counted,
+// and leaves no nodes in the part of its stencil that never was
+TEST_F(RollingWindowTest, EvictedObstacleIsDeflated) {
+    // Window spans [-0.4, 1.6] in x and y: the obstacle is evicted, but part
+    // of its stencil is in the window, both inside and beyond the previous one
+    map_.MoveWindow(Eigen::Vector3d(0.6, 0.6, 0.0));
+    EXPECT_TRUE(map_.tree_.Search(obstacle_, octoclass::kSlimLayer) == NULL);
+    for (int dx = -4; dx <= 4; dx++) {
+        for (int dy = -4; dy <= 4; dy++) {
+            for (int dz = -4; dz <= 4; dz++) {
+                EXPECT_EQ(0, Count(dx, dy, dz)) << "offset (" << dx << ", " << dy << ", " << dz << ")";
+                if (dx >= 2) {  // Beyond the previous window (and off the ray to the obstacle)
+                    const octomap::OcTreeKey key(obstacle_[0] + dx, obstacle_[1] + dy, obstacle_[2] + dz);
+                    EXPECT_TRUE(map_.tree_.search(key) == NULL)
+                        << "offset (" << dx << ", " << dy << ", " << dz << ")";
+                }
+            }
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    testing::InitGoogleTest(&argc, argv);
+    ros::Time::init();
+    return RUN_ALL_TESTS();
+}